@@ -0,0 +1,195 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+
+/* Standalone throughput benchmark for the psk_soft demodulator.
+ * Runs PskDemodCore outside of a REDHAWK domain on synthesized PSK data and reports
+ * Msamples/s and Msymbols/s for a sweep of constellation sizes and tracking settings.
+ * It also counts heap allocations per packet once the demodulator has warmed up, which should be zero.
+ *
+ * Usage: psk_benchmark [numSymbols] [packetSize] [avx2|sse2|scalar] [exact|fast] [all|bits] [maxenergy|gardner|leaky] [fit|loop] [cf32|sc16]
+ *
+ * With bits only the packed bits are produced, as when only bits_dataOctet_out is connected.
+ * With sc16 the samples are demodulated as complex 16 bit integers, as from dataShort_in.
+ */
+
+#include "psk_demod_core.h"
+#include "psk_simd_kernels.h"
+
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+//Count every heap allocation made by the process.
+static size_t allocations = 0;
+
+#if __cplusplus >= 201103L
+void* operator new(size_t size)
+#else
+void* operator new(size_t size) throw (std::bad_alloc)
+#endif
+{
+	allocations++;
+	void* ptr = malloc(size);
+	if (ptr==NULL)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void* ptr) throw()
+{
+	free(ptr);
+}
+
+#if __cplusplus >= 201402L
+//The sized delete C++14 calls has to go to the same free.
+void operator delete(void* ptr, size_t) throw()
+{
+	operator delete(ptr);
+}
+#endif
+
+static double now()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+//Generate numSymbols random symbols with a small frequency offset, a little noise
+//and a pulse shape which peaks in the middle of the symbol so the timing recovery has something to find.
+static void generatePsk(std::vector<std::complex<float> >& data, size_t numSymbols, size_t samplesPerBaud, size_t constellationSize)
+{
+	data.resize(numSymbols*samplesPerBaud);
+	double phase = 0.0;
+	const double freqOffset = 1e-4;
+	size_t k=0;
+	for (size_t i=0; i!=numSymbols; i++)
+	{
+		double symPhase = 2*M_PI*(rand()%constellationSize)/constellationSize;
+		for (size_t j=0; j!=samplesPerBaud; j++, k++)
+		{
+			double amp = sin(M_PI*(j+.5)/samplesPerBaud);
+			double noiseI = .05*(rand()/double(RAND_MAX)-.5);
+			double noiseQ = .05*(rand()/double(RAND_MAX)-.5);
+			data[k] = std::complex<float>(amp*cos(symPhase+phase)+noiseI, amp*sin(symPhase+phase)+noiseQ);
+			phase += freqOffset;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t numSymbols = (argc>1) ? strtoul(argv[1], NULL, 10) : 200000;
+	size_t packetSize = (argc>2) ? strtoul(argv[2], NULL, 10) : 16384;
+	if (argc>3 && !psk_simd::setInstructionSet(argv[3]))
+	{
+		fprintf(stderr, "instruction set %s is not supported\n", argv[3]);
+		return 1;
+	}
+	bool fastPhase = (argc>4 && strcmp(argv[4], "fast")==0);
+	unsigned int outputs = (argc>5 && strcmp(argv[5], "bits")==0) ? PSK_PACKED_BITS : PSK_ALL_OUTPUTS;
+	PskTimingMode timingMode = PSK_TIMING_MAX_ENERGY;
+	const char* timingName = "maxenergy";
+	if (argc>6 && strcmp(argv[6], "gardner")==0)
+	{
+		timingMode = PSK_TIMING_GARDNER;
+		timingName = "gardner";
+	}
+	else if (argc>6 && strcmp(argv[6], "leaky")==0)
+	{
+		timingMode = PSK_TIMING_LEAKY_ENERGY;
+		timingName = "leaky";
+	}
+	PskCarrierMode carrierMode = (argc>7 && strcmp(argv[7], "loop")==0) ? PSK_CARRIER_LOOP : PSK_CARRIER_POWER_FIT;
+	bool sc16 = (argc>8 && strcmp(argv[8], "sc16")==0);
+
+	const size_t constellationSizes[] = {2, 4, 8, 16};
+	const size_t samplesPerBauds[] = {2, 4, 8, 10, 16};
+	const size_t numAvgs[] = {10, 100};
+	const size_t phaseAvgs[] = {10, 50};
+
+	srand(100);
+	printf("instruction set: %s, phase math: %s, outputs: %s, timing: %s, carrier: %s, input: %s\n", psk_simd::instructionSet(), fastPhase ? "fast" : "exact",
+			outputs==PSK_ALL_OUTPUTS ? "all" : "bits", timingName, carrierMode==PSK_CARRIER_LOOP ? "loop" : "fit", sc16 ? "sc16" : "cf32");
+	printf("%-6s %6s %6s %8s %12s %12s %12s\n", "M", "sps", "numAvg", "phaseAvg", "Msamples/s", "Msymbols/s", "allocs/pkt");
+	std::vector<std::complex<float> > data;
+	std::vector<std::complex<short> > dataSc16;
+	PskDemodOutput out;
+	for (size_t m=0; m!=sizeof(constellationSizes)/sizeof(size_t); m++)
+	{
+		for (size_t s=0; s!=sizeof(samplesPerBauds)/sizeof(size_t); s++)
+		{
+			generatePsk(data, numSymbols, samplesPerBauds[s], constellationSizes[m]);
+			if (sc16)
+			{
+				//Half of full scale leaves room for the noise.
+				dataSc16.resize(data.size());
+				for (size_t i=0; i!=data.size(); i++)
+					dataSc16[i] = std::complex<short>(lrint(data[i].real()*16384), lrint(data[i].imag()*16384));
+			}
+			for (size_t a=0; a!=sizeof(numAvgs)/sizeof(size_t); a++)
+			{
+				for (size_t p=0; p!=sizeof(phaseAvgs)/sizeof(size_t); p++)
+				{
+					PskDemodCore demod;
+					demod.setTimingMode(timingMode);
+					demod.setCarrierMode(carrierMode);
+					demod.setSamplesPerBaud(samplesPerBauds[s]);
+					demod.setNumAvg(numAvgs[a]);
+					demod.setConstellationSize(constellationSizes[m]);
+					demod.setPhaseAvg(phaseAvgs[p]);
+					demod.setSampleRate(1e6);
+					demod.setFastPhase(fastPhase);
+					demod.setOutputs(outputs);
+
+					size_t symbolsOut=0;
+					size_t bitsOut=0;
+					//Only count allocations for the second half of the packets, once all the buffers have grown.
+					const size_t numPackets = (data.size()+packetSize-1)/packetSize;
+					const size_t warmupPackets = numPackets/2;
+					size_t warmAllocations=0;
+					double start = now();
+					for (size_t i=0, packet=0; i<data.size(); i+=packetSize, packet++)
+					{
+						if (packet==warmupPackets)
+							warmAllocations=allocations;
+						if (sc16)
+							demod.process(&dataSc16[i], std::min(packetSize, data.size()-i), out);
+						else
+							demod.process(&data[i], std::min(packetSize, data.size()-i), out);
+						symbolsOut+=out.softDecisions.size();
+						bitsOut+=out.packedBits.size()*8;
+					}
+					double elapsed = now()-start;
+					//Without the soft decisions count the symbols from the bits.
+					if (!(outputs & PSK_SOFT_DECISIONS))
+						symbolsOut = bitsOut/demod.bitsPerBaud();
+					double allocsPerPacket = double(allocations-warmAllocations)/(numPackets-warmupPackets);
+					printf("%-6lu %6lu %6lu %8lu %12.2f %12.2f %12.2f\n", (unsigned long)constellationSizes[m], (unsigned long)samplesPerBauds[s],
+							(unsigned long)numAvgs[a], (unsigned long)phaseAvgs[p], data.size()/elapsed*1e-6, symbolsOut/elapsed*1e-6, allocsPerPacket);
+				}
+			}
+		}
+	}
+	return 0;
+}
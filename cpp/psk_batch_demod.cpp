@@ -0,0 +1,434 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+#include "psk_batch_demod.h"
+
+#include <algorithm>
+#include <cmath>
+
+//Symbols compared at each chunk boundary.
+static const size_t compareSymbols = 32;
+//How far either way of the symbol count the Gardner timing's symbols are looked for at a boundary.
+static const size_t searchSymbols = 2;
+//Largest power of the difference between two chunks' soft decisions on the symbols they share, relative to their power,
+//for them to count as matching.  The LLR scales of the packet they share are held to the same.
+static const double matchError = 1e-6;
+//Each thread can be this many chunks ahead of the one being stitched, which bounds the output held in memory.
+static const size_t chunksAheadPerThread = 2;
+
+static size_t greatestCommonDivisor(size_t a, size_t b)
+{
+	while (b!=0)
+	{
+		const size_t r = a%b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+//Round value up to a multiple of step.
+static size_t roundUp(size_t value, size_t step)
+{
+	return (value+step-1)/step*step;
+}
+
+//The packet holding symbol of the packets' output, with index set to the symbol's position in it, or NULL past the end.
+static const PskDemodOutput* findSymbol(const std::vector<PskDemodOutput>& packets, size_t symbol, size_t& packet, size_t& index)
+{
+	for (packet=0; packet!=packets.size(); packet++)
+	{
+		if (symbol<packets[packet].numSymbols)
+		{
+			index = symbol;
+			return &packets[packet];
+		}
+		symbol -= packets[packet].numSymbols;
+	}
+	return NULL;
+}
+
+//Copy count soft decisions of the packets' output from symbol first on into soft, returning false if there are not that many.
+static bool gatherSoft(const std::vector<PskDemodOutput>& packets, size_t first, size_t count, std::vector<std::complex<float> >& soft)
+{
+	soft.clear();
+	size_t packet;
+	size_t index;
+	if (findSymbol(packets, first, packet, index)==NULL)
+		return false;
+	for (; packet!=packets.size() && soft.size()!=count; packet++, index=0)
+	{
+		const std::vector<std::complex<float> >& from = packets[packet].softDecisions;
+		const size_t len = std::min(from.size()-index, count-soft.size());
+		soft.insert(soft.end(), from.begin()+index, from.begin()+index+len);
+	}
+	return soft.size()==count;
+}
+
+//Append the entries of from for the symbols from first on, perSymbol entries each, if there are any.
+template <typename T>
+static void appendSymbols(const std::vector<T>& from, size_t first, size_t perSymbol, std::vector<T>& to)
+{
+	if (from.size()>first*perSymbol)
+		to.insert(to.end(), from.begin()+first*perSymbol, from.end());
+}
+
+//Keep the last count entries of values.
+template <typename T>
+static void keepLast(std::vector<T>& values, size_t count)
+{
+	if (values.size()>count)
+		values.erase(values.begin(), values.end()-count);
+}
+
+PskBatchDemod::Chunk::Chunk() :
+	start(0),
+	own(0),
+	end(0),
+	done(false),
+	first(0),
+	firstPacket(0),
+	turns(0)
+{
+}
+
+PskBatchDemod::PskBatchDemod() :
+	numThreads(0),
+	chunkSamples(1<<22),
+	packetSamples(16384),
+	outputs(0),
+	nextChunk(0),
+	stitchedChunks(0),
+	maxChunksAhead(0),
+	stopped(false),
+	tailLlrScale(0.0f),
+	lastTurns(0),
+	partialOctet(0),
+	partialOctetBits(0)
+{
+}
+
+void PskBatchDemod::setThreads(size_t threads)
+{
+	numThreads = threads;
+}
+
+void PskBatchDemod::setChunkSamples(size_t samples)
+{
+	chunkSamples = samples;
+}
+
+void PskBatchDemod::setPacketSamples(size_t samples)
+{
+	packetSamples = std::max(samples, size_t(1));
+}
+
+size_t PskBatchDemod::overlapSamples(const PskDemodCore& demod) const
+{
+	//The Gardner timing's symbols may be found a few either way of where the count says.
+	const size_t search = (demod.timing()==PSK_TIMING_GARDNER) ? 2*searchSymbols : 0;
+	return size_t(ceil((demod.warmupSymbols()+compareSymbols+search+1)*demod.samplesPerOutputSymbol()));
+}
+
+bool PskBatchDemod::process(const PskDemodCore& demod, const std::complex<float>* data, size_t len, PskBatchSink& sink)
+{
+	return run(demod, data, len, sink);
+}
+
+bool PskBatchDemod::process(const PskDemodCore& demod, const std::complex<short>* data, size_t len, PskBatchSink& sink)
+{
+	return run(demod, data, len, sink);
+}
+
+void PskBatchDemod::planChunks(size_t len, size_t threads)
+{
+	//The chunks end on the packet boundaries of serial demodulation.  The max energy timing's symbols fall on a grid
+	//of samplesPerBaud from the start of the buffer, so the chunks start on it as well.
+	size_t grid = packetSamples;
+	if (prototype.timing()!=PSK_TIMING_GARDNER)
+		grid = packetSamples/greatestCommonDivisor(packetSamples, prototype.samplesPerBaud())*prototype.samplesPerBaud();
+	const size_t overlap = overlapSamples(prototype);
+	//Share a short buffer out between the threads, but keep the chunks long enough that the overlaps stay a small part of the work.
+	size_t samples = std::min(chunkSamples, (len+threads-1)/threads);
+	samples = roundUp(std::max(samples, std::max(4*overlap, size_t(1))), packetSamples);
+	const size_t numChunks = std::max((len+samples-1)/samples, size_t(1));
+	chunks.assign(numChunks, Chunk());
+	for (size_t k=0; k!=numChunks; k++)
+	{
+		Chunk& chunk = chunks[k];
+		chunk.own = k*samples;
+		chunk.end = std::min(len, chunk.own+samples);
+		chunk.start = (chunk.own>overlap) ? (chunk.own-overlap)/grid*grid : 0;
+	}
+}
+
+template <typename Sample>
+bool PskBatchDemod::run(const PskDemodCore& demod, const Sample* data, size_t len, PskBatchSink& sink)
+{
+	//The stitching needs the soft decisions to rotate and line up the chunks, and the phase wherever it is tracked
+	//for the carrier phase ambiguity.  The bits are packed here as the chunks' octets do not line up.
+	prototype = demod;
+	outputs = demod.enabledOutputs();
+	unsigned int chunkOutputs = (outputs & ~PSK_PACKED_BITS) | PSK_SOFT_DECISIONS;
+	if (outputs & PSK_PACKED_BITS)
+		chunkOutputs |= PSK_BITS;
+	if (!demod.differential())
+		chunkOutputs |= PSK_PHASE;
+	prototype.setOutputs(chunkOutputs);
+	//Bursts would start the chunks at different places from serial demodulation, so the whole buffer is demodulated.
+	prototype.setPresenceGating(false);
+
+	const size_t threadCount = std::max(numThreads ? numThreads : size_t(boost::thread::hardware_concurrency()), size_t(1));
+	planChunks(len, threadCount);
+	nextChunk = 0;
+	stitchedChunks = 0;
+	maxChunksAhead = chunksAheadPerThread*threadCount;
+	stopped = false;
+	tailSoft.clear();
+	tailPhase.clear();
+	tailLlrScale = 0.0f;
+	lastTurns = 0;
+	partialOctet = 0;
+	partialOctetBits = 0;
+	workStats.clear();
+
+	std::vector<boost::thread*> threads;
+	for (size_t i=0; i!=std::min(threadCount, chunks.size()); i++)
+		threads.push_back(new boost::thread(&PskBatchDemod::runWorker<Sample>, this, data));
+	bool ok = true;
+	for (size_t k=0; k!=chunks.size() && ok; k++)
+	{
+		{
+			boost::mutex::scoped_lock lock(chunkLock);
+			while (!chunks[k].done)
+				chunkChanged.wait(lock);
+		}
+		Chunk& chunk = chunks[k];
+		workStats += chunk.demod.stats();
+		if (!lineUp(chunk))
+		{
+			//Demodulate the chunk's own part again from where the chunk before finished, which serial demodulation would match.
+			chunk.start = chunk.own;
+			chunk.demod = lastDemod;
+			chunk.demod.clearStats();
+			demodulate(chunk, data);
+			workStats += chunk.demod.stats();
+			chunk.first = 0;
+			chunk.firstPacket = 0;
+			chunk.turns = lastTurns;
+		}
+		ok = stitch(chunk, sink);
+		lastDemod = chunk.demod;
+		std::vector<PskDemodOutput>().swap(chunk.packets);
+		chunk.demod = PskDemodCore();
+		boost::mutex::scoped_lock lock(chunkLock);
+		stitchedChunks = k+1;
+		stopped = !ok;
+		chunkChanged.notify_all();
+	}
+	for (size_t i=0; i!=threads.size(); i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+	std::vector<Chunk>().swap(chunks);
+	if (ok && partialOctetBits!=0)
+	{
+		//Pad the last octet with zeros.
+		piece.clear();
+		piece.packedBits.push_back(partialOctet<<(8-partialOctetBits));
+		partialOctetBits = 0;
+		ok = sink.write(piece);
+	}
+	return ok;
+}
+
+template <typename Sample>
+void PskBatchDemod::runWorker(const Sample* data)
+{
+	for (;;)
+	{
+		size_t k;
+		{
+			boost::mutex::scoped_lock lock(chunkLock);
+			while (!stopped && nextChunk!=chunks.size() && nextChunk>=stitchedChunks+maxChunksAhead)
+				chunkChanged.wait(lock);
+			if (stopped || nextChunk==chunks.size())
+				return;
+			k = nextChunk++;
+		}
+		//Only this thread touches the chunk until it is done.
+		Chunk& chunk = chunks[k];
+		chunk.demod = prototype;
+		chunk.demod.setSamplePosition(chunk.start);
+		demodulate(chunk, data);
+		boost::mutex::scoped_lock lock(chunkLock);
+		chunk.done = true;
+		chunkChanged.notify_all();
+	}
+}
+
+template <typename Sample>
+void PskBatchDemod::demodulate(Chunk& chunk, const Sample* data)
+{
+	chunk.packets.resize((chunk.end-chunk.start+packetSamples-1)/packetSamples);
+	for (size_t i=chunk.start, p=0; i<chunk.end; i+=packetSamples, p++)
+		chunk.demod.process(data+i, std::min(packetSamples, chunk.end-i), chunk.packets[p]);
+}
+
+size_t PskBatchDemod::firstNewSymbol(const Chunk& chunk, size_t covered) const
+{
+	if (prototype.timing()!=PSK_TIMING_GARDNER || tailSoft.size()<compareSymbols)
+		return covered;
+	//The Gardner timing's symbols are matched up by the soft decisions, allowing for the carrier phase ambiguity.
+	std::vector<std::complex<float> > soft;
+	size_t best = covered;
+	double bestError = HUGE_VAL;
+	for (size_t first=std::max(covered, compareSymbols+searchSymbols)-searchSymbols; first<=covered+searchSymbols; first++)
+	{
+		if (!gatherSoft(chunk.packets, first-compareSymbols, compareSymbols, soft))
+			break;
+		double power = 0.0;
+		std::complex<double> correlation(0.0, 0.0);
+		for (size_t i=0; i!=compareSymbols; i++)
+		{
+			power += norm(tailSoft[i])+norm(soft[i]);
+			correlation += std::complex<double>(tailSoft[i]*conj(soft[i]));
+		}
+		const double error = power-2*abs(correlation);
+		if (error<bestError)
+		{
+			bestError = error;
+			best = first;
+		}
+	}
+	return best;
+}
+
+bool PskBatchDemod::lineUp(Chunk& chunk) const
+{
+	//The symbols the chunk put out by the start of its own part of the buffer were put out by the chunk before too.
+	size_t covered = 0;
+	size_t coveredPackets = 0;
+	for (; coveredPackets!=chunk.packets.size() && chunk.start+(coveredPackets+1)*packetSamples<=chunk.own; coveredPackets++)
+		covered += chunk.packets[coveredPackets].numSymbols;
+	chunk.first = (chunk.start==chunk.own) ? 0 : firstNewSymbol(chunk, covered);
+	chunk.firstPacket = 0;
+	chunk.turns = 0;
+	if (chunk.first==0)
+		return true;
+
+	//Work out the turns of the carrier phase from the chunk before on the last symbol both put out before the boundary.
+	//This is compared before either has wrapped its phase at the end of the packet, so the turns can be followed
+	//through the wraps from there.
+	const size_t shared = std::min(chunk.first, covered)-1;
+	size_t index;
+	const PskDemodOutput* out = findSymbol(chunk.packets, shared, chunk.firstPacket, index);
+	const size_t back = chunk.first-1-shared;
+	if (out!=NULL && !out->phase.empty() && back<tailPhase.size())
+		chunk.turns = lround((tailPhase[tailPhase.size()-1-back]-out->phase[index])/(2*M_PI));
+
+	//The wraps are whole turns of the symbols, so the symbols before the boundary all rotate the same way.
+	const size_t count = std::min(tailSoft.size(), chunk.first);
+	PskDemodOutput compare;
+	if (!gatherSoft(chunk.packets, chunk.first-count, count, compare.softDecisions))
+		return false;
+	prototype.rotateOutput(compare, chunk.turns);
+	double power = 0.0;
+	double error = 0.0;
+	for (size_t i=0; i!=count; i++)
+	{
+		const std::complex<float>& tail = tailSoft[tailSoft.size()-count+i];
+		power += norm(tail)+norm(compare.softDecisions[i]);
+		error += norm(tail-compare.softDecisions[i]);
+	}
+	if (error>matchError*power)
+		return false;
+	//The LLRs are scaled by statistics which can take longer to settle.
+	if ((outputs & (PSK_LLRS|PSK_QUANTIZED_LLRS)) && coveredPackets!=0)
+	{
+		const double scaleError = chunk.packets[coveredPackets-1].llrScale-tailLlrScale;
+		return scaleError*scaleError<=matchError*tailLlrScale*tailLlrScale;
+	}
+	return true;
+}
+
+bool PskBatchDemod::stitch(Chunk& chunk, PskBatchSink& sink)
+{
+	size_t symbol = 0;
+	for (size_t p=0; p!=chunk.firstPacket; p++)
+		symbol += chunk.packets[p].numSymbols;
+	long turns = chunk.turns;
+	for (size_t packet=chunk.firstPacket; packet!=chunk.packets.size(); packet++)
+	{
+		PskDemodOutput& out = chunk.packets[packet];
+		const float lastPhase = out.phase.empty() ? 0.0f : out.phase.back();
+		prototype.rotateOutput(out, turns);
+		if (!emit(out, (chunk.first>symbol) ? std::min(chunk.first-symbol, out.numSymbols) : 0, sink))
+			return false;
+		symbol += out.numSymbols;
+		//The chunk and serial demodulation each wrap the phase fit's estimate at the end of the packet.
+		if (!out.phase.empty())
+			turns += prototype.phaseWrapTurns(lastPhase)-prototype.phaseWrapTurns(out.phase.back());
+	}
+	lastTurns = turns;
+	return true;
+}
+
+bool PskBatchDemod::emit(const PskDemodOutput& packet, size_t first, PskBatchSink& sink)
+{
+	const size_t bitsPerSymbol = prototype.bitsPerBaud();
+	piece.clear();
+	piece.numSymbols = packet.numSymbols-first;
+	piece.llrScale = packet.llrScale;
+	tailLlrScale = packet.llrScale;
+	if (piece.numSymbols==0)
+		return true;
+	if (outputs & PSK_SOFT_DECISIONS)
+		appendSymbols(packet.softDecisions, first, 1, piece.softDecisions);
+	if (outputs & PSK_BITS)
+		appendSymbols(packet.bits, first, bitsPerSymbol, piece.bits);
+	if (outputs & PSK_PHASE)
+		appendSymbols(packet.phase, first, 1, piece.phase);
+	if (outputs & PSK_SAMPLE_INDEX)
+		appendSymbols(packet.sampleIndex, first, 1, piece.sampleIndex);
+	if (outputs & PSK_LLRS)
+		appendSymbols(packet.llrs, first, bitsPerSymbol, piece.llrs);
+	if (outputs & PSK_QUANTIZED_LLRS)
+		appendSymbols(packet.quantizedLlrs, first, bitsPerSymbol, piece.quantizedLlrs);
+	if (outputs & PSK_PACKED_BITS)
+	{
+		//Pack the bits most significant bit first, carrying any partial octet over to the next piece.
+		for (size_t i=first*bitsPerSymbol; i<packet.bits.size(); i++)
+		{
+			partialOctet = (partialOctet<<1) | packet.bits[i];
+			if (++partialOctetBits==8)
+			{
+				piece.packedBits.push_back(partialOctet);
+				partialOctet = 0;
+				partialOctetBits = 0;
+			}
+		}
+	}
+	appendSymbols(packet.softDecisions, first, 1, tailSoft);
+	keepLast(tailSoft, compareSymbols);
+	appendSymbols(packet.phase, first, 1, tailPhase);
+	keepLast(tailPhase, compareSymbols);
+	return sink.write(piece);
+}
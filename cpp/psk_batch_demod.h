@@ -0,0 +1,141 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+#ifndef PSK_BATCH_DEMOD_H
+#define PSK_BATCH_DEMOD_H
+
+#include "psk_demod_core.h"
+
+#include <boost/thread.hpp>
+#include <vector>
+
+/* Receiver for the output of PskBatchDemod, which hands it over a piece at a time in stream order. */
+class PskBatchSink
+{
+public:
+	virtual ~PskBatchSink() {}
+	//Take the next piece of the output.  Returning false stops the demodulation.
+	virtual bool write(const PskDemodOutput& out) = 0;
+};
+
+/* Parallel demodulation of a large buffer held in memory, such as a memory mapped capture.
+ * The buffer is split into chunks which are demodulated on all cores by copies of a configured PskDemodCore.
+ * Each chunk starts early by an overlap covering the demodulator's warm-up (PskDemodCore::warmupSymbols())
+ * and a few more symbols to compare with the chunk before, and its output from the overlap is dropped.
+ * At each boundary the chunks are lined up symbol for symbol - by counting the symbols both put out up to the boundary,
+ * and for the Gardner timing, whose symbols do not fall on a fixed grid, by then matching up the soft decisions.
+ * The carrier phase ambiguity is taken from the phase outputs on the last symbol they share and the chunk's output
+ * is rotated by it (PskDemodCore::rotateOutput()), so its phase carries on from the chunk before.
+ *
+ * If the chunks' soft decisions or LLR scales still differ on the symbols they share, as when the demodulator has not locked on
+ * within warmupSymbols() of the chunk starting, the chunk is demodulated again on the stitching thread, carrying on
+ * from where the chunk before finished.
+ *
+ * The chunks keep to the packets serial demodulation would use, so the stitched output is what the demodulator would put out
+ * for the buffer a packet at a time from where it was configured, apart from floating point rounding.  The exception
+ * is a carrier loop slipping a cycle soon after a chunk boundary, which the rounding can tip the other way in the chunk.
+ * Presence gating is turned off in the copies, so the whole buffer is demodulated.
+ */
+class PskBatchDemod
+{
+public:
+	PskBatchDemod();
+	//Threads to demodulate on - 0, the default, uses one per core.
+	void setThreads(size_t numThreads);
+	//Samples per chunk.  This is rounded up to whole packets and to at least four overlaps, and down to share out short buffers.
+	void setChunkSamples(size_t samples);
+	//Samples per packet of the serial demodulation to match.
+	void setPacketSamples(size_t samples);
+	//Samples each chunk starts ahead of its part of the buffer with demod's settings.
+	size_t overlapSamples(const PskDemodCore& demod) const;
+
+	//Demodulate len samples with copies of demod, handing the output to sink in order.
+	//The outputs are the ones demod is set up for, and the last packed bits are padded out to an octet as at the end of a stream.
+	//Returns false if the sink stopped the demodulation.
+	bool process(const PskDemodCore& demod, const std::complex<float>* data, size_t len, PskBatchSink& sink);
+	bool process(const PskDemodCore& demod, const std::complex<short>* data, size_t len, PskBatchSink& sink);
+
+	//Work done by all the threads in the last call to process, including the overlaps.
+	const PskDemodStats& stats() const {return workStats;}
+
+private:
+	struct Chunk
+	{
+		Chunk();
+		//Samples demodulated, from the start of the overlap, and where the chunk's own part of the buffer starts.
+		size_t start;
+		size_t own;
+		size_t end;
+		//Output of each packet, and the demodulator where it finished.
+		std::vector<PskDemodOutput> packets;
+		PskDemodCore demod;
+		bool done;
+		//First symbol to hand on, the packet to start following the carrier phase turns from and the turns there.
+		size_t first;
+		size_t firstPacket;
+		long turns;
+	};
+	template <typename Sample>
+	bool run(const PskDemodCore& demod, const Sample* data, size_t len, PskBatchSink& sink);
+	template <typename Sample>
+	void runWorker(const Sample* data);
+	//Demodulate the chunk's samples from its start a packet at a time with its demodulator.
+	template <typename Sample>
+	void demodulate(Chunk& chunk, const Sample* data);
+	void planChunks(size_t len, size_t threads);
+	//Line a finished chunk up with the one before, returning false if their output does not match.
+	bool lineUp(Chunk& chunk) const;
+	//Hand the output of a lined up chunk on.
+	bool stitch(Chunk& chunk, PskBatchSink& sink);
+	//First symbol of the chunk which the chunk before did not put out.
+	size_t firstNewSymbol(const Chunk& chunk, size_t covered) const;
+	//Hand on the output of a packet from symbol first on.
+	bool emit(const PskDemodOutput& packet, size_t first, PskBatchSink& sink);
+
+	size_t numThreads;
+	size_t chunkSamples;
+	size_t packetSamples;
+
+	//The demodulator the chunks are copied from, set up for the outputs the stitching needs as well as the wanted ones.
+	PskDemodCore prototype;
+	unsigned int outputs;
+	std::vector<Chunk> chunks;
+	//Next chunk for a thread to demodulate, and the number handed on to the sink.
+	size_t nextChunk;
+	size_t stitchedChunks;
+	size_t maxChunksAhead;
+	bool stopped;
+	boost::mutex chunkLock;
+	boost::condition_variable chunkChanged;
+
+	//The last symbols handed on, for lining up the next chunk.
+	std::vector<std::complex<float> > tailSoft;
+	std::vector<float> tailPhase;
+	float tailLlrScale;
+	//The demodulator of the last chunk handed on and the turns its output was rotated by at the end, for carrying on from it.
+	PskDemodCore lastDemod;
+	long lastTurns;
+	//Bits which did not fill an octet.
+	unsigned int partialOctet;
+	size_t partialOctetBits;
+	PskDemodOutput piece;
+	PskDemodStats workStats;
+};
+
+#endif
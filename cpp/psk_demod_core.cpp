@@ -0,0 +1,2243 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "psk_demod_core.h"
+#include "psk_simd_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <time.h>
+
+static const double M_2PI = 2*M_PI;
+
+/* Per constellation size operations for the symbol kernels.
+ * power() raises a sample to the constellation size and slice() converts a phase corrected symbol to the number of its
+ * nearest point, counting counterclockwise from the point at 0, which the symbol maps turn into bits.
+ * Constellation<0> is the fallback for unsupported constellation sizes which produces no bits.
+ */
+template <size_t M>
+struct Constellation;
+
+/* Slicing on the angle of the symbol, for the constellations with points at multiples of 2pi/M.
+ * The angle is quantized to the nearest multiple, which wraps round to a point number with the low bits.
+ */
+template <size_t M>
+struct AngleSlicer
+{
+	static unsigned int slice(const std::complex<float>& symbol)
+	{
+		//arg returns a number between -pi and pi.  Phases near -pi and near pi map to the same point.
+		return sliceAngle(arg(symbol));
+	}
+	static unsigned int sliceAngle(float theta)
+	{
+		//Convert the phase to soft symbols -M/2 <=softsym <= M/2 and round to the closest integer.
+		//Both -1 and M-1 have the same low bits, as do M/2 and -M/2, so the negative numbers wrap over to the same points.
+		const int sym = round(theta*(M/M_2PI));
+		return sym&(M-1);
+	}
+	static std::complex<float> nearest(const std::complex<float>& symbol, size_t)
+	{
+		const float step = M_2PI/M;
+		return std::polar(1.0f, float(step*round(arg(symbol)/step)));
+	}
+};
+
+template <>
+struct Constellation<0>
+{
+	static const size_t bitsPerSymbol = 0;
+	static std::complex<float> power(const std::complex<float>& sample, size_t numSyms)
+	{
+		return std::complex<float>(pow(sample,int(numSyms)));
+	}
+	static unsigned int slice(const std::complex<float>&)
+	{
+		return 0;
+	}
+	static std::complex<float> nearest(const std::complex<float>& symbol, size_t numSyms)
+	{
+		const float step = M_2PI/numSyms;
+		return std::polar(1.0f, float(step*round(arg(symbol)/step)));
+	}
+};
+
+template <>
+struct Constellation<2>
+{
+	static const size_t bitsPerSymbol = 1;
+	static std::complex<float> power(const std::complex<float>& sample, size_t)
+	{
+		return sample*sample;
+	}
+	static unsigned int slice(const std::complex<float>& symbol)
+	{
+		//
+		//                  |             // A -> 0
+		//                  |             // B -> 1
+		//             B---------A
+		//                  |
+		//                  |
+
+		return (symbol.real()<0);
+	}
+	//The nearest of the points at multiples of 2pi/M, before slice()'s rotation for QPSK.
+	static std::complex<float> nearest(const std::complex<float>& symbol, size_t)
+	{
+		return std::complex<float>(symbol.real()<0 ? -1.0f : 1.0f, 0.0f);
+	}
+};
+
+template <>
+struct Constellation<4>
+{
+	static const size_t bitsPerSymbol = 2;
+	static std::complex<float> power(const std::complex<float>& sample, size_t)
+	{
+		std::complex<float> squared = sample*sample;
+		return squared*squared;
+	}
+	static unsigned int slice(const std::complex<float>& symbol)
+	{
+		//The symbols are rotated by pi/4 for slicing, so the points are in the middle of the quadrants.
+		//
+		//             B    |    A         // A -> 0
+		//                  |              // B -> 1
+		//              ---------          // C -> 2
+		//                  |              // D -> 3
+		//             C    |    D
+
+		bool real = symbol.real()>0;
+		bool imag = symbol.imag()>0;
+		//The low bit is real ^ imag and the high bit is not imag.
+		return (real ^ imag) | (!imag)<<1;
+	}
+	static std::complex<float> nearest(const std::complex<float>& symbol, size_t)
+	{
+		if (std::abs(symbol.real())>=std::abs(symbol.imag()))
+			return std::complex<float>(symbol.real()<0 ? -1.0f : 1.0f, 0.0f);
+		return std::complex<float>(0.0f, symbol.imag()<0 ? -1.0f : 1.0f);
+	}
+};
+
+template <>
+struct Constellation<8> : AngleSlicer<8>
+{
+	static const size_t bitsPerSymbol = 3;
+	static std::complex<float> power(const std::complex<float>& sample, size_t)
+	{
+		std::complex<float> squared = sample*sample;
+		std::complex<float> fourth = squared*squared;
+		return fourth*fourth;
+	}
+	//
+	//                  C
+	//             D    |    B         // A -> 0   E -> 4
+	//                  |              // B -> 1   F -> 5
+	//            E  --------- A       // C -> 2   G -> 6
+	//                  |              // D -> 3   H -> 7
+	//             F    |    H
+	//                  G
+	static std::complex<float> nearest(const std::complex<float>& symbol, size_t)
+	{
+		//Points on the axes are within pi/8 of them, the rest are on the diagonals.
+		const float tanPi8 = 0.41421356f;
+		const float x = std::abs(symbol.real());
+		const float y = std::abs(symbol.imag());
+		const float re = symbol.real()<0 ? -1.0f : 1.0f;
+		const float im = symbol.imag()<0 ? -1.0f : 1.0f;
+		if (y<x*tanPi8)
+			return std::complex<float>(re, 0.0f);
+		if (x<y*tanPi8)
+			return std::complex<float>(0.0f, im);
+		return std::complex<float>(re*M_SQRT1_2, im*M_SQRT1_2);
+	}
+};
+
+template <>
+struct Constellation<16> : AngleSlicer<16>
+{
+	static const size_t bitsPerSymbol = 4;
+	static std::complex<float> power(const std::complex<float>& sample, size_t)
+	{
+		std::complex<float> squared = sample*sample;
+		std::complex<float> fourth = squared*squared;
+		std::complex<float> eighth = fourth*fourth;
+		return eighth*eighth;
+	}
+};
+
+/* Slicing for the fast phase kernels.
+ * 8PSK and 16PSK are sliced on the angle of the symbols so they use the approximate arg for the whole block.
+ */
+template <size_t M>
+struct FastSlicer
+{
+	static void slice(const std::complex<float>* symbols, size_t numSymbols, unsigned char* values, std::vector<float>&)
+	{
+		for (size_t i=0; i!=numSymbols; i++)
+			values[i] = Constellation<M>::slice(symbols[i]);
+	}
+};
+
+template <size_t M>
+struct FastAngleSlicer
+{
+	static void slice(const std::complex<float>* symbols, size_t numSymbols, unsigned char* values, std::vector<float>& angles)
+	{
+		angles.resize(numSymbols);
+		psk_simd::fastArg(symbols, &angles[0], numSymbols);
+		for (size_t i=0; i!=numSymbols; i++)
+			values[i] = Constellation<M>::sliceAngle(angles[i]);
+	}
+};
+
+template <>
+struct FastSlicer<8> : FastAngleSlicer<8> {};
+
+template <>
+struct FastSlicer<16> : FastAngleSlicer<16> {};
+
+template <size_t M>
+static void sliceFast(const std::complex<float>* symbols, size_t numSymbols, unsigned char* values, std::vector<float>& angles)
+{
+	FastSlicer<M>::slice(symbols, numSymbols, values, angles);
+}
+
+//The history is held in fixed point with the largest scale for which the sums cannot overflow,
+//given a history of numPts points with magnitudes up to 2^maxValueBits.
+static const int maxValueBits = 16;
+static const int maxScaleBits = 40;
+
+static int fixedScaleBits(size_t numPts)
+{
+	//The sums are bounded by numPts^2 * 2^(maxValueBits+scaleBits) and must fit in 62 bits.
+	int ptsBits=0;
+	while ((size_t(1)<<ptsBits) < numPts)
+		ptsBits++;
+	return std::min(maxScaleBits, 62-maxValueBits-2*ptsBits);
+}
+
+LinearFit::LinearFit (size_t numPts, float sampleRate):
+	first(0),
+	numVals(0),
+	offset(0),
+	ySum(0),
+	iySum(0),
+	n(numPts),
+	xdelta(1.0/sampleRate),
+	scaleBits(fixedScaleBits(std::max(numPts, size_t(1)))),
+	fixedScale(ldexp(1.0, scaleBits))
+{
+	resizeHistory(n);
+}
+
+float LinearFit::next(float yval)
+{
+	push(toFixed(yval));
+
+	//Calculate the best fit given our state.
+	return calculateFit();
+}
+
+void LinearFit::next(const float* yvals, size_t len, float* fits)
+{
+	predict(yvals, len, fits);
+	accept(len);
+}
+
+void LinearFit::predict(const float* yvals, size_t len, float* fits)
+{
+	blockVals.resize(len);
+	blockSums.resize(2*len);
+	for (size_t k=0; k!=len; k++)
+		blockVals[k] = toFixed(yvals[k]);
+
+	//Slide the window over the block with the same updates as push(), on copies of the sums.
+	//The points which drop out of the window come from the history until the window is past it.
+	//This is the only serial pass and it is only integer adds.
+	unsigned long long blockYSum = ySum;
+	unsigned long long blockIYSum = iySum;
+	size_t count = numVals;
+	size_t oldest = 0;
+	for (size_t k=0; k!=len; k++)
+	{
+		if (count!=0 && count>=n)
+		{
+			const unsigned long long y = (oldest<numVals) ? history(oldest) : blockVals[oldest-numVals];
+			oldest++;
+			blockYSum-=y;
+			count--;
+			blockIYSum-=blockYSum;
+		}
+		blockYSum+=blockVals[k];
+		blockIYSum+=blockVals[k]*count;
+		count++;
+		blockSums[2*k] = double((long long)blockYSum);
+		blockSums[2*k+1] = double(numerator(blockYSum, blockIYSum, count));
+	}
+
+	//The fits are independent of each other once the sums are known.
+	const size_t maxPts = std::max(n, size_t(1));
+	count = numVals;
+	for (size_t k=0; k!=len && count<maxPts; k++)
+		fits[k] = fitSums(blockSums[2*k], blockSums[2*k+1], ++count);
+	for (size_t k=count-numVals; k<len; k++)
+		fits[k] = fitSums(blockSums[2*k], blockSums[2*k+1], count);
+}
+
+void LinearFit::accept(size_t count)
+{
+	for (size_t k=0; k!=count; k++)
+		push(blockVals[k]);
+}
+
+void LinearFit::push(unsigned long long y)
+{
+	//Are we currently in steady state?
+	//A history of 0 points is treated as 1 point rather than popping from an empty history.
+	bool steadyState =  numVals!=0 && numVals>=n;
+	if (steadyState)
+	{
+		//Update our state given our x-axis shift and our loss of the last point.
+
+		// Here is a bit of the magic for the iySum update equation:
+		// iySum = sum(i*yi) = y0*0+y1*1 + y2*2 + ... yn-1*(n-1)
+		// For the next value for iySum, we shift our x-axis (to keep the earliest point at 0).
+		// iySumNext = y1*0 + y2*1 + y3*2 + ... yn-1*(n-2) + newYval*(n-1)
+		// iySumNext - iySum = -(y1+y2+...yn-1) + newYval*(n-1)
+		// but ySumNext = ySum-y0 = y1+y2+...yn-1
+		// and the final update equation becomes iySum = -newYSum+newYval*(n-1).
+
+		//We take care of the last term providing the new value update outside of the steady state check.
+
+		ySum-=history(0);
+		if (++first==yvals.size())
+			first=0;
+		numVals--;
+		iySum-=ySum;
+	}
+	//Update our state for our new point according to the update equations.
+	//The sums are kept in integers so they are exact - no error builds up however long they run.
+	ySum+=y;
+	//This is actually multiplying by yval*(n-1)
+	//because we haven't yet pushed_back the new value.  This is intentional.
+	iySum+=y*numVals;
+	size_t last = first+numVals;
+	if (last>=yvals.size())
+		last-=yvals.size();
+	yvals[last] = y+offset;
+	numVals++;
+}
+
+float LinearFit::reset(size_t* numPts, float* sampleRate, bool forceHistoryClear)
+{
+	if (sampleRate!=NULL)
+	{
+		//Can't use history once we reset the sample rate.
+		float newXdelta = 1.0/(*sampleRate);
+		if (xdelta!=newXdelta)
+		{
+			xdelta = newXdelta;
+			forceHistoryClear=true;
+		}
+	}
+	if (forceHistoryClear)
+		numVals=0;
+
+	if (numPts !=NULL && *numPts != n)
+	{
+		n = *numPts;
+		resizeHistory(n);
+	}
+	//Now update our internal state given our history.
+	ySum=0;
+	iySum=0;
+	for (size_t j=0; j!=numVals; j++)
+	{
+		const unsigned long long y = history(j);
+		ySum+=y;
+		iySum+=j*y;
+	}
+    return calculateFit();
+
+}
+
+float LinearFit::subtractConst(float yval)
+{
+	//Subtracting c from every point takes n*c off ySum and c*(0+1+...+n-1) off iySum.
+	//The points in the history are adjusted lazily by offset when they are used.
+	const unsigned long long y = toFixed(yval);
+	ySum-=y*numVals;
+	iySum-=y*(numVals*(numVals-1)/2);
+	offset+=y;
+	return calculateFit();
+}
+
+void LinearFit::resizeHistory(size_t numPts)
+{
+	//Drop the oldest points which no longer fit and copy the rest to the start of the new buffer,
+	//rescaled for the new history length.
+	const size_t numKeep = std::min(numVals, std::max(numPts, size_t(1)));
+	const int newScaleBits = fixedScaleBits(std::max(numPts, size_t(1)));
+	const double newFixedScale = ldexp(1.0, newScaleBits);
+	std::vector<unsigned long long> newYvals(std::max(numPts, size_t(1)));
+	for (size_t j=0; j!=numKeep; j++)
+	{
+		const double y = fromFixed(history(numVals-numKeep+j));
+		newYvals[j] = toFixed(y, newFixedScale);
+	}
+	yvals.swap(newYvals);
+	first=0;
+	numVals=numKeep;
+	offset=0;
+	scaleBits=newScaleBits;
+	fixedScale=newFixedScale;
+}
+
+float LinearFit::calculateFit()
+{
+	// The General best fit for a linear fit (to minimize avg error) is as follows:
+
+	// y = mx+b
+	// numerator = sum(xi*yi) -1/n*sum(xi)*sum(yi);
+	// denominator = sum(xi^2) - 1/n(sum(x))^2
+	// m = numerator / denominator
+	// b = sum(y)/n - m sum(x) / n
+
+	// We simplify this equation for regularly sampled data: xi = i*xdelta
+	// (xvals = 0, xdelta, 2*xdelta, ... (n-1)*xdelta)
+
+	// Thus - the numerator reduces to the following equation:
+	// numerator  = xdelta*(sum(i*yi) -(n-1)/2*sum(yi))
+	// The denominator simplifies to a constant for a given xdelta and n:
+	// denominator = xdelta^2*n*(n^2-1)/12
+	// The best fit point for the newest data point, at x = (n-1)*xdelta, is then
+	// m*(n-1)*xdelta + b = sum(y)/n + m*(n-1)/2*xdelta
+	// where xdelta cancels out.  Substituting the denominator gives
+	// (sum(y) + 3*(2*numerator/xdelta)/(n+1))/n
+	// which is worked out by fitSums from the exact integer sums.
+
+	if (numVals==0)
+		return 0;
+	return fitSums(double((long long)ySum), double(numerator(ySum, iySum, numVals)), numVals);
+}
+
+unsigned long long LinearFit::toFixed(double y, double scale)
+{
+	//Clamp anything too big for the sums to hold then round to the nearest step.
+	const double maxValue = double(1LL<<maxValueBits);
+	y = std::max(-maxValue, std::min(maxValue, y))*scale;
+	return (long long)(y<0 ? y-0.5 : y+0.5);
+}
+
+//Slope of the normalized Gardner error against the timing error in symbols near lock.
+//This is 1.3 to 1.6 for random symbols with raised cosine pulses.
+static const double gardnerDetectorGain = 1.5;
+//Largest symbol rate offset the loop tracks, as a fraction of the symbol rate.
+static const double gardnerMaxRateOffset = 0.05;
+
+GardnerTiming::GardnerTiming() :
+	symbolSamples(2.0),
+	loopBandwidth(0.01)
+{
+	setLoopBandwidth(loopBandwidth);
+	reset();
+}
+
+void GardnerTiming::setSamplesPerSymbol(double newSamplesPerSymbol)
+{
+	newSamplesPerSymbol = std::max(newSamplesPerSymbol, 2.0);
+	if (newSamplesPerSymbol!=symbolSamples)
+	{
+		symbolSamples = newSamplesPerSymbol;
+		//The rate correction was for the old rate.
+		integrator = 0;
+	}
+}
+
+void GardnerTiming::setLoopBandwidth(double newLoopBandwidth)
+{
+	//Gains for a second order loop with a damping factor of 1/sqrt(2).
+	loopBandwidth = newLoopBandwidth;
+	const double damping = M_SQRT1_2;
+	const double theta = loopBandwidth/(damping+0.25/damping);
+	const double denominator = (1+2*damping*theta+theta*theta)*gardnerDetectorGain;
+	gain1 = 4*damping*theta/denominator;
+	gain2 = 4*theta*theta/denominator;
+}
+
+void GardnerTiming::reset()
+{
+	integrator = 0;
+	nextPoint = 0;
+	midpointNext = false;
+	haveSymbol = false;
+	lastSymbol = 0;
+	midpoint = 0;
+	std::fill(taps, taps+3, std::complex<float>(0.0,0.0));
+	sampleCount = 0;
+}
+
+size_t GardnerTiming::maxSymbols(size_t len) const
+{
+	//The loop moves each symbol by at most a quarter of a symbol.
+	return size_t((len+3)/(0.75*symbolSamples))+1;
+}
+
+std::complex<float> GardnerTiming::interpolate(const std::complex<float>* data, long base, float mu) const
+{
+	//Cubic Lagrange interpolation between x0 and x1 through the samples either side of them, in Farrow form.
+	//Points before the start of the block come from the last block.
+	const std::complex<float> xm1 = (base>=1) ? data[base-1] : taps[base+2];
+	const std::complex<float> x0 = (base>=0) ? data[base] : taps[base+3];
+	const std::complex<float> x1 = (base>=-1) ? data[base+1] : taps[base+4];
+	const std::complex<float> x2 = data[base+2];
+	const float third = 1.0f/3, sixth = 1.0f/6;
+	const std::complex<float> c1 = x1 - third*xm1 - 0.5f*x0 - sixth*x2;
+	const std::complex<float> c2 = 0.5f*(xm1+x1) - x0;
+	const std::complex<float> c3 = sixth*(x2-xm1) + 0.5f*(x0-x1);
+	return ((c3*mu+c2)*mu+c1)*mu+x0;
+}
+
+void GardnerTiming::process(const std::complex<float>* data, size_t len, std::vector<std::complex<float> >& symbols, std::vector<short>* sampleIndex)
+{
+	const double halfSymbol = symbolSamples/2;
+	//Each point needs the two samples after it.
+	while (nextPoint<double(len)-2)
+	{
+		//The point is never more than 2 samples before the block so this rounds down.
+		const long base = long(nextPoint+2)-2;
+		const std::complex<float> point = interpolate(data, base, nextPoint-base);
+		double step = halfSymbol;
+		if (midpointNext)
+			midpoint = point;
+		else
+		{
+			const float power = norm(point)+norm(lastSymbol);
+			if (haveSymbol && power>0)
+			{
+				//The midpoint is on the way from the last symbol to this one if the points are late.
+				//Normalizing by the symbol power keeps the loop gain independent of the signal level.
+				const std::complex<float> change = point-lastSymbol;
+				const double error = 2*(midpoint.real()*change.real()+midpoint.imag()*change.imag())/power;
+				integrator = std::max(-gardnerMaxRateOffset, std::min(gardnerMaxRateOffset, integrator+gain2*error));
+				const double correction = (gain1*error+integrator)*symbolSamples;
+				step -= std::max(-halfSymbol/2, std::min(halfSymbol/2, correction));
+			}
+			symbols.push_back(point);
+			if (sampleIndex)
+				sampleIndex->push_back(short(fmod(sampleCount+nextPoint, symbolSamples)));
+			lastSymbol = point;
+			haveSymbol = true;
+		}
+		midpointNext = !midpointNext;
+		nextPoint += step;
+	}
+
+	//Keep the last samples for the interpolator and carry the next point over to the next block.
+	std::complex<float> newTaps[3];
+	for (long k=0; k!=3; k++)
+	{
+		const long i = long(len)-3+k;
+		newTaps[k] = (i>=0) ? data[i] : taps[i+3];
+	}
+	std::copy(newTaps, newTaps+3, taps);
+	nextPoint -= len;
+	sampleCount += len;
+}
+
+//std::complex multiplication checks for infinities, which stops the inner loops from being optimized.
+static inline std::complex<float> multiply(const std::complex<float>& a, const std::complex<float>& b)
+{
+	return std::complex<float>(a.real()*b.real()-a.imag()*b.imag(), a.real()*b.imag()+a.imag()*b.real());
+}
+
+CarrierLoop::CarrierLoop() :
+	loopBandwidth(0.05)
+{
+	setLoopBandwidth(loopBandwidth);
+	reset();
+}
+
+void CarrierLoop::setLoopBandwidth(double newLoopBandwidth)
+{
+	//Gains for a second order loop with a damping factor of 1/sqrt(2).
+	//The phase detector works out the sine of the phase error, so its gain is 1.
+	loopBandwidth = newLoopBandwidth;
+	const double damping = M_SQRT1_2;
+	const double theta = loopBandwidth/(damping+0.25/damping);
+	const double denominator = 1+2*damping*theta+theta*theta;
+	gain1 = 4*damping*theta/denominator;
+	gain2 = 4*theta*theta/denominator;
+}
+
+void CarrierLoop::reset()
+{
+	carrierPhase = 0;
+	frequency = 0;
+	started = false;
+}
+
+//Number of symbols whose Mth power is averaged for the starting phase of the carrier loop.
+static const size_t carrierLoopStartSymbols = 8;
+
+template <class Points>
+void CarrierLoop::track(const std::complex<float>* symbols, size_t len, size_t numSyms, std::complex<float>* corrected, float* phase)
+{
+	if (len==0)
+		return;
+	if (!started)
+	{
+		//Start from the phase of the first few symbols rather than waiting for the loop to pull in.
+		std::complex<float> sum(0.0f, 0.0f);
+		for (size_t i=0; i!=std::min(len, carrierLoopStartSymbols); i++)
+			sum += Points::power(symbols[i], numSyms);
+		carrierPhase = arg(sum)/numSyms;
+		started = true;
+	}
+	//The rotation is worked out from the phase once a block, then stepped along with it.
+	std::complex<float> rotation = std::polar(1.0f, -carrierPhase);
+	for (size_t i=0; i!=len; i++)
+	{
+		const std::complex<float> symbol = multiply(symbols[i], rotation);
+		if (phase)
+			phase[i] = carrierPhase*numSyms;
+		corrected[i] = symbol;
+
+		//Sine of the angle from the nearest point to the symbol.
+		const std::complex<float> point = Points::nearest(symbol, numSyms);
+		const float power = norm(symbol);
+		float step = frequency;
+		if (power>0)
+		{
+			const float error = (symbol.imag()*point.real()-symbol.real()*point.imag())/sqrtf(power);
+			frequency += gain2*error;
+			step += gain1*error;
+		}
+		//Rotate by -step with the first terms of the series for cos and sin, and pull the magnitude back to 1.
+		//The steps are small once the loop has locked and the rotation is recomputed every block.
+		const float step2 = step*step;
+		rotation = multiply(rotation, std::complex<float>(1-0.5f*step2, step*(step2*(1.0f/6)-1)));
+		rotation *= 1.5f-0.5f*norm(rotation);
+		carrierPhase += step;
+		if (carrierPhase>M_PI)
+			carrierPhase -= M_2PI;
+		else if (carrierPhase<-M_PI)
+			carrierPhase += M_2PI;
+	}
+}
+
+//Filters up to this long are applied directly, which is quicker than the FFTs for short filters.
+static const size_t directFilterTaps = 32;
+
+MatchedFilter::MatchedFilter() :
+	designSamplesPerSymbol(0.0),
+	designRollOff(0.0),
+	designSpan(0),
+	fftSize(0)
+{
+}
+
+void MatchedFilter::design(double samplesPerSymbol, double rollOff, size_t span)
+{
+	rollOff = std::max(0.0, std::min(1.0, rollOff));
+	if (span==0)
+		samplesPerSymbol = rollOff = 0.0;
+	if (samplesPerSymbol==designSamplesPerSymbol && rollOff==designRollOff && span==designSpan)
+		return;
+	designSamplesPerSymbol = samplesPerSymbol;
+	designRollOff = rollOff;
+	designSpan = span;
+	taps.clear();
+	response.clear();
+	fftSize = 0;
+	if (span==0)
+	{
+		reset();
+		return;
+	}
+
+	//An odd number of taps keeps the filter symmetric about its center tap.
+	const size_t halfLength = size_t(span*samplesPerSymbol/2);
+	taps.resize(2*halfLength+1);
+	double sum = 0.0;
+	for (size_t k=0; k!=taps.size(); k++)
+	{
+		//Time from the center in symbols.  The pulse is even, so work it out for |t| to get exactly symmetric taps.
+		const double t = fabs(double(k)-halfLength)/samplesPerSymbol;
+		const double beta4t = 4*rollOff*t;
+		double h;
+		if (t==0)
+			h = 1-rollOff+4*rollOff/M_PI;
+		else if (fabs(1-beta4t*beta4t)<1e-8)
+			h = rollOff/M_SQRT2*((1+2/M_PI)*sin(M_PI/(4*rollOff))+(1-2/M_PI)*cos(M_PI/(4*rollOff)));
+		else
+			h = (sin(M_PI*t*(1-rollOff))+beta4t*cos(M_PI*t*(1+rollOff)))/(M_PI*t*(1-beta4t*beta4t));
+		taps[k] = h;
+		sum += h;
+	}
+	for (size_t k=0; k!=taps.size(); k++)
+		taps[k] /= sum;
+
+	if (taps.size()>directFilterTaps)
+	{
+		//Each block filters fftSize-length()+1 new samples, so make it a few times the filter length.
+		fftSize = 64;
+		while (fftSize<4*taps.size())
+			fftSize*=2;
+		//The twiddle factors for each pass of the FFT, one after the other so each pass reads them in order.
+		twiddles.resize(fftSize);
+		inverseTwiddles.resize(fftSize);
+		for (size_t half=1; half<fftSize; half*=2)
+		{
+			for (size_t k=0; k!=half; k++)
+			{
+				twiddles[half+k] = std::polar(1.0, -M_PI*k/half);
+				inverseTwiddles[half+k] = conj(twiddles[half+k]);
+			}
+		}
+		bitReverse.resize(fftSize);
+		bitReverse[0] = 0;
+		for (size_t i=1; i!=fftSize; i++)
+			bitReverse[i] = (bitReverse[i>>1]>>1) | ((i&1) ? fftSize>>1 : 0);
+		response.assign(fftSize, std::complex<float>(0.0,0.0));
+		for (size_t k=0; k!=taps.size(); k++)
+			response[k] = taps[k]/float(fftSize);
+		fft(&response[0], false);
+		work.resize(fftSize);
+	}
+	reset();
+}
+
+void MatchedFilter::reset()
+{
+	history.assign(taps.empty() ? 0 : taps.size()-1, std::complex<float>(0.0,0.0));
+}
+
+void MatchedFilter::process(const std::complex<float>* data, size_t len, std::complex<float>* out)
+{
+	if (taps.empty())
+	{
+		std::copy(data, data+len, out);
+		return;
+	}
+	const size_t historyLength = history.size();
+	//Overlap-save filters a block at a time.  The direct filter does the whole lot at once.
+	const size_t blockSize = fftSize ? fftSize-historyLength : len;
+	for (size_t pos=0; pos<len; pos+=blockSize)
+	{
+		const size_t num = std::min(blockSize, len-pos);
+		if (fftSize)
+			filterBlock(data+pos, num, out+pos);
+		else
+			filterDirect(data+pos, num, out+pos);
+	}
+}
+void MatchedFilter::keepHistory(size_t len)
+{
+	//work holds the history followed by the len new samples, so the newest samples are the last history.size() of those.
+	std::copy(work.begin()+len, work.begin()+len+history.size(), history.begin());
+}
+
+void MatchedFilter::filterDirect(const std::complex<float>* data, size_t len, std::complex<float>* out)
+{
+	work.resize(history.size()+len);
+	std::copy(history.begin(), history.end(), work.begin());
+	std::copy(data, data+len, work.begin()+history.size());
+	keepHistory(len);
+	//The taps are symmetric so the convolution is the same as the correlation.
+	const float* samples = reinterpret_cast<const float*>(&work[0]);
+	const size_t numTaps = taps.size();
+	for (size_t n=0; n!=len; n++)
+	{
+		const float* x = samples+2*n;
+		float re = 0.0f;
+		float im = 0.0f;
+		for (size_t k=0; k!=numTaps; k++)
+		{
+			re += taps[k]*x[2*k];
+			im += taps[k]*x[2*k+1];
+		}
+		out[n] = std::complex<float>(re, im);
+	}
+}
+
+void MatchedFilter::filterBlock(const std::complex<float>* data, size_t len, std::complex<float>* out)
+{
+	//The history and the new samples, padded out with zeros if the block is short.
+	//The outputs for the new samples only depend on the samples up to them, so the padding does not change them.
+	std::copy(history.begin(), history.end(), work.begin());
+	std::copy(data, data+len, work.begin()+history.size());
+	std::fill(work.begin()+history.size()+len, work.end(), std::complex<float>(0.0,0.0));
+	//The input is all in work now, so the output can go over it.
+	keepHistory(len);
+	fft(&work[0], false);
+	for (size_t i=0; i!=fftSize; i++)
+		work[i] = multiply(work[i], response[i]);
+	fft(&work[0], true);
+	//The first length()-1 outputs wrap around the block and are thrown away.
+	std::copy(work.begin()+history.size(), work.begin()+history.size()+len, out);
+}
+
+void MatchedFilter::fft(std::complex<float>* data, bool inverse) const
+{
+	for (size_t i=0; i!=fftSize; i++)
+	{
+		if (i<bitReverse[i])
+			std::swap(data[i], data[bitReverse[i]]);
+	}
+	//Radix 2 decimation in time butterflies.
+	const std::complex<float>* passTwiddles = inverse ? &inverseTwiddles[0] : &twiddles[0];
+	for (size_t half=1; half<fftSize; half*=2)
+	{
+		const std::complex<float>* w = passTwiddles+half;
+		for (size_t start=0; start<fftSize; start+=2*half)
+		{
+			std::complex<float>* a = data+start;
+			std::complex<float>* b = data+start+half;
+			for (size_t k=0; k!=half; k++)
+			{
+				const std::complex<float> t = multiply(w[k], b[k]);
+				b[k] = a[k]-t;
+				a[k] += t;
+			}
+		}
+	}
+}
+
+//Symbols in each block the presence detector measures.
+static const size_t presenceBlockSymbols = 32;
+
+//Factor the noise floor rises by each block without a signal, 0.05 dB, so it climbs 3 dB in 60 blocks.
+static const double presenceFloorRise = 1.0115794542598986;
+
+PresenceDetector::PresenceDetector() :
+	threshold(pow(10.0, 0.3)),
+	holdBlocks(4)
+{
+	reset();
+}
+
+void PresenceDetector::setThreshold(double thresholdDb)
+{
+	threshold = pow(10.0, thresholdDb/10);
+}
+
+void PresenceDetector::setHoldBlocks(size_t blocks)
+{
+	holdBlocks = blocks;
+}
+
+void PresenceDetector::reset()
+{
+	noiseFloor = 0.0;
+	quietBlocks = 0;
+	signalPresent = false;
+}
+
+double PresenceDetector::edgeLevel() const
+{
+	return noiseFloor*sqrt(threshold);
+}
+
+bool PresenceDetector::update(double power)
+{
+	const bool loud = noiseFloor>0.0 && power>noiseFloor*threshold;
+	//The floor only creeps up between bursts, so a long burst is not taken for the noise.
+	if (power>0.0 && (noiseFloor==0.0 || power<noiseFloor))
+		noiseFloor = power;
+	else if (!loud && !signalPresent)
+		noiseFloor *= presenceFloorRise;
+	if (loud)
+	{
+		signalPresent = true;
+		quietBlocks = 0;
+	}
+	else if (signalPresent && ++quietBlocks>holdBlocks)
+		signalPresent = false;
+	return signalPresent;
+}
+
+PskDemodStats::PskDemodStats()
+{
+	clear();
+}
+
+void PskDemodStats::clear()
+{
+	samples=0;
+	symbols=0;
+	timingNs=0;
+	phaseNs=0;
+	slicingNs=0;
+	energyResyncs=0;
+	gatedSamples=0;
+}
+
+PskDemodStats& PskDemodStats::operator+=(const PskDemodStats& other)
+{
+	samples+=other.samples;
+	symbols+=other.symbols;
+	timingNs+=other.timingNs;
+	phaseNs+=other.phaseNs;
+	slicingNs+=other.slicingNs;
+	energyResyncs+=other.energyResyncs;
+	gatedSamples+=other.gatedSamples;
+	return *this;
+}
+
+unsigned long long pskClockNs()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000ULL+now.tv_nsec;
+}
+
+PskDemodOutput::PskDemodOutput() :
+	numSymbols(0),
+	llrScale(0.0f)
+{
+}
+
+void PskDemodOutput::clear()
+{
+	numSymbols=0;
+	softDecisions.clear();
+	bits.clear();
+	phase.clear();
+	sampleIndex.clear();
+	packedBits.clear();
+	llrs.clear();
+	quantizedLlrs.clear();
+	llrScale=0.0f;
+	presenceChanges.clear();
+}
+
+void PskDemodOutput::append(const PskDemodOutput& other)
+{
+	numSymbols+=other.numSymbols;
+	softDecisions.insert(softDecisions.end(), other.softDecisions.begin(), other.softDecisions.end());
+	bits.insert(bits.end(), other.bits.begin(), other.bits.end());
+	phase.insert(phase.end(), other.phase.begin(), other.phase.end());
+	sampleIndex.insert(sampleIndex.end(), other.sampleIndex.begin(), other.sampleIndex.end());
+	packedBits.insert(packedBits.end(), other.packedBits.begin(), other.packedBits.end());
+	llrs.insert(llrs.end(), other.llrs.begin(), other.llrs.end());
+	quantizedLlrs.insert(quantizedLlrs.end(), other.quantizedLlrs.begin(), other.quantizedLlrs.end());
+	llrScale=other.llrScale;
+}
+
+void PskDemodOutput::reserve(size_t numSymbols, size_t bitsPerSymbol, unsigned int outputs)
+{
+	if (outputs & PSK_SOFT_DECISIONS)
+		softDecisions.reserve(numSymbols);
+	if (outputs & PSK_BITS)
+		bits.reserve(numSymbols*bitsPerSymbol);
+	if (outputs & PSK_PHASE)
+		phase.reserve(numSymbols);
+	if (outputs & PSK_SAMPLE_INDEX)
+		sampleIndex.reserve(numSymbols);
+	//Allow for an octet carried over from the last block.
+	if (outputs & PSK_PACKED_BITS)
+		packedBits.reserve(numSymbols*bitsPerSymbol/8+1);
+	if (outputs & PSK_LLRS)
+		llrs.reserve(numSymbols*bitsPerSymbol);
+	if (outputs & PSK_QUANTIZED_LLRS)
+		quantizedLlrs.reserve(numSymbols*bitsPerSymbol);
+}
+
+PskDemodCore::PskDemodCore() :
+	samplesPerSymbol(10),
+	numAvg(100),
+	numSyms(4),
+	bitsPerSymbol(2),
+	phaseAvg(50),
+	differentialDecoding(false),
+	fastPhase(false),
+	grayCoding(false),
+	outputs(PSK_ALL_OUTPUTS),
+	sampleRate(1.0), //Put in an initial sample rate that will get updated later.
+	timingMode(PSK_TIMING_MAX_ENERGY),
+	symbolRate(0.0),
+	timingTimeConstant(0.0),
+	filterSpan(0),
+	filterRollOff(0.35),
+	window(samplesPerSymbol*numAvg),
+	sc16Window(false),
+	windowEnergy(samplesPerSymbol*numAvg,0.0),
+	windowRow(0),
+	windowRows(0),
+	symbolEnergy(samplesPerSymbol,0.0),
+	shadowEnergy(samplesPerSymbol,0.0),
+	shadowRows(0),
+	index(0),
+	energyDecay(0.0),
+	partialOctet(0),
+	partialOctetBits(0),
+	llrNearestSum(0.0),
+	llrEnergySum(0.0),
+	llrCount(0.0),
+	slicingStart(0),
+	presenceGating(false),
+	phaseStale(false),
+	carrierMode(PSK_CARRIER_POWER_FIT),
+	phaseEstimate(0.0),
+	phaseEstimator(phaseAvg,sampleRate)
+{
+	selectSymbolKernel();
+	updateGardnerRate();
+}
+
+void PskDemodCore::setSamplesPerBaud(size_t samplesPerBaud)
+{
+	//The window and symbolEnergy vector must be resized and re-populated with the energy samples.
+	resyncEnergy(samplesPerBaud, numAvg);
+	updateGardnerRate();
+	updateMatchedFilter();
+}
+
+void PskDemodCore::setNumAvg(size_t newNumAvg)
+{
+	if (newNumAvg != numAvg)
+		resyncEnergy(samplesPerSymbol, newNumAvg);
+}
+
+void PskDemodCore::setConstellationSize(size_t constellationSize)
+{
+	numSyms = constellationSize;
+	selectSymbolKernel();
+	//All the phase calculations are invalid if the constellation size changes.
+	//Clear the history and start with new estimates.
+	phaseEstimator.reset(NULL,NULL,true);
+	carrierLoop.reset();
+	resetLlrScale();
+}
+
+void PskDemodCore::setPhaseAvg(size_t newPhaseAvg)
+{
+	phaseAvg = newPhaseAvg;
+	phaseEstimator.reset(&phaseAvg);
+}
+
+void PskDemodCore::setDifferentialDecoding(bool newDifferentialDecoding)
+{
+	if (newDifferentialDecoding != differentialDecoding)
+	{
+		differentialDecoding = newDifferentialDecoding;
+		selectSymbolKernel();
+	}
+}
+
+void PskDemodCore::setFastPhase(bool newFastPhase)
+{
+	if (newFastPhase != fastPhase)
+	{
+		fastPhase = newFastPhase;
+		selectSymbolKernel();
+	}
+}
+
+void PskDemodCore::setGrayCoding(bool newGrayCoding)
+{
+	if (newGrayCoding != grayCoding)
+	{
+		grayCoding = newGrayCoding;
+		selectSymbolKernel();
+	}
+}
+
+void PskDemodCore::setOutputs(unsigned int newOutputs)
+{
+	outputs = newOutputs;
+}
+
+void PskDemodCore::setSampleRate(float newSampleRate)
+{
+	sampleRate = newSampleRate;
+	phaseEstimator.reset(NULL,&sampleRate);
+	updateGardnerRate();
+	updateMatchedFilter();
+}
+
+void PskDemodCore::setTimingMode(PskTimingMode newTimingMode)
+{
+	if (newTimingMode != timingMode)
+	{
+		//Each method starts over, and the max energy window is only kept while it is in use.
+		timingMode = newTimingMode;
+		windowRow = 0;
+		windowRows = 0;
+		index = 0;
+		resyncEnergy(samplesPerSymbol, numAvg);
+		gardner.reset();
+		updateMatchedFilter();
+	}
+}
+
+void PskDemodCore::setSymbolRate(double newSymbolRate)
+{
+	symbolRate = newSymbolRate;
+	updateGardnerRate();
+	updateMatchedFilter();
+}
+
+void PskDemodCore::setCarrierMode(PskCarrierMode newCarrierMode)
+{
+	if (newCarrierMode != carrierMode)
+	{
+		//The method switched to starts over.
+		carrierMode = newCarrierMode;
+		phaseEstimator.reset(NULL,NULL,true);
+		carrierLoop.reset();
+		selectSymbolKernel();
+	}
+}
+
+void PskDemodCore::setCarrierLoopBandwidth(double loopBandwidth)
+{
+	carrierLoop.setLoopBandwidth(loopBandwidth);
+}
+
+void PskDemodCore::setMatchedFilter(size_t span, double rollOff)
+{
+	filterSpan = span;
+	filterRollOff = rollOff;
+	updateMatchedFilter();
+}
+
+void PskDemodCore::setTimingLoopBandwidth(double loopBandwidth)
+{
+	gardner.setLoopBandwidth(loopBandwidth);
+}
+
+void PskDemodCore::setTimingTimeConstant(double timeConstant)
+{
+	if (timeConstant != timingTimeConstant)
+	{
+		timingTimeConstant = timeConstant;
+		if (timingMode==PSK_TIMING_LEAKY_ENERGY)
+			resyncEnergy(samplesPerSymbol, numAvg);
+	}
+}
+
+void PskDemodCore::updateGardnerRate()
+{
+	gardner.setSamplesPerSymbol(symbolRate>0 ? sampleRate/symbolRate : samplesPerSymbol);
+}
+
+void PskDemodCore::updateMatchedFilter()
+{
+	//The filter is matched to the symbol period the timing recovery works with.
+	matchedFilter.design(samplesPerOutputSymbol(), filterRollOff, filterSpan);
+}
+
+double PskDemodCore::samplesPerOutputSymbol() const
+{
+	return (timingMode==PSK_TIMING_GARDNER) ? gardner.samplesPerSymbol() : samplesPerSymbol;
+}
+
+void PskDemodCore::setSamplePosition(unsigned long long samples)
+{
+	gardner.setSampleCount(samples);
+}
+
+void PskDemodCore::setPresenceGating(bool enabled)
+{
+	if (enabled == presenceGating)
+		return;
+	//Gating stopped between bursts, so demodulation starts over as it would on the next burst.
+	if (!enabled && !presence.present())
+		reset();
+	presenceGating = enabled;
+	presence.reset();
+	gateTail.clear();
+	gateTailSc16.clear();
+}
+
+void PskDemodCore::setPresenceThreshold(double thresholdDb)
+{
+	presence.setThreshold(thresholdDb);
+}
+
+void PskDemodCore::setPresenceHold(size_t holdSymbols)
+{
+	presence.setHoldBlocks((holdSymbols+presenceBlockSymbols-1)/presenceBlockSymbols);
+}
+
+void PskDemodCore::reset()
+{
+	resyncEnergy(samplesPerSymbol, numAvg);
+	gardner.reset();
+	matchedFilter.reset();
+	phaseEstimator.reset(NULL,NULL,true);
+	phaseEstimator.reset(&phaseAvg);
+	carrierLoop.reset();
+	resetLlrScale();
+}
+
+void PskDemodCore::resetLlrScale()
+{
+	llrNearestSum = 0.0;
+	llrEnergySum = 0.0;
+	llrCount = 0.0;
+}
+
+void PskDemodCore::process(const std::complex<float>* data, size_t len, PskDemodOutput& out)
+{
+	if (presenceGating)
+		processGated(data, len, out);
+	else
+		demodulate(data, len, out);
+}
+
+void PskDemodCore::process(const std::complex<short>* data, size_t len, PskDemodOutput& out)
+{
+	if (presenceGating)
+		processGated(data, len, out);
+	else
+		demodulate(data, len, out);
+}
+
+void PskDemodCore::demodulate(const std::complex<float>* data, size_t len, PskDemodOutput& out)
+{
+	const unsigned long long timingStart = beginBlock(len, out);
+	//The timing recovery works on the matched filter output when the filter is turned on.
+	//SC16 input has already been converted into the scratch buffer, so it is filtered in place there.
+	//The float input belongs to the caller, so its output needs the buffer to itself.
+	if (matchedFilter.enabled() && len!=0)
+	{
+		converted.resize(len);
+		matchedFilter.process(data, len, &converted[0]);
+		data = &converted[0];
+	}
+	recoverTiming(data, len, out);
+	endBlock(len, timingStart, out);
+}
+
+void PskDemodCore::demodulate(const std::complex<short>* data, size_t len, PskDemodOutput& out)
+{
+	if (timingMode==PSK_TIMING_GARDNER || matchedFilter.enabled() || samplesPerSymbol==1)
+	{
+		converted.resize(len);
+		if (len!=0)
+			psk_simd::convertSc16(data, PSK_SC16_SCALE, &converted[0], len);
+		demodulate(converted.empty() ? NULL : &converted[0], len, out);
+		return;
+	}
+	const unsigned long long timingStart = beginBlock(len, out);
+	symbols.clear();
+	symbols.reserve((len+index)/samplesPerSymbol);
+	if (timingMode==PSK_TIMING_LEAKY_ENERGY)
+		recoverTimingLeaky(data, len, out);
+	else
+		recoverTimingMaxEnergy(data, len, out);
+	endBlock(len, timingStart, out);
+}
+
+unsigned long long PskDemodCore::beginBlock(size_t len, PskDemodOutput& out)
+{
+	out.clear();
+
+	//Reserve the output for the most symbols this block can produce.
+	//Once the buffers have grown to the largest packet size processing does not allocate.
+	const size_t maxSymbols = (timingMode==PSK_TIMING_GARDNER) ? gardner.maxSymbols(len) : (len+index)/samplesPerSymbol;
+	out.reserve(maxSymbols, bitsPerSymbol, outputs);
+
+	//Differential decoding only tracks the phase for the phase output.
+	//If it has not been tracked for a while the history is out of date, so start over.
+	if (differentialDecoding && !(outputs & PSK_PHASE))
+		phaseStale = true;
+	else if (phaseStale)
+	{
+		phaseEstimator.reset(NULL,NULL,true);
+		carrierLoop.reset();
+		phaseStale = false;
+	}
+	return pskClockNs();
+}
+
+void PskDemodCore::endBlock(size_t len, unsigned long long timingStart, PskDemodOutput& out)
+{
+	//The symbols for the whole block have been picked out, now track the phase and slice them.
+	out.numSymbols = symbols.size();
+	const unsigned long long phaseStart = pskClockNs();
+	slicingStart = phaseStart;
+	(this->*symbolKernel)(out);
+	wrapPhase();
+	const unsigned long long end = pskClockNs();
+
+	workStats.samples += len;
+	workStats.symbols += symbols.size();
+	workStats.timingNs += phaseStart-timingStart;
+	//The kernels mark where slicing starts if there are any symbols.
+	workStats.phaseNs += slicingStart-phaseStart;
+	workStats.slicingNs += end-slicingStart;
+}
+
+void PskDemodCore::recoverTiming(const std::complex<float>* data, size_t len, PskDemodOutput& out)
+{
+	symbols.clear();
+	if (timingMode==PSK_TIMING_GARDNER)
+	{
+		symbols.reserve(gardner.maxSymbols(len));
+		gardner.process(data, len, symbols, (outputs & PSK_SAMPLE_INDEX) ? &out.sampleIndex : NULL);
+		return;
+	}
+	//Without oversampling every sample is a symbol and there is no timing to recover.
+	if (samplesPerSymbol==1)
+	{
+		symbols.assign(data, data+len);
+		if (outputs & PSK_SAMPLE_INDEX)
+			out.sampleIndex.insert(out.sampleIndex.end(), len, 0);
+		return;
+	}
+	symbols.reserve((len+index)/samplesPerSymbol);
+	if (timingMode==PSK_TIMING_LEAKY_ENERGY)
+		recoverTimingLeaky(data, len, out);
+	else
+		recoverTimingMaxEnergy(data, len, out);
+}
+
+static void sampleEnergy(const std::complex<float>* data, float* energy, size_t len)
+{
+	psk_simd::energy(data, energy, len);
+}
+
+static void sampleEnergy(const std::complex<short>* data, float* energy, size_t len)
+{
+	psk_simd::energySc16(data, PSK_SC16_SCALE*PSK_SC16_SCALE, energy, len);
+}
+
+template <typename Sample>
+void PskDemodCore::processGated(const Sample* data, size_t len, PskDemodOutput& out)
+{
+	out.clear();
+	//Split the block evenly into presence blocks of about presenceBlockSymbols symbols.
+	const size_t blockSamples = std::max(size_t(presenceBlockSymbols*samplesPerOutputSymbol()), size_t(1));
+	const size_t numBlocks = std::max((len+blockSamples/2)/blockSamples, size_t(1));
+	size_t demodulated = 0;
+	size_t burstStart = 0;
+	std::vector<Sample>& tail = presenceTail(data);
+	size_t lastFrom = 0;
+	size_t from = 0;
+	for (size_t i=0; i!=numBlocks; i++)
+	{
+		const unsigned long long start = pskClockNs();
+		const size_t to = (i+1)*len/numBlocks;
+		double power = 0.0;
+		if (to!=from)
+		{
+			energy.resize(to-from);
+			sampleEnergy(data+from, &energy[0], to-from);
+			for (size_t j=0; j!=to-from; j++)
+				power += energy[j];
+			power /= to-from;
+		}
+		const bool wasPresent = presence.present();
+		const bool present = presence.update(power);
+		workStats.timingNs += pskClockNs()-start;
+		if (present!=wasPresent)
+		{
+			PskPresenceChange change;
+			change.symbol = out.numSymbols;
+			change.present = present;
+			if (present)
+			{
+				startBurst();
+				//The burst can start anywhere in this block, or late in the one before if that did not have enough of it.
+				//For the first block that is the last block of the call before, which is searched along with it.
+				if (i==0 && !tail.empty())
+				{
+					const size_t tailLen = tail.size();
+					tail.insert(tail.end(), data, data+to);
+					const size_t edge = findBurstStart(&tail[0], 0, tail.size());
+					burstStart = std::max(edge, tailLen)-tailLen;
+					change.sample = long(edge)-long(tailLen);
+					out.presenceChanges.push_back(change);
+					if (edge<tailLen)
+					{
+						//These samples were counted as skipped by the call before.
+						demodulateBurst(&tail[edge], tailLen-edge, out);
+						workStats.samples -= tailLen-edge;
+						workStats.gatedSamples -= tailLen-edge;
+					}
+				}
+				else
+				{
+					burstStart = findBurstStart(data, lastFrom, to);
+					change.sample = burstStart;
+					out.presenceChanges.push_back(change);
+				}
+			}
+			else
+			{
+				demodulateBurst(data+burstStart, from-burstStart, out);
+				demodulated += from-burstStart;
+				flushPackedBits(out);
+				change.sample = from;
+				change.symbol = out.numSymbols;
+				out.presenceChanges.push_back(change);
+			}
+		}
+		lastFrom = from;
+		from = to;
+	}
+	if (presence.present())
+	{
+		demodulateBurst(data+burstStart, len-burstStart, out);
+		demodulated += len-burstStart;
+	}
+	workStats.samples += len-demodulated;
+	workStats.gatedSamples += len-demodulated;
+	//Keep the last block for a burst found at the start of the next call.
+	if (presence.present())
+		tail.clear();
+	else if (len!=0)
+		tail.assign(data+lastFrom, data+len);
+}
+
+template <typename Sample>
+size_t PskDemodCore::findBurstStart(const Sample* data, size_t from, size_t to)
+{
+	//Sum the power of each symbol's worth of samples less a level between the noise floor and the threshold.
+	//The sum is lowest where the symbols go from mostly under the level to mostly over it, which is taken as the edge.
+	const size_t step = std::max(size_t(samplesPerOutputSymbol()+0.5), size_t(1));
+	const double level = presence.edgeLevel();
+	double sum = 0.0;
+	double lowest = 0.0;
+	size_t edge = from;
+	for (size_t pos=from; pos<to; pos+=step)
+	{
+		const size_t num = std::min(step, to-pos);
+		energy.resize(num);
+		sampleEnergy(data+pos, &energy[0], num);
+		for (size_t j=0; j!=num; j++)
+			sum += energy[j]-level;
+		if (sum<lowest)
+		{
+			lowest = sum;
+			edge = pos+num;
+		}
+	}
+	return edge;
+}
+
+void PskDemodCore::startBurst()
+{
+	//Start from scratch rather than from wherever the loops drifted to on the last burst, and drop the samples
+	//the timing recovery held back from the end of it, which would otherwise come out ahead of the new burst.
+	windowRow = 0;
+	windowRows = 0;
+	index = 0;
+	reset();
+	std::fill(symbolEnergy.begin(), symbolEnergy.end(), 0.0);
+}
+
+template <typename Sample>
+void PskDemodCore::demodulateBurst(const Sample* data, size_t len, PskDemodOutput& out)
+{
+	//Output carrying on from the last block goes straight out, but a burst after anything else in this block is added on.
+	if (out.numSymbols==0 && out.packedBits.empty() && out.presenceChanges.empty())
+	{
+		demodulate(data, len, out);
+		return;
+	}
+	demodulate(data, len, burstOut);
+	out.append(burstOut);
+}
+
+static std::complex<float> toSymbol(const std::complex<float>& sample)
+{
+	return sample;
+}
+
+static std::complex<float> toSymbol(const std::complex<short>& sample)
+{
+	return std::complex<float>(sample.real()*PSK_SC16_SCALE, sample.imag()*PSK_SC16_SCALE);
+}
+
+std::vector<std::complex<float> >& PskDemodCore::sampleWindow(const std::complex<float>*)
+{
+	useSc16Window(false);
+	return window;
+}
+
+std::vector<std::complex<short> >& PskDemodCore::sampleWindow(const std::complex<short>*)
+{
+	useSc16Window(true);
+	return windowSc16;
+}
+
+void PskDemodCore::useSc16Window(bool sc16)
+{
+	if (sc16==sc16Window)
+		return;
+	//This only happens when a stream changes sample type or the window is resynced, so it need not be quick.
+	if (sc16)
+	{
+		windowSc16.resize(window.size());
+		for (size_t i=0; i!=window.size(); i++)
+		{
+			const float re = std::max(-32768.0f, std::min(32767.0f, window[i].real()/PSK_SC16_SCALE));
+			const float im = std::max(-32768.0f, std::min(32767.0f, window[i].imag()/PSK_SC16_SCALE));
+			windowSc16[i] = std::complex<short>(lrintf(re), lrintf(im));
+		}
+		std::vector<std::complex<float> >().swap(window);
+	}
+	else
+	{
+		window.resize(windowSc16.size());
+		if (!windowSc16.empty())
+			psk_simd::convertSc16(&windowSc16[0], PSK_SC16_SCALE, &window[0], windowSc16.size());
+		std::vector<std::complex<short> >().swap(windowSc16);
+	}
+	sc16Window = sc16;
+}
+
+template <typename Sample>
+void PskDemodCore::recoverTimingMaxEnergy(const Sample* data, size_t len, PskDemodOutput& out)
+{
+	std::vector<Sample>& windowSamples = sampleWindow(data);
+	//Compute the energy for the whole block up front.
+	energy.resize(len);
+	if (len!=0)
+		sampleEnergy(data, &energy[0], len);
+
+	size_t pos=0;
+	while (pos!=len)
+	{
+		//Store the samples and their energy in the window up to the end of the current symbol.
+		const size_t num = std::min(samplesPerSymbol-index, len-pos);
+		const size_t rowPos = windowRow*samplesPerSymbol+index;
+		std::copy(data+pos, data+pos+num, windowSamples.begin()+rowPos);
+		std::copy(energy.begin()+pos, energy.begin()+pos+num, windowEnergy.begin()+rowPos);
+		//Add energy to the symbolEnergy vector.
+		psk_simd::accumulate(&symbolEnergy[index], &energy[pos], num);
+		psk_simd::accumulate(&shadowEnergy[index], &energy[pos], num);
+		pos+=num;
+		index+=num;
+
+		//When the end of the next symbol is reached...
+		if (index==samplesPerSymbol)
+		{
+			const size_t nextRow = (windowRow+1==numAvg) ? 0 : windowRow+1;
+			//If there are enough samples to get meaningful averages, start outputting data.
+			if (windowRows+1==numAvg)
+			{
+				//The window is full so the next row to be written holds the oldest symbol.
+				const size_t oldest = nextRow*samplesPerSymbol;
+
+				//Get the index for the max symbolEnergy.
+				size_t sampleIndex = std::distance(symbolEnergy.begin(), std::max_element(symbolEnergy.begin(),symbolEnergy.end()));
+
+				//This is the sample that is output.
+				if (outputs & PSK_SAMPLE_INDEX)
+					out.sampleIndex.push_back(sampleIndex);
+				symbols.push_back(toSymbol(windowSamples[oldest+sampleIndex]));
+
+				//Subtract the energy for the oldest symbol from the symbolEnergy vector.
+				psk_simd::subtract(&symbolEnergy[0], &windowEnergy[oldest], samplesPerSymbol);
+			}
+			else
+				windowRows++;
+			windowRow = nextRow;
+
+			//Once the shadow sums cover exactly the rows left in the window swap them in.
+			//This keeps floating point error from building up in symbolEnergy without ever walking the whole window.
+			if (++shadowRows>=windowRows)
+			{
+				if (shadowRows==windowRows)
+				{
+					symbolEnergy.swap(shadowEnergy);
+					workStats.energyResyncs++;
+				}
+				shadowEnergy.assign(samplesPerSymbol,0.0);
+				shadowRows=0;
+			}
+			//Reset the symbolIndex back to 0
+			index=0;
+		}
+	}
+}
+
+template <typename Sample>
+void PskDemodCore::recoverTimingLeaky(const Sample* data, size_t len, PskDemodOutput& out)
+{
+	std::vector<Sample>& windowSamples = sampleWindow(data);
+	energy.resize(len);
+	if (len!=0)
+		sampleEnergy(data, &energy[0], len);
+
+	size_t pos=0;
+	while (pos!=len)
+	{
+		//Decay the energy sums at the start of each symbol so the older symbols count for less.
+		if (index==0)
+		{
+			for (size_t i=0; i!=samplesPerSymbol; i++)
+				symbolEnergy[i]*=energyDecay;
+		}
+		//Store the samples up to the end of the current symbol and add their energy.
+		const size_t num = std::min(samplesPerSymbol-index, len-pos);
+		std::copy(data+pos, data+pos+num, windowSamples.begin()+index);
+		psk_simd::accumulate(&symbolEnergy[index], &energy[pos], num);
+		pos+=num;
+		index+=num;
+
+		//At the end of the symbol output the sample with the most energy on average.
+		if (index==samplesPerSymbol)
+		{
+			size_t sampleIndex = std::distance(symbolEnergy.begin(), std::max_element(symbolEnergy.begin(),symbolEnergy.end()));
+			if (outputs & PSK_SAMPLE_INDEX)
+				out.sampleIndex.push_back(sampleIndex);
+			symbols.push_back(toSymbol(windowSamples[sampleIndex]));
+			index=0;
+		}
+	}
+}
+
+void PskDemodCore::selectSymbolKernel()
+{
+	//Pick the symbol kernel for the constellation size, decoding mode and phase math once
+	//so none of these choices have to be made per symbol.
+	switch (numSyms)
+	{
+	case 2:
+		symbolKernel = pickSymbolKernel<2>();
+		buildSymbolMap<2>();
+		break;
+	case 4:
+		symbolKernel = pickSymbolKernel<4>();
+		buildSymbolMap<4>();
+		break;
+	case 8:
+		symbolKernel = pickSymbolKernel<8>();
+		buildSymbolMap<8>();
+		break;
+	case 16:
+		symbolKernel = pickSymbolKernel<16>();
+		buildSymbolMap<16>();
+		break;
+	default:
+		symbolKernel = pickSymbolKernel<0>();
+		buildSymbolMap<0>();
+		break;
+	}
+}
+
+template <size_t M>
+void PskDemodCore::buildSymbolMap()
+{
+	bitsPerSymbol = Constellation<M>::bitsPerSymbol;
+	//QPSK is sliced with the symbols rotated by pi/4.
+	const double offset = (M==4) ? M_PI_4 : 0.0;
+	for (size_t point=0; point!=M; point++)
+	{
+		//The Gray code of the point number changes one bit from each point to the next, including from M-1 back round to 0.
+		const unsigned int value = grayCoding ? point^(point>>1) : point;
+		unsigned int packed = 0;
+		for (size_t j=0; j!=bitsPerSymbol; j++)
+		{
+			pointBitShorts[point][j] = (value>>j)&1;
+			packed = (packed<<1) | ((value>>j)&1);
+		}
+		pointBits[point] = value;
+		pointPackedBits[point] = packed;
+		pointPhasors[point] = std::polar(1.0f, float(M_2PI*point/M+offset));
+	}
+}
+
+template <size_t M>
+PskDemodCore::SymbolKernel PskDemodCore::pickSymbolKernel() const
+{
+	if (carrierMode==PSK_CARRIER_LOOP)
+		return differentialDecoding ? &PskDemodCore::demodSymbolsLoop<M,true> : &PskDemodCore::demodSymbolsLoop<M,false>;
+	if (fastPhase)
+		return differentialDecoding ? &PskDemodCore::demodSymbolsFast<M,true> : &PskDemodCore::demodSymbolsFast<M,false>;
+	return differentialDecoding ? &PskDemodCore::demodSymbols<M,true> : &PskDemodCore::demodSymbols<M,false>;
+}
+
+template <size_t M, bool Differential>
+void PskDemodCore::demodSymbols(PskDemodOutput& out)
+{
+	const size_t numSymbols = symbols.size();
+	const bool wantSoft = outputs & PSK_SOFT_DECISIONS;
+	const bool wantPhase = outputs & PSK_PHASE;
+	const bool wantBits = outputs & (PSK_BITS | PSK_PACKED_BITS);
+	const bool trackPhase = !Differential || wantPhase;
+	out.softDecisions.resize(wantSoft ? numSymbols : 0);
+	out.phase.resize(wantPhase ? numSymbols : 0);
+	symbolValues.resize(wantBits ? numSymbols : 0);
+	if (numSymbols==0)
+		return;
+	const size_t order = M ? M : numSyms;
+	//The corrected symbols go straight to the output if anyone wants them, otherwise they are only needed for slicing.
+	if (!wantSoft)
+		phasors.resize(numSymbols);
+	std::complex<float>* corrected = wantSoft ? &out.softDecisions[0] : &phasors[0];
+
+	//With differential decoding the phase correction is fixed.
+	//Compute the phase offset - add PI/4 so that samples are at (+/- 1, +/-j) instead of 0,1,-1,,-j.
+	const std::complex<float> fixedCorrection = std::polar(float(1.0), float(M_PI_4));
+
+	//Algorithm to compensate for phase offset.
+	//Note this isn't needed for differential decoding,
+	//so it is only done then if someone is listening to the phase output.
+	if (trackPhase)
+	{
+		angles.resize(numSymbols);
+		for (size_t i=0; i!=numSymbols; i++)
+			angles[i] = arg(Constellation<M>::power(symbols[i], order));
+		fitPhase(numSymbols);
+		if (wantPhase)
+			std::copy(angles.begin(), angles.end(), out.phase.begin());
+	}
+
+	for (size_t i=0; i!=numSymbols; i++)
+	{
+		std::complex<float> sample = symbols[i];
+
+		if (Differential)
+		{
+			corrected[i] = sample/last;
+			last = sample;
+			if (M==4)
+				corrected[i]*=fixedCorrection;
+		}
+		else
+		{
+			float phaseCorrection = -angles[i]/order;
+			if (M==4)
+				phaseCorrection+=M_PI_4;
+			corrected[i] = sample*std::polar(float(1.0),phaseCorrection);
+		}
+	}
+	slicingStart = pskClockNs();
+
+	//do conversion to bits
+	if (wantBits)
+	{
+		for (size_t i=0; i!=numSymbols; i++)
+			symbolValues[i] = Constellation<M>::slice(corrected[i]);
+	}
+	writeBits<Constellation<M>::bitsPerSymbol>(out);
+	writeLlrs<M>(corrected, numSymbols, out);
+}
+template <size_t M, bool Differential>
+void PskDemodCore::demodSymbolsFast(PskDemodOutput& out)
+{
+	const size_t numSymbols = symbols.size();
+	const bool wantSoft = outputs & PSK_SOFT_DECISIONS;
+	const bool wantPhase = outputs & PSK_PHASE;
+	const bool wantBits = outputs & (PSK_BITS | PSK_PACKED_BITS);
+	const bool trackPhase = !Differential || wantPhase;
+	out.softDecisions.resize(wantSoft ? numSymbols : 0);
+	out.phase.resize(wantPhase ? numSymbols : 0);
+	symbolValues.resize(wantBits ? numSymbols : 0);
+	if (numSymbols==0)
+		return;
+	const size_t order = M ? M : numSyms;
+	phasors.resize(numSymbols);
+	angles.resize(numSymbols);
+
+	if (trackPhase)
+	{
+		//Phase of the Mth power of every symbol in the block.
+		for (size_t i=0; i!=numSymbols; i++)
+			phasors[i] = Constellation<M>::power(symbols[i], order);
+		psk_simd::fastArg(&phasors[0], &angles[0], numSymbols);
+
+		fitPhase(numSymbols);
+		if (wantPhase)
+			std::copy(angles.begin(), angles.end(), out.phase.begin());
+	}
+
+	//The corrected symbols go straight to the output if anyone wants them,
+	//otherwise they are only needed for slicing and overwrite the phasors in place.
+	std::complex<float>* corrected = wantSoft ? &out.softDecisions[0] : &phasors[0];
+	if (Differential)
+	{
+		//Multiply by the conjugate of the previous symbol rather than dividing by it.
+		//Scaling by 1/|last|^2 keeps the soft decisions the same size as the exact path's.
+		const std::complex<float> fixedCorrection = std::polar(float(1.0), float(M_PI_4));
+		for (size_t i=0; i!=numSymbols; i++)
+		{
+			const std::complex<float> sample = symbols[i];
+			const float scale = 1.0f/(last.real()*last.real()+last.imag()*last.imag());
+			const float re = (sample.real()*last.real()+sample.imag()*last.imag())*scale;
+			const float im = (sample.imag()*last.real()-sample.real()*last.imag())*scale;
+			corrected[i] = (M==4) ? std::complex<float>(re, im)*fixedCorrection : std::complex<float>(re, im);
+			last = sample;
+		}
+	}
+	else
+	{
+		for (size_t i=0; i!=numSymbols; i++)
+		{
+			angles[i] = -angles[i]/order;
+			if (M==4)
+				angles[i]+=M_PI_4;
+		}
+		psk_simd::fastPolar(&angles[0], &phasors[0], numSymbols);
+		for (size_t i=0; i!=numSymbols; i++)
+		{
+			const std::complex<float> sample = symbols[i];
+			const std::complex<float> rotation = phasors[i];
+			corrected[i] = std::complex<float>(sample.real()*rotation.real()-sample.imag()*rotation.imag(),
+					sample.real()*rotation.imag()+sample.imag()*rotation.real());
+		}
+	}
+
+	slicingStart = pskClockNs();
+
+	//do conversion to bits
+	if (wantBits)
+		sliceFast<M>(corrected, numSymbols, &symbolValues[0], angles);
+	writeBits<Constellation<M>::bitsPerSymbol>(out);
+	writeLlrs<M>(corrected, numSymbols, out);
+}
+
+template <size_t M, bool Differential>
+void PskDemodCore::demodSymbolsLoop(PskDemodOutput& out)
+{
+	const size_t numSymbols = symbols.size();
+	const bool wantSoft = outputs & PSK_SOFT_DECISIONS;
+	const bool wantPhase = outputs & PSK_PHASE;
+	const bool wantBits = outputs & (PSK_BITS | PSK_PACKED_BITS);
+	out.softDecisions.resize(wantSoft ? numSymbols : 0);
+	out.phase.resize(wantPhase ? numSymbols : 0);
+	symbolValues.resize(wantBits ? numSymbols : 0);
+	if (numSymbols==0)
+		return;
+	phasors.resize(numSymbols);
+	std::complex<float>* corrected = wantSoft ? &out.softDecisions[0] : &phasors[0];
+	const std::complex<float> fixedCorrection = std::polar(float(1.0), float(M_PI_4));
+
+	if (Differential)
+	{
+		//The loop only runs for the phase output - the corrected symbols it works out are not used.
+		if (wantPhase)
+			carrierLoop.track<Constellation<M> >(&symbols[0], numSymbols, numSyms, &phasors[0], &out.phase[0]);
+		for (size_t i=0; i!=numSymbols; i++)
+		{
+			const std::complex<float> sample = symbols[i];
+			corrected[i] = sample/last;
+			last = sample;
+			if (M==4)
+				corrected[i]*=fixedCorrection;
+		}
+	}
+	else
+	{
+		carrierLoop.track<Constellation<M> >(&symbols[0], numSymbols, numSyms, corrected, wantPhase ? &out.phase[0] : NULL);
+		//Move the QPSK points off the axes for slicing.
+		if (M==4)
+		{
+			for (size_t i=0; i!=numSymbols; i++)
+				corrected[i] = multiply(corrected[i], fixedCorrection);
+		}
+	}
+
+	slicingStart = pskClockNs();
+
+	//do conversion to bits
+	if (wantBits)
+	{
+		if (fastPhase)
+			sliceFast<M>(corrected, numSymbols, &symbolValues[0], angles);
+		else
+		{
+			for (size_t i=0; i!=numSymbols; i++)
+				symbolValues[i] = Constellation<M>::slice(corrected[i]);
+		}
+	}
+	writeBits<Constellation<M>::bitsPerSymbol>(out);
+	writeLlrs<M>(corrected, numSymbols, out);
+}
+
+template <size_t BitsPerSymbol>
+void PskDemodCore::writeBits(PskDemodOutput& out)
+{
+	const size_t numSymbols = symbolValues.size();
+	if (outputs & PSK_BITS)
+	{
+		out.bits.resize(numSymbols*BitsPerSymbol);
+		//The copy is a fixed size, so each symbol's bits go out in a single store.
+		for (size_t i=0; i!=numSymbols && BitsPerSymbol!=0; i++)
+			memcpy(&out.bits[i*BitsPerSymbol], pointBitShorts[symbolValues[i]], BitsPerSymbol*sizeof(short));
+	}
+
+	if (!(outputs & PSK_PACKED_BITS))
+	{
+		//Don't hold on to bits from before the packed output was turned off.
+		partialOctetBits=0;
+		return;
+	}
+	//Pack the bits most significant bit first, carrying any partial octet over to the next block.
+	out.packedBits.resize((partialOctetBits+numSymbols*BitsPerSymbol)/8);
+	size_t octet=0;
+	for (size_t i=0; i!=numSymbols; i++)
+	{
+		partialOctet = (partialOctet<<BitsPerSymbol) | pointPackedBits[symbolValues[i]];
+		partialOctetBits += BitsPerSymbol;
+		if (partialOctetBits>=8)
+		{
+			partialOctetBits -= 8;
+			out.packedBits[octet++] = partialOctet>>partialOctetBits;
+		}
+	}
+	partialOctet &= (1<<partialOctetBits)-1;
+}
+
+//Number of symbols the LLR amplitude and noise estimates average over.
+static const double llrAverageSymbols = 1000.0;
+//Smallest noise estimate relative to the signal power, so a clean signal does not give infinite LLRs.
+static const double minLlrNoise = 1e-4;
+
+template <size_t M>
+void PskDemodCore::writeLlrs(const std::complex<float>* corrected, size_t numSymbols, PskDemodOutput& out)
+{
+	const bool wantLlrs = outputs & PSK_LLRS;
+	const bool wantQuantized = outputs & PSK_QUANTIZED_LLRS;
+	//Unsupported constellation sizes have no bits to work out LLRs for.
+	if (!(wantLlrs || wantQuantized) || Constellation<M>::bitsPerSymbol==0)
+		return;
+	const size_t numLlrs = numSymbols*Constellation<M>::bitsPerSymbol;
+	//The metrics go straight to the float output if anyone wants it, and are scaled there in place.
+	llrMetrics.resize(wantLlrs ? 0 : numLlrs);
+	out.llrs.resize(wantLlrs ? numLlrs : 0);
+	float* metrics = wantLlrs ? &out.llrs[0] : &llrMetrics[0];
+	llrNearest.resize(numSymbols);
+	llrEnergy.resize(numSymbols);
+	maxLogLlrs(corrected, numSymbols, metrics, &llrNearest[0]);
+	psk_simd::energy(corrected, &llrEnergy[0], numSymbols);
+
+	//Estimate the amplitude A as the average projection onto the nearest points
+	//and the noise N0 as the rest of the average energy, over roughly the last llrAverageSymbols symbols.
+	double nearestSum = 0.0;
+	double energySum = 0.0;
+	for (size_t i=0; i!=numSymbols; i++)
+	{
+		nearestSum += llrNearest[i];
+		energySum += llrEnergy[i];
+	}
+	const double weight = llrAverageSymbols/(llrAverageSymbols+numSymbols);
+	llrNearestSum = llrNearestSum*weight+nearestSum;
+	llrEnergySum = llrEnergySum*weight+energySum;
+	llrCount = llrCount*weight+numSymbols;
+	const double amplitude = llrNearestSum/llrCount;
+	const double noise = std::max(llrEnergySum/llrCount-amplitude*amplitude, minLlrNoise*amplitude*amplitude);
+	const float scale = (amplitude>0.0) ? 2.0*amplitude/noise : 0.0f;
+	out.llrScale = scale;
+
+	if (wantLlrs)
+	{
+		for (size_t i=0; i!=numLlrs; i++)
+			metrics[i] *= scale;
+	}
+	if (wantQuantized)
+	{
+		out.quantizedLlrs.resize(numLlrs);
+		psk_simd::quantize(metrics, wantLlrs ? PSK_LLR_QUANTIZATION : scale*PSK_LLR_QUANTIZATION, &out.quantizedLlrs[0], numLlrs);
+	}
+}
+
+void PskDemodCore::flushPackedBits(PskDemodOutput& out)
+{
+	if (partialOctetBits!=0)
+	{
+		//Pad the last octet with zeros.
+		out.packedBits.push_back(partialOctet<<(8-partialOctetBits));
+		partialOctet=0;
+		partialOctetBits=0;
+	}
+}
+
+template <size_t M>
+static void slicePointsOf(const std::complex<float>* symbols, size_t numSymbols, unsigned char* values)
+{
+	for (size_t i=0; i!=numSymbols; i++)
+		values[i] = Constellation<M>::slice(symbols[i]);
+}
+
+void PskDemodCore::slicePoints(const std::complex<float>* symbols, size_t numSymbols, unsigned char* values) const
+{
+	switch (numSyms)
+	{
+	case 2: slicePointsOf<2>(symbols, numSymbols, values); break;
+	case 4: slicePointsOf<4>(symbols, numSymbols, values); break;
+	case 8: slicePointsOf<8>(symbols, numSymbols, values); break;
+	case 16: slicePointsOf<16>(symbols, numSymbols, values); break;
+	default: std::fill(values, values+numSymbols, 0); break;
+	}
+}
+
+void PskDemodCore::maxLogLlrs(const std::complex<float>* corrected, size_t numSymbols, float* metrics, float* nearest) const
+{
+	//The SIMD kernels number the points counterclockwise, which Gray coding leaves alone for BPSK.
+	if (numSyms<=8 && (!grayCoding || numSyms==2))
+	{
+		psk_simd::maxLogLlrs(corrected, numSymbols, numSyms, metrics, nearest);
+		return;
+	}
+	//Otherwise project each symbol onto every point and take the difference of the projections onto
+	//the nearest points with each bit clear and set.
+	for (size_t i=0; i!=numSymbols; i++)
+	{
+		float best[PSK_MAX_BITS_PER_SYMBOL][2];
+		for (size_t j=0; j!=bitsPerSymbol; j++)
+			best[j][0] = best[j][1] = -std::numeric_limits<float>::max();
+		float nearestProjection = -std::numeric_limits<float>::max();
+		for (size_t point=0; point!=numSyms; point++)
+		{
+			const float projection = corrected[i].real()*pointPhasors[point].real()+corrected[i].imag()*pointPhasors[point].imag();
+			nearestProjection = std::max(nearestProjection, projection);
+			for (size_t j=0; j!=bitsPerSymbol; j++)
+			{
+				float& bitBest = best[j][(pointBits[point]>>j)&1];
+				bitBest = std::max(bitBest, projection);
+			}
+		}
+		for (size_t j=0; j!=bitsPerSymbol; j++)
+			metrics[i*bitsPerSymbol+j] = best[j][0]-best[j][1];
+		nearest[i] = nearestProjection;
+	}
+}
+
+void PskDemodCore::rotateOutput(PskDemodOutput& out, long turns) const
+{
+	if (turns==0)
+		return;
+	//The carrier loop keeps its phase between -pi and pi, which is +/-pi*numSyms in the phase output.
+	const float phaseLimit = M_PI*numSyms;
+	for (size_t i=0; i!=out.phase.size(); i++)
+	{
+		out.phase[i] += M_2PI*turns;
+		if (carrierMode==PSK_CARRIER_LOOP)
+		{
+			while (out.phase[i]>phaseLimit)
+				out.phase[i] -= 2*phaseLimit;
+			while (out.phase[i]<-phaseLimit)
+				out.phase[i] += 2*phaseLimit;
+		}
+	}
+	//Differential decoding takes the phase from one symbol to the next, which the rotation does not change.
+	if (differentialDecoding || turns%long(numSyms)==0)
+		return;
+	//A turn of the phase output is a turn of 2pi/numSyms of the symbols.
+	const size_t numSymbols = out.softDecisions.size();
+	const std::complex<float> rotation = std::polar(1.0f, float(-M_2PI*turns/numSyms));
+	for (size_t i=0; i!=numSymbols; i++)
+		out.softDecisions[i] = multiply(out.softDecisions[i], rotation);
+	if (numSymbols==0 || bitsPerSymbol==0)
+		return;
+
+	if (!out.bits.empty())
+	{
+		std::vector<unsigned char> values(numSymbols);
+		slicePoints(&out.softDecisions[0], numSymbols, &values[0]);
+		out.bits.resize(numSymbols*bitsPerSymbol);
+		for (size_t i=0; i!=numSymbols; i++)
+			std::copy(pointBitShorts[values[i]], pointBitShorts[values[i]]+bitsPerSymbol, &out.bits[i*bitsPerSymbol]);
+	}
+	if (out.llrs.empty() && out.quantizedLlrs.empty())
+		return;
+	//Scaled and quantized the same way as writeLlrs.
+	const size_t numLlrs = numSymbols*bitsPerSymbol;
+	std::vector<float> metrics(numLlrs);
+	std::vector<float> nearest(numSymbols);
+	maxLogLlrs(&out.softDecisions[0], numSymbols, &metrics[0], &nearest[0]);
+	if (!out.llrs.empty())
+	{
+		out.llrs.resize(numLlrs);
+		for (size_t i=0; i!=numLlrs; i++)
+			out.llrs[i] = metrics[i]*out.llrScale;
+	}
+	if (!out.quantizedLlrs.empty())
+	{
+		out.quantizedLlrs.resize(numLlrs);
+		if (out.llrs.empty())
+			psk_simd::quantize(&metrics[0], out.llrScale*PSK_LLR_QUANTIZATION, &out.quantizedLlrs[0], numLlrs);
+		else
+			psk_simd::quantize(&out.llrs[0], PSK_LLR_QUANTIZATION, &out.quantizedLlrs[0], numLlrs);
+	}
+}
+
+//The loops and exponential averages are taken to have forgotten where they started after this many time constants,
+//when what is left of the start is e^-16, about 1e-7, which is down at the float rounding.
+static const double warmupTimeConstants = 16.0;
+
+size_t PskDemodCore::warmupSymbols() const
+{
+	//The matched filter starts with a history of zeros.
+	double symbols = matchedFilter.length()/samplesPerOutputSymbol();
+	if (timingMode==PSK_TIMING_MAX_ENERGY)
+		symbols += numAvg;
+	else if (timingMode==PSK_TIMING_LEAKY_ENERGY)
+		symbols += warmupTimeConstants/(1-energyDecay);
+	else if (gardner.bandwidth()>0)
+		symbols += warmupTimeConstants/gardner.bandwidth();
+	//The carrier phase only counts if it is tracked.
+	if (!differentialDecoding || (outputs & PSK_PHASE))
+	{
+		if (carrierMode==PSK_CARRIER_POWER_FIT)
+			symbols += phaseAvg;
+		else if (carrierLoop.bandwidth()>0)
+			symbols += warmupTimeConstants/carrierLoop.bandwidth();
+	}
+	if (outputs & (PSK_LLRS | PSK_QUANTIZED_LLRS))
+		symbols += warmupTimeConstants*llrAverageSymbols;
+	return size_t(ceil(symbols))+1;
+}
+
+//Number of 2pi wraps to add to phase to bring it closest to reference.
+static long phaseWraps(float reference, float phase)
+{
+	return round((reference-double(phase))/M_2PI);
+}
+
+void PskDemodCore::fitPhase(size_t numSymbols)
+{
+	//Each phase is unwrapped against the previous phase estimate, which would mean fitting one phase at a time.
+	//Instead the block is unwrapped against the previous unwrapped phase, which nearly always picks the same wrap,
+	//and fitted all at once.  The fits are kept up to the first phase where the wraps differ
+	//and the rest of the block is tried again from there, so the estimates are the same either way.
+	unwrapped.resize(numSymbols);
+	fitted.resize(numSymbols);
+	size_t blockSize = numSymbols;
+	for (size_t i=0; i!=numSymbols;)
+	{
+		const size_t len = std::min(blockSize, numSymbols-i);
+		float reference = phaseEstimate;
+		for (size_t j=i; j!=i+len; j++)
+		{
+			unwrapped[j] = angles[j]+phaseWraps(reference, angles[j])*M_2PI;
+			reference = unwrapped[j];
+		}
+		phaseEstimator.predict(&unwrapped[i], len, &fitted[i]);
+
+		//The first phase was unwrapped against the estimate so it is always right.
+		size_t good = 1;
+		while (good!=len && phaseWraps(fitted[i+good-1], angles[i+good])==phaseWraps(unwrapped[i+good-1], angles[i+good]))
+			good++;
+		phaseEstimator.accept(good);
+		phaseEstimate = fitted[i+good-1];
+		i += good;
+		//Try smaller blocks while the wraps keep differing so noisy phase does not redo much work.
+		if (good!=len)
+			blockSize = std::max(2*good, size_t(16));
+	}
+	angles.swap(fitted);
+}
+
+long PskDemodCore::phaseWrapTurns(float phase) const
+{
+	//Wrap about numSyms*2pi and NOT 2PI or phase offsets are introduced,
+	//since phaseEstimate is the estimate of the numSyms power of the phase.
+	float wrapValue = M_2PI*numSyms;
+	if (carrierMode!=PSK_CARRIER_POWER_FIT || std::abs(phase)<=wrapValue)
+		return 0;
+	long numWraps = round(phase/wrapValue);
+	return numWraps*long(numSyms);
+}
+
+void PskDemodCore::wrapPhase()
+{
+	//Wrap phase estimate back to a reasonable value to keep it from going to infinity.
+	const long turns = phaseWrapTurns(phaseEstimate);
+	if (turns!=0)
+	{
+		//Subtract the phaseOffset from the estimator.  This takes care of doing it for all the history.
+		//and reseting the state.
+		float wrapValue = M_2PI*numSyms;
+		phaseEstimate = phaseEstimator.subtractConst(turns/long(numSyms)*wrapValue);
+	}
+}
+
+void PskDemodCore::resyncEnergy(size_t newSamplesPerSymbol, size_t newNumAvg)
+{
+	//The window is rebuilt as floats, and goes back to complex 16 bit samples with the next block of them.
+	useSc16Window(false);
+	//Pull the history out of the window in time order.
+	std::vector<std::complex<float> > history;
+	if (samplesPerSymbol>1)
+	{
+		history.reserve(windowRows*samplesPerSymbol+index);
+		size_t row = (windowRow+numAvg-windowRows)%numAvg;
+		for (size_t r=0; r!=windowRows; r++)
+		{
+			history.insert(history.end(), window.begin()+row*samplesPerSymbol, window.begin()+(row+1)*samplesPerSymbol);
+			row = (row+1)%numAvg;
+		}
+		history.insert(history.end(), window.begin()+windowRow*samplesPerSymbol, window.begin()+windowRow*samplesPerSymbol+index);
+	}
+
+	const size_t oldSamplesPerSymbol = samplesPerSymbol;
+	samplesPerSymbol = std::max(newSamplesPerSymbol, size_t(1));
+	numAvg = std::max(newNumAvg, size_t(1));
+	if (timingMode!=PSK_TIMING_MAX_ENERGY)
+	{
+		//Release the numAvg symbol window while another timing method is in use.
+		std::vector<float>().swap(windowEnergy);
+		std::vector<double>().swap(shadowEnergy);
+		windowRow = 0;
+		windowRows = 0;
+		shadowRows = 0;
+		if (timingMode==PSK_TIMING_LEAKY_ENERGY)
+		{
+			const double timeConstant = (timingTimeConstant>0) ? timingTimeConstant : (numAvg+1)/2.0;
+			energyDecay = 1-1/std::max(timeConstant, 1.0);
+			//The current symbol and the energy sums carry on unless the symbol size has changed.
+			if (samplesPerSymbol!=oldSamplesPerSymbol || window.size()!=samplesPerSymbol)
+			{
+				window.assign(samplesPerSymbol, std::complex<float>(0.0,0.0));
+				symbolEnergy.assign(samplesPerSymbol,0.0);
+				index = 0;
+			}
+			return;
+		}
+		std::vector<std::complex<float> >().swap(window);
+		std::vector<double>().swap(symbolEnergy);
+		index = 0;
+		return;
+	}
+	const size_t numDataPts = samplesPerSymbol*numAvg;
+	window.assign(numDataPts, std::complex<float>(0.0,0.0));
+	windowEnergy.assign(numDataPts, 0.0);
+	symbolEnergy.assign(samplesPerSymbol,0.0);
+	shadowEnergy.assign(samplesPerSymbol,0.0);
+	shadowRows=0;
+
+	//Refill the window with the newest samples, leaving room for at least one more sample.
+	const size_t numKeep = std::min(history.size(), numDataPts-1);
+	std::copy(history.end()-numKeep, history.end(), window.begin());
+	index=0;
+	for (size_t i=0; i!=numKeep; i++)
+	{
+		windowEnergy[i] = norm(window[i]);
+		symbolEnergy[index]+=windowEnergy[i];
+		index++;
+		if (index==samplesPerSymbol)
+			index=0;
+	}
+	windowRow = numKeep/samplesPerSymbol;
+	windowRows = windowRow;
+}
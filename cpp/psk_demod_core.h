@@ -0,0 +1,594 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+#ifndef PSK_DEMOD_CORE_H
+#define PSK_DEMOD_CORE_H
+
+#include <complex>
+#include <vector>
+#include <cstddef>
+
+/* Class for calculating a linear fit for uniformly sampled data.
+ * To use this class do the following:
+ * 1. Specify the number of points to use in the fit (the history) and sample rate of the data.
+ * 2. Pass in one data point at a time. The point which is the linear best fit given the current history is returned.
+ */
+class LinearFit
+{
+public:
+	LinearFit(size_t numPts, float sampleRate);
+	float next(float yval);
+	float reset(size_t* numPts=NULL, float* sampleRate=NULL, bool forceHistoryClear=false);
+	//Subtract yval from every point in the history.
+	float subtractConst(float yval);
+
+	//Pass in a block of len points, returning the best fit for each in fits - the same as calling next() on each in turn.
+	//fits may be the same buffer as yvals.
+	void next(const float* yvals, size_t len, float* fits);
+	//Work out the fits for a block of points without adding them to the history.
+	//accept() then adds the first count of those points, so a caller can try out a block and keep part of it.
+	void predict(const float* yvals, size_t len, float* fits);
+	void accept(size_t count);
+private:
+	void push(unsigned long long y);
+	float calculateFit();
+	//The best fit for the newest of pts points from their sums - see calculateFit().
+	static long long numerator(unsigned long long ySum, unsigned long long iySum, size_t pts) {return 2*iySum-(pts-1)*ySum;}
+	float fitSums(double ySum, double numerator, size_t pts) const {return (ySum + 3.0*numerator/(pts+1))/(fixedScale*pts);}
+	//Point j of the history, oldest first.
+	unsigned long long history(size_t j) const
+	{
+		size_t i = first+j;
+		if (i>=yvals.size())
+			i-=yvals.size();
+		return yvals[i]-offset;
+	}
+	//Make room for numPts points in the history, keeping the newest points.
+	void resizeHistory(size_t numPts);
+	//Conversion to and from the fixed point values the history and sums are kept in.
+	unsigned long long toFixed(double y) const {return toFixed(y, fixedScale);}
+	static unsigned long long toFixed(double y, double scale);
+	double fromFixed(unsigned long long y) const {return double((long long)y)/fixedScale;}
+	//The history is kept oldest first in a circular buffer of n points so it never allocates once it is full.
+	//Each point is stored plus offset, so subtracting a constant from all of them does not have to touch them.
+	std::vector<unsigned long long> yvals;
+	size_t first;
+	size_t numVals;
+	unsigned long long offset;
+	//sum(yi) and sum(i*yi), where i is the position in the history.
+	//These use unsigned arithmetic so they wrap cleanly - the true values always fit in 63 bits.
+	unsigned long long ySum;
+	unsigned long long iySum;
+	size_t n;
+	float xdelta;
+	//The points are fixed point numbers with this many fractional bits, which is a scale of 2^scaleBits.
+	int scaleBits;
+	double fixedScale;
+	//Scratch space for predict() - the block in fixed point and the sums for each of its points.
+	std::vector<unsigned long long> blockVals;
+	std::vector<double> blockSums;
+};
+
+/* Gardner timing error detector driving a cubic Farrow interpolator.
+ * Works from as few as 2 samples per symbol, which need not be an integer.
+ * Two points are interpolated per symbol, the symbol itself and the midpoint between it and the last symbol.
+ * The timing error worked out from them steers the interpolation points through a second order loop.
+ * Only the last few samples are kept from one block to the next.
+ */
+class GardnerTiming
+{
+public:
+	GardnerTiming();
+	//Samples per symbol - anything under 2 is treated as 2.
+	void setSamplesPerSymbol(double samplesPerSymbol);
+	//Loop bandwidth normalized to the symbol rate.
+	void setLoopBandwidth(double loopBandwidth);
+	//Start over with the next sample, forgetting the timing.
+	void reset();
+	//Interpolate the symbols in len samples onto the end of symbols.
+	//If sampleIndex is not NULL the sample each symbol falls on within a symbol period is added to it as well.
+	void process(const std::complex<float>* data, size_t len, std::vector<std::complex<float> >& symbols, std::vector<short>* sampleIndex);
+	//Most symbols the next len samples can produce.
+	size_t maxSymbols(size_t len) const;
+	double samplesPerSymbol() const {return symbolSamples;}
+	double bandwidth() const {return loopBandwidth;}
+	//Count the sample index from count samples into the stream, as if that many samples had gone before.
+	void setSampleCount(unsigned long long count) {sampleCount = count;}
+private:
+	std::complex<float> interpolate(const std::complex<float>* data, long base, float mu) const;
+	double symbolSamples;
+	double loopBandwidth;
+	//Loop filter gains and integrator, in fractions of a symbol.
+	double gain1;
+	double gain2;
+	double integrator;
+	//Position of the next interpolation point in samples from the start of the block.
+	double nextPoint;
+	//Set when the next point is the midpoint between symbols.
+	bool midpointNext;
+	bool haveSymbol;
+	std::complex<float> lastSymbol;
+	std::complex<float> midpoint;
+	//Samples before the start of the block which the interpolator still needs.
+	std::complex<float> taps[3];
+	//Samples seen before the start of the block, for the sample index.
+	unsigned long long sampleCount;
+};
+
+/* Second order decision directed carrier tracking loop.
+ * Each symbol is rotated by the carrier phase estimate and compared with the nearest constellation point.
+ * The phase error to that point steers the estimate through a proportional plus integral loop filter,
+ * so the loop tracks frequency offsets as well as the phase.  The estimate is advanced with a complex rotation,
+ * which takes a few multiply-adds per symbol.  After a reset the phase starts from the Mth power of the first few symbols.
+ */
+class CarrierLoop
+{
+public:
+	CarrierLoop();
+	//Loop bandwidth normalized to the symbol rate.
+	void setLoopBandwidth(double loopBandwidth);
+	//Forget the carrier phase and frequency.
+	void reset();
+	//Rotate len symbols by the carrier phase into corrected, which may be the same buffer as symbols,
+	//so the constellation points of Points come out at multiples of 2pi/numSyms.
+	//If phase is not NULL numSyms times the phase each symbol is corrected by is written to it.
+	//Points is one of the constellations defined alongside PskDemodCore, which is the only user.
+	template <class Points>
+	void track(const std::complex<float>* symbols, size_t len, size_t numSyms, std::complex<float>* corrected, float* phase);
+	double bandwidth() const {return loopBandwidth;}
+private:
+	double loopBandwidth;
+	float gain1;
+	float gain2;
+	//Carrier phase in radians between -pi and pi, and frequency in radians per symbol.
+	float carrierPhase;
+	float frequency;
+	//Set once the phase has been started from the first symbols.
+	bool started;
+};
+
+/* Root raised cosine matched filter.
+ * Short filters are applied directly.  Longer ones use overlap-save fast convolution,
+ * filtering a block of samples at a time with a radix 2 FFT, which costs O(log(taps)) per sample instead of O(taps).
+ * The filter is causal, so the output is delayed by half its length, and carries on from one block to the next.
+ * It has unity gain at DC.
+ */
+class MatchedFilter
+{
+public:
+	MatchedFilter();
+	//Design the filter for a roll-off between 0 and 1 spanning span symbols.  A span of 0 turns it off.
+	//The history is only cleared if the design changes.
+	void design(double samplesPerSymbol, double rollOff, size_t span);
+	bool enabled() const {return !taps.empty();}
+	size_t length() const {return taps.size();}
+	//Forget the history, so the filter starts over as if it had been fed zeros.
+	void reset();
+	//Filter len samples into out, which can be data itself to filter in place but must not otherwise overlap it.
+	void process(const std::complex<float>* data, size_t len, std::complex<float>* out);
+private:
+	void filterDirect(const std::complex<float>* data, size_t len, std::complex<float>* out);
+	void filterBlock(const std::complex<float>* data, size_t len, std::complex<float>* out);
+	//Keep the newest samples in work for the next block, once the len new ones have been copied in after the history.
+	void keepHistory(size_t len);
+	//In place FFT of fftSize points, or the inverse without the 1/fftSize scaling.
+	void fft(std::complex<float>* data, bool inverse) const;
+	double designSamplesPerSymbol;
+	double designRollOff;
+	size_t designSpan;
+	std::vector<float> taps;
+	//The last length()-1 input samples, oldest first.
+	std::vector<std::complex<float> > history;
+	//Overlap-save state - fftSize is 0 when the filter is applied directly.
+	size_t fftSize;
+	//FFT of the taps, scaled by 1/fftSize so the inverse FFT comes out at the right level.
+	std::vector<std::complex<float> > response;
+	//Twiddle factors for the FFT and inverse FFT passes - the pass over blocks of 2*half points uses [half, 2*half).
+	std::vector<std::complex<float> > twiddles;
+	std::vector<std::complex<float> > inverseTwiddles;
+	std::vector<size_t> bitReverse;
+	//Scratch space for the block being filtered - history followed by the new samples.
+	std::vector<std::complex<float> > work;
+};
+
+/* Signal presence detector for gating the demodulator on bursty channels.
+ * The mean power of each block of samples is compared with a noise floor, which drops straight down to any quieter block
+ * and creeps up while there is no signal, so it sits just under the noise and follows slow changes in it.
+ * A signal is present from the first block more than the threshold over the floor until holdBlocks blocks in a row are not.
+ */
+class PresenceDetector
+{
+public:
+	PresenceDetector();
+	//Power over the noise floor, in dB, for a block to count as having a signal in it.
+	void setThreshold(double thresholdDb);
+	//Blocks without a signal in them which a signal is held present for.
+	void setHoldBlocks(size_t blocks);
+	//Forget the noise floor and start with no signal present.
+	void reset();
+	//Take the mean power of the next block, returning whether a signal is present in it.
+	bool update(double power);
+	bool present() const {return signalPresent;}
+	//Power halfway in dB between the noise floor and the threshold, for placing the edges of a burst.
+	double edgeLevel() const;
+private:
+	double threshold;
+	size_t holdBlocks;
+	//Noise floor power - 0 until a block with some power in it.
+	double noiseFloor;
+	size_t quietBlocks;
+	bool signalPresent;
+};
+
+/* Timing recovery methods for PskDemodCore.
+ * PSK_TIMING_MAX_ENERGY picks the sample with the most energy averaged over numAvg symbols and needs
+ * an integer number of samples per symbol.  PSK_TIMING_LEAKY_ENERGY does the same with an exponential
+ * average of the energy, so it only keeps the current symbol.  PSK_TIMING_GARDNER uses GardnerTiming.
+ */
+enum PskTimingMode
+{
+	PSK_TIMING_MAX_ENERGY,
+	PSK_TIMING_GARDNER,
+	PSK_TIMING_LEAKY_ENERGY
+};
+
+/* Carrier phase tracking methods for PskDemodCore.
+ * PSK_CARRIER_POWER_FIT fits a line to the phase of the Mth power of the last phaseAvg symbols.
+ * PSK_CARRIER_LOOP uses CarrierLoop, which is cheaper per symbol and settles faster.
+ */
+enum PskCarrierMode
+{
+	PSK_CARRIER_POWER_FIT,
+	PSK_CARRIER_LOOP
+};
+
+/* Flags for the outputs PskDemodCore fills in.
+ * Work which only feeds an output that is turned off is skipped.
+ */
+enum PskDemodOutputs
+{
+	PSK_SOFT_DECISIONS = 1,
+	PSK_BITS = 2,
+	PSK_PACKED_BITS = 4,
+	PSK_PHASE = 8,
+	PSK_SAMPLE_INDEX = 16,
+	PSK_LLRS = 32,
+	PSK_QUANTIZED_LLRS = 64,
+	PSK_ALL_OUTPUTS = 127
+};
+
+/* A burst starting or ending in the output of PskDemodCore::process with presence gating on.
+ * sample is where it happens in the block passed in and symbol the number of symbols put out before it.
+ * A burst found at the start of a block may have started in the last presence block of the block before,
+ * in which case sample is negative and its symbols from there are put out first.
+ */
+struct PskPresenceChange
+{
+	long sample;
+	size_t symbol;
+	bool present;
+};
+
+//Steps per unit of LLR in PskDemodOutput::quantizedLlrs.
+const float PSK_LLR_QUANTIZATION = 4.0f;
+//Complex 16 bit integer samples are scaled by this, so full scale is 1.
+const float PSK_SC16_SCALE = 1.0f/32768;
+//Largest constellation size PskDemodCore slices into bits, and its bits per symbol.
+const size_t PSK_MAX_CONSTELLATION = 16;
+const size_t PSK_MAX_BITS_PER_SYMBOL = 4;
+
+/* Output of a single call to PskDemodCore::process.
+ * One entry per output symbol in softDecisions, phase and sampleIndex
+ * and bitsPerBaud entries per output symbol in bits, llrs and quantizedLlrs.
+ * packedBits holds the same bits packed most significant bit first, in whole octets only.
+ * llrs are the max-log log likelihood ratios log(P(0)/P(1)) of the bits, and quantizedLlrs the same
+ * in steps of 1/PSK_LLR_QUANTIZATION saturated to +/-127.  llrScale is what the max-log metrics
+ * of the block were scaled by to give the LLRs.  presenceChanges marks where bursts start and end with presence gating on.
+ */
+struct PskDemodOutput
+{
+	PskDemodOutput();
+	//Number of symbols demodulated, whichever outputs are turned on.
+	size_t numSymbols;
+	std::vector<std::complex<float> > softDecisions;
+	std::vector<short> bits;
+	std::vector<float> phase;
+	std::vector<short> sampleIndex;
+	std::vector<unsigned char> packedBits;
+	std::vector<float> llrs;
+	std::vector<signed char> quantizedLlrs;
+	float llrScale;
+	std::vector<PskPresenceChange> presenceChanges;
+	void clear();
+	//Add the symbols of another output on to the end of this one.
+	void append(const PskDemodOutput& other);
+	//Make room for numSymbols symbols in the buffers for the given outputs so filling them does not allocate.
+	void reserve(size_t numSymbols, size_t bitsPerSymbol, unsigned int outputs=PSK_ALL_OUTPUTS);
+};
+
+/* Running totals of the work done by PskDemodCore::process, for performance monitoring.
+ * The counts are cheap to keep - the clock is read a few times per call to process().
+ */
+struct PskDemodStats
+{
+	PskDemodStats();
+	void clear();
+	PskDemodStats& operator+=(const PskDemodStats& other);
+	unsigned long long samples;
+	unsigned long long symbols;
+	//Nanoseconds spent on matched filtering and timing recovery, phase tracking and correction, and slicing and packing the bits.
+	unsigned long long timingNs;
+	unsigned long long phaseNs;
+	unsigned long long slicingNs;
+	//Number of times the timing recovery energy sums were replaced to flush out floating point error.
+	unsigned long long energyResyncs;
+	//Samples the presence gating skipped as there was no signal in them, which are counted in samples as well.
+	unsigned long long gatedSamples;
+};
+
+//Monotonic clock in nanoseconds for timing the work.
+unsigned long long pskClockNs();
+
+/* Framework independent PSK demodulator.
+ * Does optional matched filtering, timing recovery, carrier phase tracking and slicing on buffers of complex baseband samples.
+ * All tracking state is carried over from one call to process() to the next so a stream can be passed in
+ * with arbitrary packetization.  The setters are expected to be called between calls to process().
+ */
+class PskDemodCore
+{
+public:
+	PskDemodCore();
+	void setSamplesPerBaud(size_t samplesPerBaud);
+	void setNumAvg(size_t numAvg);
+	void setConstellationSize(size_t constellationSize);
+	void setPhaseAvg(size_t phaseAvg);
+	void setDifferentialDecoding(bool differentialDecoding);
+	//Use the polynomial phase approximations (see psk_simd_kernels.h) instead of the exact math library calls.
+	void setFastPhase(bool fastPhase);
+	//Map the constellation points to bits so neighbouring points differ by one bit, rather than numbering them
+	//counterclockwise from the point at phase 0 (the point at pi/4 for QPSK) with the first bit out least significant.
+	void setGrayCoding(bool grayCoding);
+	//Which of the PskDemodOutputs to fill in - all of them by default.  The others are left empty.
+	void setOutputs(unsigned int outputs);
+	void setSampleRate(float sampleRate);
+	void setTimingMode(PskTimingMode mode);
+	//Symbol rate for the Gardner timing, which works out the samples per symbol from it and the sample rate.
+	//With 0 it uses samplesPerBaud.  The max energy timing always uses samplesPerBaud.
+	void setSymbolRate(double symbolRate);
+	//Gardner timing loop bandwidth normalized to the symbol rate.
+	void setTimingLoopBandwidth(double loopBandwidth);
+	//Time constant of the leaky energy average in symbols.
+	//With 0 it is (numAvg+1)/2, which averages out as much noise as the numAvg symbol window.
+	void setTimingTimeConstant(double timeConstant);
+	void setCarrierMode(PskCarrierMode mode);
+	//Carrier loop bandwidth normalized to the symbol rate.
+	void setCarrierLoopBandwidth(double loopBandwidth);
+	//Root raised cosine matched filter in front of the timing recovery, spanning span symbols (0 turns it off).
+	void setMatchedFilter(size_t span, double rollOff);
+	//Resync the timing recovery energy and clear the timing and phase tracking history.
+	void reset();
+	//Count the Gardner timing's sample index from this position in the stream, for demodulating part of a stream.
+	void setSamplePosition(unsigned long long samples);
+	//Only demodulate while a PresenceDetector finds a signal, checking blocks of about 32 symbols.  Between bursts the samples
+	//are only measured and no symbols come out.  Each burst is demodulated from a reset and its packed bits are padded out
+	//to an octet at the end.  Turning the gating on starts with no signal present and the noise floor to learn.
+	void setPresenceGating(bool enabled);
+	//Power over the noise floor, in dB, which starts a burst.
+	void setPresenceThreshold(double thresholdDb);
+	//Symbols a burst carries on for after the signal goes, which also lets the timing recovery put out the symbols it holds back.
+	void setPresenceHold(size_t holdSymbols);
+
+	size_t samplesPerBaud() const {return samplesPerSymbol;}
+	//Input samples per output symbol for the current timing mode, which need not be an integer.
+	double samplesPerOutputSymbol() const;
+	size_t constellationSize() const {return numSyms;}
+	//Number of bits out per symbol - zero if the constellation size is not 2, 4, 8 or 16.
+	size_t bitsPerBaud() const {return bitsPerSymbol;}
+	unsigned int enabledOutputs() const {return outputs;}
+	PskTimingMode timing() const {return timingMode;}
+	bool differential() const {return differentialDecoding;}
+	//Symbols a freshly reset demodulator takes before its output is the same as one which has been running all along,
+	//bar a carrier phase ambiguity of whole constellation points and floating point rounding.  This covers filling the
+	//timing and phase averages, holding back the max energy window and settling the loops and exponential averages.
+	size_t warmupSymbols() const;
+
+	//Set while the presence gating finds a signal, and always with the gating off.
+	bool signalPresent() const {return !presenceGating || presence.present();}
+
+	//Demodulate len complex samples.  The output buffers are cleared before they are filled.
+	void process(const std::complex<float>* data, size_t len, PskDemodOutput& out);
+	//The same for complex 16 bit integer samples, scaled by PSK_SC16_SCALE.  The max energy and leaky energy timing work out
+	//the energy in integers and only convert the samples picked as symbols, while the Gardner timing, the matched filter
+	//and samplesPerBaud 1 convert the whole block.
+	void process(const std::complex<short>* data, size_t len, PskDemodOutput& out);
+	//Append any bits left over from the last call to process to out.packedBits as a zero padded octet.
+	void flushPackedBits(PskDemodOutput& out);
+	//Turn the output of a block by whole turns of the phase output, which is constellationSize times the carrier phase,
+	//as if the carrier phase had locked on that many points further round.  The bits and LLRs are worked out again from
+	//the rotated soft decisions, so this needs the soft decisions, and the LLRs are scaled by out.llrScale.
+	//packedBits is left alone as its octets need not start on a symbol.  With differential decoding only the phase changes.
+	void rotateOutput(PskDemodOutput& out, long turns) const;
+	//Turns the phase fit takes off its phase estimate after a block ending on the given phase output, to keep it bounded.
+	//These are whole constellations, so the symbols are not rotated.  The carrier loop keeps its phase wrapped itself.
+	long phaseWrapTurns(float phase) const;
+
+	//Work done since the stats were last cleared.
+	const PskDemodStats& stats() const {return workStats;}
+	void clearStats() {workStats.clear();}
+
+private:
+	//Demodulate a block without the presence gating.
+	void demodulate(const std::complex<float>* data, size_t len, PskDemodOutput& out);
+	void demodulate(const std::complex<short>* data, size_t len, PskDemodOutput& out);
+	//Demodulate the parts of a block with a signal in them, for either sample type.
+	template <typename Sample>
+	void processGated(const Sample* data, size_t len, PskDemodOutput& out);
+	//Where a burst starts between from and to, which has to be a presence block with the burst in it.
+	template <typename Sample>
+	size_t findBurstStart(const Sample* data, size_t from, size_t to);
+	//Samples of the last presence block of the last call, which a burst found at the start of the next call may have started in.
+	std::vector<std::complex<float> >& presenceTail(const std::complex<float>*) {return gateTail;}
+	std::vector<std::complex<short> >& presenceTail(const std::complex<short>*) {return gateTailSc16;}
+	//Reset for a burst starting, with nothing held over from the last one.
+	void startBurst();
+	//Demodulate part of a burst onto the end of out.
+	template <typename Sample>
+	void demodulateBurst(const Sample* data, size_t len, PskDemodOutput& out);
+	void resyncEnergy(size_t newSamplesPerSymbol, size_t newNumAvg);
+	//Set up the output for a block of len samples and return the clock reading it starts at.
+	unsigned long long beginBlock(size_t len, PskDemodOutput& out);
+	//Demodulate the symbols picked out of the block and add up the work done on it.
+	void endBlock(size_t len, unsigned long long timingStart, PskDemodOutput& out);
+	void recoverTiming(const std::complex<float>* data, size_t len, PskDemodOutput& out);
+	//The energy timing methods for either sample type, which keep the samples in the window as they come.
+	template <typename Sample>
+	void recoverTimingMaxEnergy(const Sample* data, size_t len, PskDemodOutput& out);
+	template <typename Sample>
+	void recoverTimingLeaky(const Sample* data, size_t len, PskDemodOutput& out);
+	std::vector<std::complex<float> >& sampleWindow(const std::complex<float>*);
+	std::vector<std::complex<short> >& sampleWindow(const std::complex<short>*);
+	//Move the samples in the window over to the other sample type if the input has changed.
+	void useSc16Window(bool sc16);
+	void updateGardnerRate();
+	void updateMatchedFilter();
+	void selectSymbolKernel();
+	//Fill in the symbol maps for the constellation size and coding.
+	template <size_t M>
+	void buildSymbolMap();
+	//Slice phase corrected symbols into point numbers, for the constellation size picked at run time.
+	void slicePoints(const std::complex<float>* symbols, size_t numSymbols, unsigned char* values) const;
+	//Max-log LLR metrics of the phase corrected symbols as psk_simd::maxLogLlrs works them out, from the symbol maps
+	//when the points are not numbered in the way its kernels take them.
+	void maxLogLlrs(const std::complex<float>* corrected, size_t numSymbols, float* metrics, float* nearest) const;
+	//Phase tracking, correction and slicing of the symbols picked out by the timing recovery.
+	//Specialized for each supported constellation size M (0 for any other size) and decoding mode.
+	template <size_t M, bool Differential>
+	void demodSymbols(PskDemodOutput& out);
+	//The same with the phase approximations, done a pass at a time over the block so they vectorize.
+	template <size_t M, bool Differential>
+	void demodSymbolsFast(PskDemodOutput& out);
+	//The same with the carrier loop tracking the phase.
+	template <size_t M, bool Differential>
+	void demodSymbolsLoop(PskDemodOutput& out);
+	typedef void (PskDemodCore::*SymbolKernel)(PskDemodOutput& out);
+	template <size_t M>
+	SymbolKernel pickSymbolKernel() const;
+	SymbolKernel symbolKernel;
+	//Unpack and pack the bits of the sliced symbols into the output, looking each symbol's bits up in the symbol maps.
+	template <size_t BitsPerSymbol>
+	void writeBits(PskDemodOutput& out);
+	//Work out the LLRs of the bits of the phase corrected symbols.
+	template <size_t M>
+	void writeLlrs(const std::complex<float>* corrected, size_t numSymbols, PskDemodOutput& out);
+	//Forget the amplitude and noise estimates the LLRs are scaled by.
+	void resetLlrScale();
+	//Replace the Mth power phases of the symbols in angles with the phase estimates.
+	void fitPhase(size_t numSymbols);
+	void wrapPhase();
+
+	size_t samplesPerSymbol;
+	size_t numAvg;
+	size_t numSyms;
+	size_t bitsPerSymbol;
+	size_t phaseAvg;
+	bool differentialDecoding;
+	bool fastPhase;
+	bool grayCoding;
+	unsigned int outputs;
+	float sampleRate;
+	PskTimingMode timingMode;
+	double symbolRate;
+	double timingTimeConstant;
+	size_t filterSpan;
+	double filterRollOff;
+	MatchedFilter matchedFilter;
+
+	//The timing recovery window holds numAvg symbols of samplesPerSymbol samples each.
+	//It is a circular buffer of symbol rows - windowRow is the row currently being written,
+	//windowRows is the number of complete rows held in the window and index is the position in the current row.
+	//The leaky energy timing only keeps the current row and decays symbolEnergy by energyDecay each symbol instead.
+	//The window holds the complex 16 bit samples in windowSc16 instead while that is the input.
+	std::vector<std::complex<float> > window;
+	std::vector<std::complex<short> > windowSc16;
+	bool sc16Window;
+	std::vector<float> windowEnergy;
+	size_t windowRow;
+	size_t windowRows;
+	std::vector<double> symbolEnergy;
+	//Energy sums of the newest shadowRows rows.  These replace symbolEnergy once they cover the whole window
+	//to flush out the floating point error from adding and subtracting each sample's energy.
+	std::vector<double> shadowEnergy;
+	size_t shadowRows;
+	size_t index;
+	double energyDecay;
+	GardnerTiming gardner;
+	//Scratch space for complex 16 bit samples converted to float, which the matched filter output goes to as well,
+	//the energy of the current block and the symbols picked out of it.
+	std::vector<std::complex<float> > converted;
+	std::vector<float> energy;
+	std::vector<std::complex<float> > symbols;
+	//Scratch space for the phase passes.
+	std::vector<float> angles;
+	std::vector<float> unwrapped;
+	std::vector<float> fitted;
+	std::vector<std::complex<float> > phasors;
+	//The point number of each sliced symbol, counting counterclockwise from the point slicing puts at 0.
+	std::vector<unsigned char> symbolValues;
+	//Symbol maps from the point numbers to the bits: the first bit out in the least significant bit, the bits in
+	//packing order with the first bit out most significant, and one short per bit for the unpacked output so
+	//a symbol's bits are copied in one go.  pointPhasors holds the points themselves for the LLRs.
+	unsigned char pointBits[PSK_MAX_CONSTELLATION];
+	unsigned char pointPackedBits[PSK_MAX_CONSTELLATION];
+	short pointBitShorts[PSK_MAX_CONSTELLATION][PSK_MAX_BITS_PER_SYMBOL];
+	std::complex<float> pointPhasors[PSK_MAX_CONSTELLATION];
+	//Bits which did not fill an octet in the last block.
+	unsigned int partialOctet;
+	size_t partialOctetBits;
+	//Scratch space for the LLR metrics and the projection and energy of each symbol.
+	std::vector<float> llrMetrics;
+	std::vector<float> llrNearest;
+	std::vector<float> llrEnergy;
+	//Decaying sums of the symbols' projections onto the nearest points, their energies and the number of symbols,
+	//for the amplitude and noise estimates the LLRs are scaled by.
+	double llrNearestSum;
+	double llrEnergySum;
+	double llrCount;
+	std::complex<float> last;
+
+	PskDemodStats workStats;
+	//Clock reading when the symbol kernel finished the phase correction and started slicing.
+	unsigned long long slicingStart;
+
+	bool presenceGating;
+	PresenceDetector presence;
+	//Output of part of a burst, when it has to be added on to output from earlier in the block.
+	PskDemodOutput burstOut;
+	//The last presence block of the last call while no signal was present, for either sample type.
+	std::vector<std::complex<float> > gateTail;
+	std::vector<std::complex<short> > gateTailSc16;
+
+	//Set while differential decoding skips the phase tracking.
+	bool phaseStale;
+	PskCarrierMode carrierMode;
+	float phaseEstimate;
+	LinearFit phaseEstimator;
+	CarrierLoop carrierLoop;
+};
+
+#endif
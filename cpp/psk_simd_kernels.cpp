@@ -0,0 +1,828 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "psk_simd_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//The x86 kernels are compiled with function level target attributes so the rest of the
+//component does not need to be built for a particular instruction set.
+//This needs a compiler which allows intrinsics inside target attributed functions (gcc 4.9+).
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define PSK_SIMD_X86
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+namespace
+{
+	struct Kernels
+	{
+		const char* name;
+		bool (*supported)();
+		void (*energy)(const std::complex<float>*, float*, size_t);
+		void (*energySc16)(const std::complex<short>*, float, float*, size_t);
+		void (*convertSc16)(const std::complex<short>*, float, std::complex<float>*, size_t);
+		void (*accumulate)(double*, const float*, size_t);
+		void (*subtract)(double*, const float*, size_t);
+		void (*fastArg)(const std::complex<float>*, float*, size_t);
+		void (*fastPolar)(const float*, std::complex<float>*, size_t);
+		void (*maxLogLlrs)(const std::complex<float>*, size_t, size_t, float*, float*);
+		void (*quantize)(const float*, float, signed char*, size_t);
+	};
+
+	//Coefficients of the odd polynomial approximating atan(a) for 0<=a<=1 (Abramowitz & Stegun 4.4.48).
+	const float atanC1 = 0.9998660f;
+	const float atanC3 = -0.3302995f;
+	const float atanC5 = 0.1801410f;
+	const float atanC7 = -0.0851330f;
+	const float atanC9 = 0.0208351f;
+
+	//pi/2 split into three parts for the sin/cos argument reduction (Cody-Waite).
+	//The first two parts have few enough bits that multiplying them by the quadrant number is exact.
+	const float halfPi1 = 1.5703125f;
+	const float halfPi2 = 4.837512969970703125e-4f;
+	const float halfPi3 = 7.54978995489188216e-8f;
+	const float twoOverPi = 0.636619772367581343f;
+
+	//Minimax coefficients for sin and cos on -pi/4<=r<=pi/4 (from the Cephes sinf and cosf).
+	const float sinC3 = -1.6666654611e-1f;
+	const float sinC5 = 8.3321608736e-3f;
+	const float sinC7 = -1.9515295891e-4f;
+	const float cosC4 = 4.166664568298827e-2f;
+	const float cosC6 = -1.388731625493765e-3f;
+	const float cosC8 = 2.443315711809948e-5f;
+
+	//Projection onto the points at pi/4 off the axes.
+	const float halfSqrt2 = 0.707106781186547524f;
+	//The quantized LLRs are symmetric about 0.
+	const float quantizeLimit = 127.0f;
+
+	bool scalarSupported()
+	{
+		return true;
+	}
+
+	void energyScalar(const std::complex<float>* in, float* out, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+			out[i] = norm(in[i]);
+	}
+
+	//re*re+im*im can be up to 2^31, which only fits in an unsigned 32 bit integer.
+	void energySc16Scalar(const std::complex<short>* in, float scale, float* out, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+		{
+			const int re = in[i].real();
+			const int im = in[i].imag();
+			out[i] = float((unsigned int)(re*re)+(unsigned int)(im*im))*scale;
+		}
+	}
+
+	void convertSc16Scalar(const std::complex<short>* in, float scale, std::complex<float>* out, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+			out[i] = std::complex<float>(in[i].real()*scale, in[i].imag()*scale);
+	}
+
+	void accumulateScalar(double* acc, const float* in, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+			acc[i]+=in[i];
+	}
+
+	void subtractScalar(double* acc, const float* in, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+			acc[i]-=in[i];
+	}
+
+	//The SIMD fast phase kernels do exactly the same operations in the same order as these,
+	//with the selects done by masking.
+	void fastArgScalar(const std::complex<float>* in, float* out, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+		{
+			const float x = in[i].real();
+			const float y = in[i].imag();
+			const float ax = std::fabs(x);
+			const float ay = std::fabs(y);
+			const float maxAbs = std::max(ax, ay);
+			const float minAbs = std::min(ax, ay);
+			//Reduce to atan(a) with 0<=a<=1 - arg(0) is taken to be 0.
+			const float a = (maxAbs>0) ? minAbs/maxAbs : 0.0f;
+			const float a2 = a*a;
+			float theta = a*(atanC1+a2*(atanC3+a2*(atanC5+a2*(atanC7+a2*atanC9))));
+			//Then reflect the result back to the right octant.
+			theta = (ay>ax) ? float(M_PI_2)-theta : theta;
+			theta = (x<0) ? float(M_PI)-theta : theta;
+			out[i] = (y<0) ? -theta : theta;
+		}
+	}
+
+	void fastPolarScalar(const float* theta, std::complex<float>* out, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+		{
+			//Reduce theta to r in -pi/4<=r<=pi/4 and the quadrant q.
+			const float k = theta[i]*twoOverPi;
+			const int q = int(k+((k>=0) ? 0.5f : -0.5f));
+			const float qf = q;
+			const float r = ((theta[i]-qf*halfPi1)-qf*halfPi2)-qf*halfPi3;
+			const float r2 = r*r;
+			const float sinR = r+r*r2*(sinC3+r2*(sinC5+r2*sinC7));
+			const float cosR = (1.0f-0.5f*r2)+r2*r2*(cosC4+r2*(cosC6+r2*cosC8));
+			//Rotate by the quadrant: q=1 gives (-sin, cos), q=2 (-cos, -sin) and q=3 (sin, -cos).
+			const bool swap = q&1;
+			float c = swap ? sinR : cosR;
+			float s = swap ? cosR : sinR;
+			c = ((q+1)&2) ? -c : c;
+			s = (q&2) ? -s : s;
+			out[i] = std::complex<float>(c, s);
+		}
+	}
+
+	//max and min the way the SSE instructions do them, so all the kernels agree on the sign of zero.
+	inline float maxScalar(float a, float b)
+	{
+		return (a>b) ? a : b;
+	}
+
+	inline float minScalar(float a, float b)
+	{
+		return (a<b) ? a : b;
+	}
+
+	//The max-log metric for each bit is the largest projection of the symbol onto the points with the bit clear less the largest
+	//onto the points with the bit set.  The points for the symbol numbers, which the bits are taken from least significant first, are
+	//BPSK: 0 at 0 and 1 at pi, so the metric is 2re.
+	//QPSK: k at pi/4+k*pi/2.  With c0 and c1 the projections on the points at pi/4 and 3pi/4 (the others are their negatives)
+	//the metrics are |c0|-|c1| and c0+c1.
+	//8-PSK: k at k*pi/4.  With c1 and c3 the projections on the points at pi/4 and 3pi/4, re and im those on 0 and pi/2,
+	//the metrics are max(|re|,|im|)-max(|c1|,|c3|), max(|re|,|c1|)-max(|im|,|c3|) and max(re,c1,im,c3)+min(re,c1,im,c3).
+	//nearest is the projection onto the closest point.
+	void maxLogLlrs2Scalar(const std::complex<float>* in, float* llrs, float* nearest, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+		{
+			const float re = in[i].real();
+			llrs[i] = re+re;
+			nearest[i] = std::fabs(re);
+		}
+	}
+
+	void maxLogLlrs4Scalar(const std::complex<float>* in, float* llrs, float* nearest, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+		{
+			const float re = in[i].real();
+			const float im = in[i].imag();
+			const float c0 = (re+im)*halfSqrt2;
+			const float c1 = (im-re)*halfSqrt2;
+			const float a0 = std::fabs(c0);
+			const float a1 = std::fabs(c1);
+			llrs[2*i] = a0-a1;
+			llrs[2*i+1] = c0+c1;
+			nearest[i] = maxScalar(a0, a1);
+		}
+	}
+
+	void maxLogLlrs8Scalar(const std::complex<float>* in, float* llrs, float* nearest, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+		{
+			const float re = in[i].real();
+			const float im = in[i].imag();
+			const float c1 = (re+im)*halfSqrt2;
+			const float c3 = (im-re)*halfSqrt2;
+			const float ar = std::fabs(re);
+			const float ai = std::fabs(im);
+			const float a1 = std::fabs(c1);
+			const float a3 = std::fabs(c3);
+			llrs[3*i] = maxScalar(ar, ai)-maxScalar(a1, a3);
+			llrs[3*i+1] = maxScalar(ar, a1)-maxScalar(ai, a3);
+			llrs[3*i+2] = maxScalar(maxScalar(re, c1), maxScalar(im, c3))+minScalar(minScalar(re, c1), minScalar(im, c3));
+			nearest[i] = maxScalar(maxScalar(ar, ai), maxScalar(a1, a3));
+		}
+	}
+
+	void maxLogLlrsScalar(const std::complex<float>* in, size_t n, size_t constellationSize, float* llrs, float* nearest)
+	{
+		if (constellationSize==2)
+			maxLogLlrs2Scalar(in, llrs, nearest, n);
+		else if (constellationSize==4)
+			maxLogLlrs4Scalar(in, llrs, nearest, n);
+		else if (constellationSize==8)
+			maxLogLlrs8Scalar(in, llrs, nearest, n);
+	}
+
+	void quantizeScalar(const float* in, float scale, signed char* out, size_t n)
+	{
+		for (size_t i=0; i!=n; i++)
+		{
+			//Rounded to nearest even, as the SIMD conversions do in the default rounding mode.
+			const float value = maxScalar(minScalar(in[i]*scale, quantizeLimit), -quantizeLimit);
+			out[i] = (signed char)lrintf(value);
+		}
+	}
+
+#ifdef PSK_SIMD_X86
+	bool sse2Supported()
+	{
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			return false;
+		return (edx & (1<<26));
+	}
+
+	bool avx2Supported()
+	{
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			return false;
+		//The CPU must support AVX and the OS must save the ymm registers on a context switch.
+		const unsigned int osxsave = 1<<27;
+		const unsigned int avx = 1<<28;
+		if ((ecx & osxsave)==0 || (ecx & avx)==0)
+			return false;
+		unsigned int xcr0, xcr0High;
+		__asm__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+		if ((xcr0 & 6)!=6)
+			return false;
+		if (__get_cpuid_max(0, NULL) < 7)
+			return false;
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		return (ebx & (1<<5));
+	}
+
+	__attribute__((target("sse2")))
+	void energySse2(const std::complex<float>* in, float* out, size_t n)
+	{
+		const float* data = reinterpret_cast<const float*>(in);
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128 a = _mm_loadu_ps(data+2*i);
+			__m128 b = _mm_loadu_ps(data+2*i+4);
+			//Deinterleave into the real and imaginary parts of the four samples.
+			__m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+			__m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+			_mm_storeu_ps(out+i, _mm_add_ps(_mm_mul_ps(re,re), _mm_mul_ps(im,im)));
+		}
+		energyScalar(in+i, out+i, n-i);
+	}
+
+	__attribute__((target("sse2")))
+	void energySc16Sse2(const std::complex<short>* in, float scale, float* out, size_t n)
+	{
+		const __m128 factor = _mm_set1_ps(scale);
+		//madd wraps the one sum which does not fit a signed 32 bit integer, -32768^2*2, to -2^31.  Adding 2^32 puts it back.
+		const __m128 wrap = _mm_set1_ps(4294967296.0f);
+		const __m128i zero = _mm_setzero_si128();
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(in+i));
+			__m128i sum = _mm_madd_epi16(v, v);
+			__m128 wrapped = _mm_and_ps(_mm_castsi128_ps(_mm_cmplt_epi32(sum, zero)), wrap);
+			_mm_storeu_ps(out+i, _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(sum), wrapped), factor));
+		}
+		energySc16Scalar(in+i, scale, out+i, n-i);
+	}
+
+	__attribute__((target("sse2")))
+	void convertSc16Sse2(const std::complex<short>* in, float scale, std::complex<float>* out, size_t n)
+	{
+		const __m128 factor = _mm_set1_ps(scale);
+		float* data = reinterpret_cast<float*>(out);
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(in+i));
+			//Sign extend by putting each short in the top half of a 32 bit integer and shifting it down.
+			__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(data+2*i, _mm_mul_ps(_mm_cvtepi32_ps(low), factor));
+			_mm_storeu_ps(data+2*i+4, _mm_mul_ps(_mm_cvtepi32_ps(high), factor));
+		}
+		convertSc16Scalar(in+i, scale, out+i, n-i);
+	}
+
+	__attribute__((target("sse2")))
+	void accumulateSse2(double* acc, const float* in, size_t n)
+	{
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128 v = _mm_loadu_ps(in+i);
+			_mm_storeu_pd(acc+i, _mm_add_pd(_mm_loadu_pd(acc+i), _mm_cvtps_pd(v)));
+			_mm_storeu_pd(acc+i+2, _mm_add_pd(_mm_loadu_pd(acc+i+2), _mm_cvtps_pd(_mm_movehl_ps(v,v))));
+		}
+		accumulateScalar(acc+i, in+i, n-i);
+	}
+
+	__attribute__((target("sse2")))
+	void subtractSse2(double* acc, const float* in, size_t n)
+	{
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128 v = _mm_loadu_ps(in+i);
+			_mm_storeu_pd(acc+i, _mm_sub_pd(_mm_loadu_pd(acc+i), _mm_cvtps_pd(v)));
+			_mm_storeu_pd(acc+i+2, _mm_sub_pd(_mm_loadu_pd(acc+i+2), _mm_cvtps_pd(_mm_movehl_ps(v,v))));
+		}
+		subtractScalar(acc+i, in+i, n-i);
+	}
+
+	__attribute__((target("sse2")))
+	inline __m128 selectSse2(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	__attribute__((target("sse2")))
+	void fastArgSse2(const std::complex<float>* in, float* out, size_t n)
+	{
+		const float* data = reinterpret_cast<const float*>(in);
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		const __m128 zero = _mm_setzero_ps();
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128 a = _mm_loadu_ps(data+2*i);
+			__m128 b = _mm_loadu_ps(data+2*i+4);
+			__m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+			__m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+			__m128 ax = _mm_andnot_ps(signBit, x);
+			__m128 ay = _mm_andnot_ps(signBit, y);
+			__m128 maxAbs = _mm_max_ps(ax, ay);
+			__m128 ratio = _mm_and_ps(_mm_cmpgt_ps(maxAbs, zero), _mm_div_ps(_mm_min_ps(ax, ay), maxAbs));
+			__m128 ratio2 = _mm_mul_ps(ratio, ratio);
+			__m128 poly = _mm_add_ps(_mm_set1_ps(atanC7), _mm_mul_ps(ratio2, _mm_set1_ps(atanC9)));
+			poly = _mm_add_ps(_mm_set1_ps(atanC5), _mm_mul_ps(ratio2, poly));
+			poly = _mm_add_ps(_mm_set1_ps(atanC3), _mm_mul_ps(ratio2, poly));
+			poly = _mm_add_ps(_mm_set1_ps(atanC1), _mm_mul_ps(ratio2, poly));
+			__m128 theta = _mm_mul_ps(ratio, poly);
+			theta = selectSse2(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(float(M_PI_2)), theta), theta);
+			theta = selectSse2(_mm_cmplt_ps(x, zero), _mm_sub_ps(_mm_set1_ps(float(M_PI)), theta), theta);
+			theta = _mm_xor_ps(theta, _mm_and_ps(_mm_cmplt_ps(y, zero), signBit));
+			_mm_storeu_ps(out+i, theta);
+		}
+		fastArgScalar(in+i, out+i, n-i);
+	}
+
+	__attribute__((target("sse2")))
+	void fastPolarSse2(const float* theta, std::complex<float>* out, size_t n)
+	{
+		float* data = reinterpret_cast<float*>(out);
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		const __m128i one = _mm_set1_epi32(1);
+		const __m128i two = _mm_set1_epi32(2);
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128 t = _mm_loadu_ps(theta+i);
+			__m128 k = _mm_mul_ps(t, _mm_set1_ps(twoOverPi));
+			__m128 half = selectSse2(_mm_cmpge_ps(k, _mm_setzero_ps()), _mm_set1_ps(0.5f), _mm_set1_ps(-0.5f));
+			__m128i q = _mm_cvttps_epi32(_mm_add_ps(k, half));
+			__m128 qf = _mm_cvtepi32_ps(q);
+			__m128 r = _mm_sub_ps(t, _mm_mul_ps(qf, _mm_set1_ps(halfPi1)));
+			r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(halfPi2)));
+			r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(halfPi3)));
+			__m128 r2 = _mm_mul_ps(r, r);
+			__m128 sinPoly = _mm_add_ps(_mm_set1_ps(sinC5), _mm_mul_ps(r2, _mm_set1_ps(sinC7)));
+			sinPoly = _mm_add_ps(_mm_set1_ps(sinC3), _mm_mul_ps(r2, sinPoly));
+			__m128 sinR = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), sinPoly));
+			__m128 cosPoly = _mm_add_ps(_mm_set1_ps(cosC6), _mm_mul_ps(r2, _mm_set1_ps(cosC8)));
+			cosPoly = _mm_add_ps(_mm_set1_ps(cosC4), _mm_mul_ps(r2, cosPoly));
+			__m128 cosR = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), cosPoly));
+			__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+			__m128 negC = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_add_epi32(q, one), two), two));
+			__m128 negS = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, two), two));
+			__m128 c = _mm_xor_ps(selectSse2(swap, sinR, cosR), _mm_and_ps(negC, signBit));
+			__m128 s = _mm_xor_ps(selectSse2(swap, cosR, sinR), _mm_and_ps(negS, signBit));
+			_mm_storeu_ps(data+2*i, _mm_unpacklo_ps(c, s));
+			_mm_storeu_ps(data+2*i+4, _mm_unpackhi_ps(c, s));
+		}
+		fastPolarScalar(theta+i, out+i, n-i);
+	}
+
+	__attribute__((target("sse2")))
+	void maxLogLlrsSse2(const std::complex<float>* in, size_t n, size_t constellationSize, float* llrs, float* nearest)
+	{
+		if (constellationSize!=2 && constellationSize!=4 && constellationSize!=8)
+			return;
+		const float* data = reinterpret_cast<const float*>(in);
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		const __m128 half = _mm_set1_ps(halfSqrt2);
+		const size_t bits = (constellationSize==2) ? 1 : (constellationSize==4) ? 2 : 3;
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m128 a = _mm_loadu_ps(data+2*i);
+			__m128 b = _mm_loadu_ps(data+2*i+4);
+			__m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+			__m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+			if (constellationSize==2)
+			{
+				_mm_storeu_ps(llrs+i, _mm_add_ps(re, re));
+				_mm_storeu_ps(nearest+i, _mm_andnot_ps(signBit, re));
+			}
+			else if (constellationSize==4)
+			{
+				__m128 c0 = _mm_mul_ps(_mm_add_ps(re, im), half);
+				__m128 c1 = _mm_mul_ps(_mm_sub_ps(im, re), half);
+				__m128 a0 = _mm_andnot_ps(signBit, c0);
+				__m128 a1 = _mm_andnot_ps(signBit, c1);
+				__m128 bit0 = _mm_sub_ps(a0, a1);
+				__m128 bit1 = _mm_add_ps(c0, c1);
+				_mm_storeu_ps(llrs+2*i, _mm_unpacklo_ps(bit0, bit1));
+				_mm_storeu_ps(llrs+2*i+4, _mm_unpackhi_ps(bit0, bit1));
+				_mm_storeu_ps(nearest+i, _mm_max_ps(a0, a1));
+			}
+			else
+			{
+				__m128 c1 = _mm_mul_ps(_mm_add_ps(re, im), half);
+				__m128 c3 = _mm_mul_ps(_mm_sub_ps(im, re), half);
+				__m128 ar = _mm_andnot_ps(signBit, re);
+				__m128 ai = _mm_andnot_ps(signBit, im);
+				__m128 a1 = _mm_andnot_ps(signBit, c1);
+				__m128 a3 = _mm_andnot_ps(signBit, c3);
+				float metrics[3][4];
+				_mm_storeu_ps(metrics[0], _mm_sub_ps(_mm_max_ps(ar, ai), _mm_max_ps(a1, a3)));
+				_mm_storeu_ps(metrics[1], _mm_sub_ps(_mm_max_ps(ar, a1), _mm_max_ps(ai, a3)));
+				_mm_storeu_ps(metrics[2], _mm_add_ps(_mm_max_ps(_mm_max_ps(re, c1), _mm_max_ps(im, c3)), _mm_min_ps(_mm_min_ps(re, c1), _mm_min_ps(im, c3))));
+				_mm_storeu_ps(nearest+i, _mm_max_ps(_mm_max_ps(ar, ai), _mm_max_ps(a1, a3)));
+				//Three bits per symbol do not interleave neatly so they go out one at a time.
+				for (size_t j=0; j!=4; j++)
+				{
+					llrs[3*(i+j)] = metrics[0][j];
+					llrs[3*(i+j)+1] = metrics[1][j];
+					llrs[3*(i+j)+2] = metrics[2][j];
+				}
+			}
+		}
+		maxLogLlrsScalar(in+i, n-i, constellationSize, llrs+i*bits, nearest+i);
+	}
+
+	__attribute__((target("sse2")))
+	void quantizeSse2(const float* in, float scale, signed char* out, size_t n)
+	{
+		const __m128 factor = _mm_set1_ps(scale);
+		const __m128 upper = _mm_set1_ps(quantizeLimit);
+		const __m128 lower = _mm_set1_ps(-quantizeLimit);
+		size_t i=0;
+		for (; i+16<=n; i+=16)
+		{
+			__m128i q[4];
+			for (size_t j=0; j!=4; j++)
+				q[j] = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in+i+4*j), factor), upper), lower));
+			//The values are already in range so the saturating packs just narrow them.
+			_mm_storeu_si128((__m128i*)(out+i), _mm_packs_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+		}
+		quantizeScalar(in+i, scale, out+i, n-i);
+	}
+
+	//Note the AVX2 kernels deliberately avoid FMA so they give the same results as the scalar code.
+	//They also clear the upper halves of the ymm registers themselves before falling through to the
+	//scalar/SSE tail, since gcc does not always do so on a tail call and the SSE/AVX transition is very slow.
+	__attribute__((target("avx2")))
+	void energyAvx2(const std::complex<float>* in, float* out, size_t n)
+	{
+		const float* data = reinterpret_cast<const float*>(in);
+		size_t i=0;
+		for (; i+8<=n; i+=8)
+		{
+			__m256 a = _mm256_loadu_ps(data+2*i);
+			__m256 b = _mm256_loadu_ps(data+2*i+8);
+			//hadd works within 128 bit lanes, giving samples in the order 0 1 4 5 2 3 6 7.
+			__m256 sum = _mm256_hadd_ps(_mm256_mul_ps(a,a), _mm256_mul_ps(b,b));
+			sum = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum), _MM_SHUFFLE(3,1,2,0)));
+			_mm256_storeu_ps(out+i, sum);
+		}
+		_mm256_zeroupper();
+		energySse2(in+i, out+i, n-i);
+	}
+
+	__attribute__((target("avx2")))
+	void energySc16Avx2(const std::complex<short>* in, float scale, float* out, size_t n)
+	{
+		const __m256 factor = _mm256_set1_ps(scale);
+		const __m256 wrap = _mm256_set1_ps(4294967296.0f);
+		const __m256i zero = _mm256_setzero_si256();
+		size_t i=0;
+		for (; i+8<=n; i+=8)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)(in+i));
+			__m256i sum = _mm256_madd_epi16(v, v);
+			__m256 wrapped = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(zero, sum)), wrap);
+			_mm256_storeu_ps(out+i, _mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(sum), wrapped), factor));
+		}
+		_mm256_zeroupper();
+		energySc16Sse2(in+i, scale, out+i, n-i);
+	}
+
+	__attribute__((target("avx2")))
+	void convertSc16Avx2(const std::complex<short>* in, float scale, std::complex<float>* out, size_t n)
+	{
+		const __m256 factor = _mm256_set1_ps(scale);
+		float* data = reinterpret_cast<float*>(out);
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+		{
+			__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in+i)));
+			_mm256_storeu_ps(data+2*i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), factor));
+		}
+		_mm256_zeroupper();
+		convertSc16Scalar(in+i, scale, out+i, n-i);
+	}
+
+	__attribute__((target("avx2")))
+	void accumulateAvx2(double* acc, const float* in, size_t n)
+	{
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+			_mm256_storeu_pd(acc+i, _mm256_add_pd(_mm256_loadu_pd(acc+i), _mm256_cvtps_pd(_mm_loadu_ps(in+i))));
+		_mm256_zeroupper();
+		accumulateScalar(acc+i, in+i, n-i);
+	}
+
+	__attribute__((target("avx2")))
+	void subtractAvx2(double* acc, const float* in, size_t n)
+	{
+		size_t i=0;
+		for (; i+4<=n; i+=4)
+			_mm256_storeu_pd(acc+i, _mm256_sub_pd(_mm256_loadu_pd(acc+i), _mm256_cvtps_pd(_mm_loadu_ps(in+i))));
+		_mm256_zeroupper();
+		subtractScalar(acc+i, in+i, n-i);
+	}
+
+	__attribute__((target("avx2")))
+	void fastArgAvx2(const std::complex<float>* in, float* out, size_t n)
+	{
+		const float* data = reinterpret_cast<const float*>(in);
+		const __m256 signBit = _mm256_set1_ps(-0.0f);
+		const __m256 zero = _mm256_setzero_ps();
+		size_t i=0;
+		for (; i+8<=n; i+=8)
+		{
+			__m256 a = _mm256_loadu_ps(data+2*i);
+			__m256 b = _mm256_loadu_ps(data+2*i+8);
+			//The shuffles work within 128 bit lanes, giving samples in the order 0 1 4 5 2 3 6 7.
+			__m256 x = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+			__m256 y = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+			x = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(x), _MM_SHUFFLE(3,1,2,0)));
+			y = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(y), _MM_SHUFFLE(3,1,2,0)));
+			__m256 ax = _mm256_andnot_ps(signBit, x);
+			__m256 ay = _mm256_andnot_ps(signBit, y);
+			__m256 maxAbs = _mm256_max_ps(ax, ay);
+			__m256 ratio = _mm256_and_ps(_mm256_cmp_ps(maxAbs, zero, _CMP_GT_OQ), _mm256_div_ps(_mm256_min_ps(ax, ay), maxAbs));
+			__m256 ratio2 = _mm256_mul_ps(ratio, ratio);
+			__m256 poly = _mm256_add_ps(_mm256_set1_ps(atanC7), _mm256_mul_ps(ratio2, _mm256_set1_ps(atanC9)));
+			poly = _mm256_add_ps(_mm256_set1_ps(atanC5), _mm256_mul_ps(ratio2, poly));
+			poly = _mm256_add_ps(_mm256_set1_ps(atanC3), _mm256_mul_ps(ratio2, poly));
+			poly = _mm256_add_ps(_mm256_set1_ps(atanC1), _mm256_mul_ps(ratio2, poly));
+			__m256 theta = _mm256_mul_ps(ratio, poly);
+			theta = _mm256_blendv_ps(theta, _mm256_sub_ps(_mm256_set1_ps(float(M_PI_2)), theta), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+			theta = _mm256_blendv_ps(theta, _mm256_sub_ps(_mm256_set1_ps(float(M_PI)), theta), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+			theta = _mm256_xor_ps(theta, _mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_LT_OQ), signBit));
+			_mm256_storeu_ps(out+i, theta);
+		}
+		_mm256_zeroupper();
+		fastArgSse2(in+i, out+i, n-i);
+	}
+
+	__attribute__((target("avx2")))
+	void fastPolarAvx2(const float* theta, std::complex<float>* out, size_t n)
+	{
+		float* data = reinterpret_cast<float*>(out);
+		const __m256 signBit = _mm256_set1_ps(-0.0f);
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i two = _mm256_set1_epi32(2);
+		size_t i=0;
+		for (; i+8<=n; i+=8)
+		{
+			__m256 t = _mm256_loadu_ps(theta+i);
+			__m256 k = _mm256_mul_ps(t, _mm256_set1_ps(twoOverPi));
+			__m256 half = _mm256_blendv_ps(_mm256_set1_ps(-0.5f), _mm256_set1_ps(0.5f), _mm256_cmp_ps(k, _mm256_setzero_ps(), _CMP_GE_OQ));
+			__m256i q = _mm256_cvttps_epi32(_mm256_add_ps(k, half));
+			__m256 qf = _mm256_cvtepi32_ps(q);
+			__m256 r = _mm256_sub_ps(t, _mm256_mul_ps(qf, _mm256_set1_ps(halfPi1)));
+			r = _mm256_sub_ps(r, _mm256_mul_ps(qf, _mm256_set1_ps(halfPi2)));
+			r = _mm256_sub_ps(r, _mm256_mul_ps(qf, _mm256_set1_ps(halfPi3)));
+			__m256 r2 = _mm256_mul_ps(r, r);
+			__m256 sinPoly = _mm256_add_ps(_mm256_set1_ps(sinC5), _mm256_mul_ps(r2, _mm256_set1_ps(sinC7)));
+			sinPoly = _mm256_add_ps(_mm256_set1_ps(sinC3), _mm256_mul_ps(r2, sinPoly));
+			__m256 sinR = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), sinPoly));
+			__m256 cosPoly = _mm256_add_ps(_mm256_set1_ps(cosC6), _mm256_mul_ps(r2, _mm256_set1_ps(cosC8)));
+			cosPoly = _mm256_add_ps(_mm256_set1_ps(cosC4), _mm256_mul_ps(r2, cosPoly));
+			__m256 cosR = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)), _mm256_mul_ps(_mm256_mul_ps(r2, r2), cosPoly));
+			__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, one), one));
+			__m256 negC = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_add_epi32(q, one), two), two));
+			__m256 negS = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, two), two));
+			__m256 c = _mm256_xor_ps(_mm256_blendv_ps(cosR, sinR, swap), _mm256_and_ps(negC, signBit));
+			__m256 s = _mm256_xor_ps(_mm256_blendv_ps(sinR, cosR, swap), _mm256_and_ps(negS, signBit));
+			//The unpacks also work within 128 bit lanes so the halves are swapped back into order.
+			__m256 lo = _mm256_unpacklo_ps(c, s);
+			__m256 hi = _mm256_unpackhi_ps(c, s);
+			_mm256_storeu_ps(data+2*i, _mm256_permute2f128_ps(lo, hi, 0x20));
+			_mm256_storeu_ps(data+2*i+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+		}
+		_mm256_zeroupper();
+		fastPolarSse2(theta+i, out+i, n-i);
+	}
+	__attribute__((target("avx2")))
+	void maxLogLlrsAvx2(const std::complex<float>* in, size_t n, size_t constellationSize, float* llrs, float* nearest)
+	{
+		if (constellationSize!=2 && constellationSize!=4 && constellationSize!=8)
+			return;
+		const float* data = reinterpret_cast<const float*>(in);
+		const __m256 signBit = _mm256_set1_ps(-0.0f);
+		const __m256 half = _mm256_set1_ps(halfSqrt2);
+		const size_t bits = (constellationSize==2) ? 1 : (constellationSize==4) ? 2 : 3;
+		size_t i=0;
+		for (; i+8<=n; i+=8)
+		{
+			__m256 a = _mm256_loadu_ps(data+2*i);
+			__m256 b = _mm256_loadu_ps(data+2*i+8);
+			__m256 re = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+			__m256 im = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+			re = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(re), _MM_SHUFFLE(3,1,2,0)));
+			im = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(im), _MM_SHUFFLE(3,1,2,0)));
+			if (constellationSize==2)
+			{
+				_mm256_storeu_ps(llrs+i, _mm256_add_ps(re, re));
+				_mm256_storeu_ps(nearest+i, _mm256_andnot_ps(signBit, re));
+			}
+			else if (constellationSize==4)
+			{
+				__m256 c0 = _mm256_mul_ps(_mm256_add_ps(re, im), half);
+				__m256 c1 = _mm256_mul_ps(_mm256_sub_ps(im, re), half);
+				__m256 a0 = _mm256_andnot_ps(signBit, c0);
+				__m256 a1 = _mm256_andnot_ps(signBit, c1);
+				__m256 bit0 = _mm256_sub_ps(a0, a1);
+				__m256 bit1 = _mm256_add_ps(c0, c1);
+				__m256 lo = _mm256_unpacklo_ps(bit0, bit1);
+				__m256 hi = _mm256_unpackhi_ps(bit0, bit1);
+				_mm256_storeu_ps(llrs+2*i, _mm256_permute2f128_ps(lo, hi, 0x20));
+				_mm256_storeu_ps(llrs+2*i+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+				_mm256_storeu_ps(nearest+i, _mm256_max_ps(a0, a1));
+			}
+			else
+			{
+				__m256 c1 = _mm256_mul_ps(_mm256_add_ps(re, im), half);
+				__m256 c3 = _mm256_mul_ps(_mm256_sub_ps(im, re), half);
+				__m256 ar = _mm256_andnot_ps(signBit, re);
+				__m256 ai = _mm256_andnot_ps(signBit, im);
+				__m256 a1 = _mm256_andnot_ps(signBit, c1);
+				__m256 a3 = _mm256_andnot_ps(signBit, c3);
+				float metrics[3][8];
+				_mm256_storeu_ps(metrics[0], _mm256_sub_ps(_mm256_max_ps(ar, ai), _mm256_max_ps(a1, a3)));
+				_mm256_storeu_ps(metrics[1], _mm256_sub_ps(_mm256_max_ps(ar, a1), _mm256_max_ps(ai, a3)));
+				_mm256_storeu_ps(metrics[2], _mm256_add_ps(_mm256_max_ps(_mm256_max_ps(re, c1), _mm256_max_ps(im, c3)),
+						_mm256_min_ps(_mm256_min_ps(re, c1), _mm256_min_ps(im, c3))));
+				_mm256_storeu_ps(nearest+i, _mm256_max_ps(_mm256_max_ps(ar, ai), _mm256_max_ps(a1, a3)));
+				for (size_t j=0; j!=8; j++)
+				{
+					llrs[3*(i+j)] = metrics[0][j];
+					llrs[3*(i+j)+1] = metrics[1][j];
+					llrs[3*(i+j)+2] = metrics[2][j];
+				}
+			}
+		}
+		_mm256_zeroupper();
+		maxLogLlrsSse2(in+i, n-i, constellationSize, llrs+i*bits, nearest+i);
+	}
+
+	__attribute__((target("avx2")))
+	void quantizeAvx2(const float* in, float scale, signed char* out, size_t n)
+	{
+		const __m256 factor = _mm256_set1_ps(scale);
+		const __m256 upper = _mm256_set1_ps(quantizeLimit);
+		const __m256 lower = _mm256_set1_ps(-quantizeLimit);
+		size_t i=0;
+		for (; i+16<=n; i+=16)
+		{
+			__m256i a = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in+i), factor), upper), lower));
+			__m256i b = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in+i+8), factor), upper), lower));
+			//The pack works within 128 bit lanes, giving a0-3 b0-3 a4-7 b4-7, so the middle quarters are swapped back.
+			__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3,1,2,0));
+			_mm_storeu_si128((__m128i*)(out+i), _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+		}
+		_mm256_zeroupper();
+		quantizeSse2(in+i, scale, out+i, n-i);
+	}
+#endif
+
+	//In order of preference.
+	const Kernels kernelTable[] = {
+#ifdef PSK_SIMD_X86
+		{"avx2", avx2Supported, energyAvx2, energySc16Avx2, convertSc16Avx2, accumulateAvx2, subtractAvx2, fastArgAvx2, fastPolarAvx2, maxLogLlrsAvx2, quantizeAvx2},
+		{"sse2", sse2Supported, energySse2, energySc16Sse2, convertSc16Sse2, accumulateSse2, subtractSse2, fastArgSse2, fastPolarSse2, maxLogLlrsSse2, quantizeSse2},
+#endif
+		{"scalar", scalarSupported, energyScalar, energySc16Scalar, convertSc16Scalar, accumulateScalar, subtractScalar, fastArgScalar, fastPolarScalar, maxLogLlrsScalar, quantizeScalar}
+	};
+	const size_t numKernels = sizeof(kernelTable)/sizeof(Kernels);
+
+	const Kernels* bestKernels()
+	{
+		size_t i=0;
+		while (!kernelTable[i].supported())
+			i++;
+		return &kernelTable[i];
+	}
+
+	//Picked when the library is loaded rather than on first use so threads demodulating
+	//different streams never race to pick them.
+	const Kernels* selected = bestKernels();
+
+	const Kernels& kernels()
+	{
+		return *selected;
+	}
+}
+
+namespace psk_simd
+{
+	void energy(const std::complex<float>* in, float* out, size_t n)
+	{
+		kernels().energy(in, out, n);
+	}
+
+	void energySc16(const std::complex<short>* in, float scale, float* out, size_t n)
+	{
+		kernels().energySc16(in, scale, out, n);
+	}
+
+	void convertSc16(const std::complex<short>* in, float scale, std::complex<float>* out, size_t n)
+	{
+		kernels().convertSc16(in, scale, out, n);
+	}
+
+	void accumulate(double* acc, const float* in, size_t n)
+	{
+		kernels().accumulate(acc, in, n);
+	}
+
+	void subtract(double* acc, const float* in, size_t n)
+	{
+		kernels().subtract(acc, in, n);
+	}
+
+	void fastArg(const std::complex<float>* in, float* out, size_t n)
+	{
+		kernels().fastArg(in, out, n);
+	}
+
+	void fastPolar(const float* theta, std::complex<float>* out, size_t n)
+	{
+		kernels().fastPolar(theta, out, n);
+	}
+
+	void maxLogLlrs(const std::complex<float>* in, size_t n, size_t constellationSize, float* llrs, float* nearest)
+	{
+		kernels().maxLogLlrs(in, n, constellationSize, llrs, nearest);
+	}
+
+	void quantize(const float* in, float scale, signed char* out, size_t n)
+	{
+		kernels().quantize(in, scale, out, n);
+	}
+
+	const char* instructionSet()
+	{
+		return kernels().name;
+	}
+
+	bool setInstructionSet(const char* name)
+	{
+		for (size_t i=0; i!=numKernels; i++)
+		{
+			if (strcmp(kernelTable[i].name, name)==0 && kernelTable[i].supported())
+			{
+				selected = &kernelTable[i];
+				return true;
+			}
+		}
+		return false;
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+#ifndef PSK_SIMD_KERNELS_H
+#define PSK_SIMD_KERNELS_H
+
+#include <complex>
+#include <cstddef>
+
+/* Vectorized kernels for the demodulator inner loops.
+ * Every kernel has a scalar implementation and, when built for x86, SSE2 and AVX2 implementations.
+ * The best instruction set the CPU supports is picked when the program is loaded.
+ * All implementations produce bit identical results.
+ */
+namespace psk_simd
+{
+	//out[i] = norm(in[i])
+	void energy(const std::complex<float>* in, float* out, size_t n);
+	//out[i] = norm(in[i])*scale, with the sum of the squares worked out exactly in integers.
+	void energySc16(const std::complex<short>* in, float scale, float* out, size_t n);
+	//out[i] = in[i]*scale
+	void convertSc16(const std::complex<short>* in, float scale, std::complex<float>* out, size_t n);
+	//acc[i] += in[i]
+	void accumulate(double* acc, const float* in, size_t n);
+	//acc[i] -= in[i]
+	void subtract(double* acc, const float* in, size_t n);
+
+	//Polynomial approximations for the fast phase mode.
+	//out[i] ~= arg(in[i]) with a maximum error of 1.2e-5 radians (arg(0) is 0).
+	void fastArg(const std::complex<float>* in, float* out, size_t n);
+	//out[i] ~= polar(1, theta[i]) with a maximum error of 1e-7 in each component for |theta|<1e4.
+	void fastPolar(const float* theta, std::complex<float>* out, size_t n);
+
+	//Max-log LLR metrics for the phase corrected symbols of a 2, 4 or 8 point constellation, bitsPerSymbol per symbol in the order
+	//the bits come out.  Each is half the difference of the squared distances to the nearest points with the bit set and clear,
+	//for unit amplitude points, so it is positive for a 0 and scales to an LLR by 2A/N0 for points of amplitude A.
+	//nearest[i] is the projection of in[i] onto the nearest point's direction.
+	void maxLogLlrs(const std::complex<float>* in, size_t n, size_t constellationSize, float* llrs, float* nearest);
+	//out[i] = in[i]*scale rounded to the nearest integer and saturated to +/-127.
+	void quantize(const float* in, float scale, signed char* out, size_t n);
+
+	//Name of the instruction set in use - "avx2", "sse2" or "scalar".
+	const char* instructionSet();
+	//Force a particular instruction set (for benchmarking and testing).
+	//Returns false and leaves the current selection alone if the CPU does not support it.
+	bool setInstructionSet(const char* name);
+}
+
+#endif
@@ -27,179 +27,364 @@
 **************************************************************************/
 
 #include "psk_soft.h"
-#include "complex"
+
+#include <ossie/PropertyMap.h>
 #include <cmath>
+#include <pthread.h>
+#include <sched.h>
 
 PREPARE_LOGGING(psk_soft_i)
 
-LinearFit::LinearFit (size_t numPts, float sampleRate):
-	m(0.0),
-	b(0.0),
-	ySum(0.0),
-	xySum(0.0),
-	n(numPts),
-	xdelta(1.0/sampleRate),
-	denominator(1.0),
-	xAvg(0.0),
-	count(0)
+//How often the threads report their stats and performance_stats is updated.
+static const unsigned long long statsIntervalNs = 1000000000ULL;
+//How long serviceFunction waits for a packet on one input before checking the other.
+static const double inputWaitSeconds = 0.01;
+//The serviceFunction latency histogram has two buckets per power of two nanoseconds.
+static const size_t numLatencyBuckets = 128;
+
+static size_t latencyBucket(unsigned long long ns)
 {
+	size_t bucket=0;
+	while (ns>=4)
+	{
+		ns>>=1;
+		bucket+=2;
+	}
+	return (ns==3) ? bucket+1 : bucket;
 }
 
-float LinearFit::next(float yval)
+//The longest latency in a bucket.
+static unsigned long long latencyBucketEnd(size_t bucket)
 {
-	//Try to cope with systematic floating point math errors.
-	if (count==1048576)
-		reset();
-	//Are we currently in steady state?
-	bool steadyState =  yvals.size()==n;
-	if (steadyState)
-	{
-		//Update our state given our x-axis shift and our loss of the last point.
+	return ((bucket%2) ? 4ULL : 3ULL)<<(bucket/2);
+}
 
-		// Here is a bit of the magic for the xySum update equation:
-		// xySum = sum(xi*yi) = y0*0+y1*xdelta + y2*2*xdelta + ... yn-1*(n-1)*xdelta
-		// For the next value for xySum, we time shift our x-axis (to keep the earliest point at time 0).
-		// xySumNext = y1*0 + y2*xdelta + y3*2*xdelta + ... yn-1*(n-2)*xdelta + newYval*(n-1)*xdelta
-		// xySumNext - xySum = -xdelta*(y1+y2+...yn-1) + newYval*(n-1)*xdelta
-		// but ySumNext = ySum-y0 = y1+y2+...yn-1
-		// xySumNext - xySum = -xdelta*ySumNext + newYval*(n-1)*xdelta
-		// and the final update equation becomes xySum = -xdelta*newYSum+newYval*(n-1)*xdelta.
+PskSettings::PskSettings() :
+	samplesPerBaud(0),
+	numAvg(0),
+	timingMode(PSK_TIMING_MAX_ENERGY),
+	timingLoopBandwidth(0),
+	timingTimeConstant(0),
+	matchedFilterSpan(0),
+	matchedFilterRollOff(0),
+	constellationSize(0),
+	phaseAvg(0),
+	carrierMode(PSK_CARRIER_POWER_FIT),
+	carrierLoopBandwidth(0),
+	differentialDecoding(false),
+	fastPhase(false),
+	grayCoding(false),
+	presenceGating(false),
+	presenceThreshold(0),
+	presenceHold(0),
+	minOutputSymbols(0),
+	maxOutputSymbols(0),
+	maxOutputLatency(0),
+	outputs(PSK_ALL_OUTPUTS),
+	resets(0)
+{
+}
 
-		//We take care of the last term providing the new value update outside of the steady state check.
+PskStream::PskStream() :
+	sampleRate(1.0), //Put in an initial sample rate that will get updated later.
+	symbolRate(0),
+	configured(false),
+	worker(0),
+	pendingSymbols(0),
+	pendingOutputs(0),
+	pendingBitsPerBaud(0),
+	symbolPeriod(0),
+	octetBits(0),
+	signalPresent(true)
+{
+}
 
-		ySum-=yvals.front();
-		yvals.pop_front();
-		xySum-=xdelta*ySum;
-	}
-	//Update our state for our new point according to the update equations.
-	ySum+=yval;
-	//This is actually multiplying by yval*(n-1)*xdelta.
-	//because we haven't yet pushed_back the new value.  This is intentional.
-	xySum+=yval*yvals.size()*xdelta;
-	yvals.push_back(yval);
+PskThreadStats::PskThreadStats() :
+	pushNs(0),
+	lastReportNs(0)
+{
+}
 
-	if (! steadyState)
-		//If the size of our data vector has changed we need to recalculate the denominator.
-		calculateDenominator();
-	//Calculate the best fit given our state.
-	count++;
-	return calculateFit();
+void PskThreadStats::clear()
+{
+	demod.clear();
+	pushNs=0;
 }
 
-float LinearFit::reset(size_t* numPts, float* sampleRate, bool forceHistoryClear)
+PskResult::PskResult() :
+	packet(NULL),
+	shortPacket(NULL),
+	pushSri(false),
+	sriChunk(0),
+	samplesPerBaud(0),
+	bitsPerBaud(0),
+	presenceGating(false),
+	signalPresent(true)
 {
-	if (sampleRate!=NULL)
-	{
-		//Can't use history once we reset the sample rate.
-		float newXdelta = 1.0/(*sampleRate);
-		if (xdelta!=newXdelta)
-		{
-			xdelta = newXdelta;
-			forceHistoryClear=true;
-		}
-	}
-	if (forceHistoryClear)
-		yvals.clear();
+}
+
+PskWorker::PskWorker(psk_soft_i* parent, size_t queueDepth, CORBA::Long cpu) :
+	parent(parent),
+	jobs(queueDepth ? queueDepth : 1),
+	firstJob(0),
+	numJobs(0),
+	running(true),
+	thread(NULL)
+{
+	thread = new boost::thread(&PskWorker::run, this, cpu);
+}
 
-	if (numPts !=NULL && *numPts != n)
+PskWorker::~PskWorker()
+{
+	stop();
+}
+
+void PskWorker::post(const PskJob& job)
+{
+	boost::mutex::scoped_lock guard(lock);
+	while (numJobs==jobs.size())
+		jobsChanged.wait(guard);
+	jobs[(firstJob+numJobs)%jobs.size()] = job;
+	numJobs++;
+	jobsChanged.notify_all();
+}
+
+void PskWorker::stop()
+{
+	if (thread==NULL)
+		return;
 	{
-		n = *numPts;
-		while (yvals.size() >n)
-			yvals.pop_front();
+		boost::mutex::scoped_lock guard(lock);
+		running=false;
+		jobsChanged.notify_all();
 	}
-	//Now update our internal state given our history and sample rate.
-	unsigned int j=0;
-	ySum=0;
-	xySum=0;
-	//Recalculate yVal state directly from the yvals deque.
-	for (std::deque<float>::iterator i =yvals.begin(); i!=yvals.end(); i++, j++)
+	thread->join();
+	delete thread;
+	thread=NULL;
+}
+
+void PskWorker::run(CORBA::Long cpu)
+{
+	parent->pinThread(cpu);
+	while (true)
 	{
-		ySum+=*i;
-		xySum+=j*xdelta*(*i);
+		PskJob job;
+		{
+			boost::mutex::scoped_lock guard(lock);
+			while (numJobs==0 && running)
+				jobsChanged.wait(guard);
+			//Stop only once everything queued has been processed.
+			if (numJobs==0)
+				break;
+			job = jobs[firstJob];
+			firstJob = (firstJob+1)%jobs.size();
+			numJobs--;
+			jobsChanged.notify_all();
+		}
+		parent->demodPacket(job, result, stats);
+		parent->publishPacket(result, stats);
+		parent->reportStats(stats);
 	}
-	calculateDenominator();
-	count=0;
-    return calculateFit();
+	parent->reportStats(stats, true);
+}
 
+PskPipeline::Waiter::Waiter() :
+	idleLoops(0),
+	seenChanges(0)
+{
 }
 
-float LinearFit::subtractConst(float yval)
+PskPipeline::Stage::Stage(size_t queueDepth) :
+	jobs(queueDepth),
+	results(queueDepth),
+	thread(NULL)
 {
-	for (std::deque<float>::iterator i =yvals.begin(); i!=yvals.end(); i++)
+}
+
+PskPipeline::PskPipeline(psk_soft_i* parent, size_t numDemodThreads, size_t queueDepth, CORBA::Long publishCpu, const std::vector<CORBA::Long>& demodCpus) :
+	parent(parent),
+	publishThread(NULL),
+	changes(0),
+	sleepers(0)
+{
+	for (size_t i=0; i!=numDemodThreads; i++)
 	{
-		*i-=yval;
+		Stage* stage = new Stage(queueDepth);
+		stages.push_back(stage);
+		stage->thread = new boost::thread(&PskPipeline::runDemod, this, stage, i<demodCpus.size() ? demodCpus[i] : -1);
 	}
-	return reset();
+	publishThread = new boost::thread(&PskPipeline::runPublish, this, publishCpu);
 }
 
-float LinearFit::calculateFit()
+PskPipeline::~PskPipeline()
 {
-	// The General best fit for a linear fit (to minimize avg error) is as follows:
-
-	// y = mx+b
-	// numerator = sum(xi*yi) -1/n*sum(xi)*sum(yi);
-	// denominator = sum(xi^2) - 1/n(sum(x))^2
-	// m = numerator / denominator
-	// b = sum(y)/n - m sum(x) / n
-
-	// We simplify this equation for regularly sampled data: xi = i*xdelta
-	// (xvals = 0, xdelta, 2*xdelta, ... (n-1)*xdelta)
+	stop();
+}
 
-	// Thus - the numerator reduces to the following equation:
-	// numerator  = sum(xi*yi) -xdelta*(n-1)/2*sum(yi);
-	// The denominator simplifies to a constant for a given xdelta and n:
-	// denominator =xdelta^2*((n-1)^3/3 + (n-1)^2/2 +(n-1)/6 - 1/4*(n-1)^2*n))
+void PskPipeline::post(const PskJob& job, size_t demodThread)
+{
+	SpscQueue<PskJob>& jobs = stages[demodThread]->jobs;
+	PskJob* slot;
+	Waiter waiter;
+	while ((slot=jobs.back())==NULL)
+		waitForQueue(waiter);
+	*slot = job;
+	jobs.push();
+	queueChanged();
+}
 
-	size_t pts = yvals.size();
-	if (pts>1)
+void PskPipeline::stop()
+{
+	if (publishThread==NULL)
+		return;
+	//A job without a packet tells a demod thread to stop once it gets to it.
+	//The demod thread then passes it on to the publish thread the same way.
+	PskJob stopJob;
+	stopJob.packet = NULL;
+	stopJob.shortPacket = NULL;
+	stopJob.stream = NULL;
+	for (size_t i=0; i!=stages.size(); i++)
+		post(stopJob, i);
+	for (size_t i=0; i!=stages.size(); i++)
 	{
-		size_t pts_m_1 = pts-1;
-		m = (xySum-xdelta*pts_m_1/2*ySum)/denominator;
-		b = ySum/pts-m*xAvg;
+		stages[i]->thread->join();
+		delete stages[i]->thread;
+	}
+	publishThread->join();
+	delete publishThread;
+	publishThread=NULL;
+	for (size_t i=0; i!=stages.size(); i++)
+		delete stages[i];
+	stages.clear();
+}
 
-		//Calculate the best fit point for our new data point.
-		float xVal = xdelta*pts_m_1;
-		return m*xVal + b;
+void PskPipeline::runDemod(Stage* stage, CORBA::Long cpu)
+{
+	parent->pinThread(cpu);
+	Waiter waiter;
+	while (true)
+	{
+		PskJob* job = stage->jobs.front();
+		if (job==NULL)
+		{
+			waitForQueue(waiter);
+			continue;
+		}
+		PskResult* result;
+		while ((result=stage->results.back())==NULL)
+			waitForQueue(waiter);
+		waiter.idleLoops=0;
+		const bool stopping = job->packet==NULL && job->shortPacket==NULL;
+		if (stopping)
+		{
+			result->packet = NULL;
+			result->shortPacket = NULL;
+		}
+		else
+			parent->demodPacket(*job, *result, stage->stats);
+		stage->jobs.pop();
+		stage->results.push();
+		queueChanged();
+		if (stopping)
+			break;
+		parent->reportStats(stage->stats);
 	}
-	else
+	parent->reportStats(stage->stats, true);
+}
+
+void PskPipeline::runPublish(CORBA::Long cpu)
+{
+	parent->pinThread(cpu);
+	PskThreadStats stats;
+	size_t running = stages.size();
+	Waiter waiter;
+	while (running)
 	{
-		m=0;
-		if (pts==0)
-			b=0;
+		bool published=false;
+		for (size_t i=0; i!=stages.size(); i++)
+		{
+			PskResult* result = stages[i]->results.front();
+			if (result==NULL)
+				continue;
+			if (result->packet==NULL && result->shortPacket==NULL)
+				running--;
+			else
+				parent->publishPacket(*result, stats);
+			stages[i]->results.pop();
+			published=true;
+		}
+		if (published)
+		{
+			waiter.idleLoops=0;
+			queueChanged();
+			parent->reportStats(stats);
+		}
 		else
-			b=yvals.back();
-		return b;
+			waitForQueue(waiter);
 	}
+	parent->reportStats(stats, true);
+}
 
+//The thread gives up the CPU for a while first, as the queues seldom stay empty or full for long while data is flowing.
+//The count of changes is read before the queues are looked at again, so a change made since then is never missed.
+void PskPipeline::waitForQueue(Waiter& waiter)
+{
+	if (waiter.idleLoops<100)
+		boost::this_thread::yield();
+	else
+	{
+		boost::mutex::scoped_lock guard(sleepLock);
+		__sync_fetch_and_add(&sleepers, 1);
+		while (changes==waiter.seenChanges)
+			changed.wait(guard);
+		__sync_fetch_and_sub(&sleepers, 1);
+	}
+	waiter.idleLoops++;
+	waiter.seenChanges = changes;
+	__sync_synchronize();
 }
 
-void LinearFit::calculateDenominator()
+void PskPipeline::queueChanged()
 {
-	//Update the denominator for the current sample rate and number of points we are fitting.
-	size_t pts = yvals.size();
-	if (pts<=1)
-		return;
-	size_t pts_m_1 = pts -1;
-	denominator = pow(xdelta,2)*(pow(pts_m_1,3)/3.0+pow(pts_m_1,2)/2.0+(pts_m_1)/6.0- pow(pts_m_1,2)*pts/4.0);
-	xAvg = xdelta*(pts_m_1)/2;
+	//The count goes up before looking for sleepers, and a sleeper is counted before it looks at the count,
+	//so either it sees the change or it is woken.
+	__sync_fetch_and_add(&changes, 1);
+	if (sleepers)
+	{
+		boost::mutex::scoped_lock guard(sleepLock);
+		changed.notify_all();
+	}
 }
 
 psk_soft_i::psk_soft_i(const char *uuid, const char *label) :
     psk_soft_base(uuid, label),
-    symbolEnergy(samplesPerBaud,0.0),
-    index(0),
-    resetSamplesPerBaud(true),
-    resetNumSymbols(true),
-    resetPhaseAvg(true),
-    phaseEstimate(0.0),
-    sampleRate(1.0), //Put in an initial sample rate that will get updated later.
-    count(0),
-    phaseEstimator(phaseAvg,sampleRate)
+    timingModeSetting(PSK_TIMING_MAX_ENERGY),
+    carrierModeSetting(PSK_CARRIER_POWER_FIT),
+    lastInputShort(false),
+    pipeline(NULL),
+    nextWorker(0),
+    threadsStarted(false),
+    startedWorkerThreads(0),
+    startedPipeline(false),
+    startedQueueDepth(0),
+    servicePinned(false),
+    inputSamples(0),
+    resetCount(0),
+    queueFlushCount(0),
+    latencyHistogram(numLatencyBuckets),
+    latencyNs(0),
+    latencyCount(0),
+    lastInputSamples(0),
+    lastUpdateNs(pskClockNs())
 {
+	CPU_ZERO(&unpinnedCpus);
 }
 
 psk_soft_i::~psk_soft_i()
 {
+	stopThreads();
+	for (StreamMap::iterator i=streams.begin(); i!=streams.end(); i++)
+		delete i->second;
 }
 
 void psk_soft_i::constructor()
@@ -207,9 +392,46 @@ void psk_soft_i::constructor()
     /***********************************************************************************
      This is the RH constructor. All properties are properly initialized before this function is called
     ***********************************************************************************/
-    setPropertyChangeListener("samplesPerBaud", this, &psk_soft_i::samplesPerBaudChanged);
-    setPropertyChangeListener("constelationSize", this, &psk_soft_i::constelationSizeChanged);
-    setPropertyChangeListener("phaseAvg", this, &psk_soft_i::phaseAvgChanged);
+	setPropertyChangeListener("timingMode", this, &psk_soft_i::timingModeChanged);
+	timingModeChanged("timingMode");
+	setPropertyChangeListener("carrierMode", this, &psk_soft_i::carrierModeChanged);
+	carrierModeChanged("carrierMode");
+}
+
+void psk_soft_i::timingModeChanged(const std::string& id)
+{
+	//Look the mode up here so the service thread never reads the string while it is being configured.
+	if (timingMode=="gardner")
+		timingModeSetting = PSK_TIMING_GARDNER;
+	else if (timingMode=="leakyEnergy")
+		timingModeSetting = PSK_TIMING_LEAKY_ENERGY;
+	else
+	{
+		if (timingMode!="maxEnergy")
+			LOG_WARN(psk_soft_i, "timingMode " << timingMode << " not supported - using maxEnergy")
+		timingModeSetting = PSK_TIMING_MAX_ENERGY;
+	}
+}
+
+void psk_soft_i::carrierModeChanged(const std::string& id)
+{
+	if (carrierMode=="decisionDirected")
+		carrierModeSetting = PSK_CARRIER_LOOP;
+	else
+	{
+		if (carrierMode!="powerFit")
+			LOG_WARN(psk_soft_i, "carrierMode " << carrierMode << " not supported - using powerFit")
+		carrierModeSetting = PSK_CARRIER_POWER_FIT;
+	}
+}
+
+void psk_soft_i::stop() throw (CF::Resource::StopError, CORBA::SystemException)
+{
+	psk_soft_base::stop();
+	//The service thread has stopped so let the other threads finish what it handed them.
+	stopThreads();
+	//A new service thread starts out with the CPUs allowed from outside.
+	servicePinned = false;
 }
 
 /***********************************************************************************************
@@ -345,307 +567,710 @@ void psk_soft_i::constructor()
 ************************************************************************************************/
 int psk_soft_i::serviceFunction()
 {
-
-	bulkio::InFloatPort::dataTransfer *tmp = dataFloat_in->getPacket(bulkio::Const::BLOCKING);
-	if (not tmp) { // No data is available
-		return NOOP;
+	//Check the input which did not have the last packet first, then wait a little on the one which did,
+	//so a busy input cannot starve the other and an idle one only holds up the other for inputWaitSeconds.
+	bulkio::InFloatPort::dataTransfer* floatPacket = NULL;
+	bulkio::InShortPort::dataTransfer* shortPacket = NULL;
+	if (lastInputShort)
+	{
+		floatPacket = dataFloat_in->getPacket(bulkio::Const::NON_BLOCKING);
+		if (not floatPacket)
+			shortPacket = dataShort_in->getPacket(inputWaitSeconds);
+	}
+	else
+	{
+		shortPacket = dataShort_in->getPacket(bulkio::Const::NON_BLOCKING);
+		if (not shortPacket)
+			floatPacket = dataFloat_in->getPacket(inputWaitSeconds);
 	}
+	if (floatPacket)
+	{
+		lastInputShort = false;
+		queuePacket(floatPacket);
+	}
+	else if (shortPacket)
+	{
+		lastInputShort = true;
+		queuePacket(shortPacket);
+	}
+	//With no data go straight back to waiting rather than having the service thread sleep.
+	return NORMAL;
+}
+
+static void setPacket(PskJob& job, bulkio::InFloatPort::dataTransfer* tmp)
+{
+	job.packet = tmp;
+	job.shortPacket = NULL;
+}
+
+static void setPacket(PskJob& job, bulkio::InShortPort::dataTransfer* tmp)
+{
+	job.packet = NULL;
+	job.shortPacket = tmp;
+}
+
+template <typename Packet>
+void psk_soft_i::queuePacket(Packet* tmp)
+{
+	const unsigned long long start = pskClockNs();
     if (tmp->inputQueueFlushed)
     {
         LOG_WARN(psk_soft_i, "input queue flushed - data has been thrown on the floor.  flushing internal buffers");
         resetState = true;
+        queueFlushCount++;
     }
 
 	if (tmp->SRI.mode!=1)
 	{
 		LOG_WARN(psk_soft_i,"CANNOT work with real data")
-		return NORMAL;
+		delete tmp;
+		return;
 	}
+	inputSamples += tmp->dataBuffer.size()/2;
 
 	if (resetState)
 	{
 		LOG_DEBUG(psk_soft_i, "psk_soft_i reset state");
-		resetSamplesPerBaud=true;
-		resetNumSymbols=true;
-		resetPhaseAvg=true;
+		settings.resets++;
 		resetState = false;
+		resetCount++;
 	}
 
 	//Store local values in case user configures properties during the processing loop.
-
-	const size_t samplesPerSymbol = samplesPerBaud;
-	const size_t numDataPts = samplesPerSymbol*numAvg;
-	const size_t numSyms = constelationSize;
-	//This should only happen if numAvg or samplesPerBaud has shrunk.
-	if (numDataPts > samples.size())
+	settings.samplesPerBaud = samplesPerBaud;
+	settings.numAvg = numAvg;
+	settings.timingMode = timingModeSetting;
+	settings.timingLoopBandwidth = timingLoopBandwidth;
+	settings.timingTimeConstant = timingTimeConstant;
+	settings.matchedFilterSpan = matchedFilter ? matchedFilterSpan : 0;
+	settings.matchedFilterRollOff = matchedFilterRollOff;
+	settings.constellationSize = constelationSize;
+	settings.phaseAvg = phaseAvg;
+	settings.carrierMode = carrierModeSetting;
+	settings.carrierLoopBandwidth = carrierLoopBandwidth;
+	settings.differentialDecoding = differentialDecoding;
+	settings.fastPhase = fastPhase;
+	settings.grayCoding = grayCoding;
+	settings.presenceGating = presenceGating;
+	settings.presenceThreshold = presenceThreshold;
+	settings.presenceHold = presenceHold;
+	settings.minOutputSymbols = minOutputSymbols;
+	settings.maxOutputSymbols = maxOutputSymbols;
+	settings.maxOutputLatency = maxOutputLatency;
+	//Only compute and push the outputs somebody is listening to.
+	settings.outputs = 0;
+	if (softDecision_dataFloat_out->isActive())
+		settings.outputs |= PSK_SOFT_DECISIONS;
+	if (bits_dataShort_out->isActive())
+		settings.outputs |= PSK_BITS;
+	if (bits_dataOctet_out->isActive())
+		settings.outputs |= PSK_PACKED_BITS;
+	if (phase_dataFloat_out->isActive())
+		settings.outputs |= PSK_PHASE;
+	if (sampleIndex_dataShort_out->isActive())
+		settings.outputs |= PSK_SAMPLE_INDEX;
+	if (llr_dataFloat_out->isActive())
+		settings.outputs |= PSK_LLRS;
+	if (llr_dataChar_out->isActive())
+		settings.outputs |= PSK_QUANTIZED_LLRS;
+
+	if (!threadsStarted || startedWorkerThreads!=workerThreads || startedPipeline!=pipelineMode || startedQueueDepth!=queueDepth || startedAffinity!=threadAffinity)
+		startThreads();
+
+	PskJob job;
+	setPacket(job, tmp);
+	job.settings = settings;
+	takeDrainedStreams();
+	StreamMap::iterator i = streams.find(tmp->streamID);
+	if (i==streams.end())
 	{
-		resetSamplesPerBaud = true;
+		LOG_DEBUG(psk_soft_i, "new stream " << tmp->streamID);
+		job.stream = new PskStream();
+		const size_t numThreads = pipeline ? pipeline->demodThreads() : workers.size();
+		std::map<std::string, PskEndedStream>::const_iterator ended = endedStreams.find(tmp->streamID);
+		if (ended!=endedStreams.end())
+			job.stream->worker = ended->second.worker;
+		else if (numThreads)
+		{
+			job.stream->worker = nextWorker;
+			nextWorker = (nextWorker+1)%numThreads;
+		}
+		i = streams.insert(std::make_pair(tmp->streamID, job.stream)).first;
 	}
-	size_t bitsPerBaud=0;
-	if (numSyms==2)
-		bitsPerBaud=1;
-	else if (numSyms==4)
-		bitsPerBaud=2;
-	else if (numSyms==8)
-		bitsPerBaud=3;
-
-	// NOTE: You must make at least one valid pushSRI call prior to pushing data.
-	if (tmp->sriChanged || resetNumSymbols|| resetSamplesPerBaud) {
-		if (tmp->SRI.xdelta != sampleRate)
+	else
+		job.stream = i->second;
+	//The stream state now belongs to the packet and is deleted once it has been demodulated.
+	if (tmp->EOS)
+	{
+		std::map<std::string, PskEndedStream>::iterator ended = endedStreams.find(tmp->streamID);
+		if (ended==endedStreams.end())
 		{
-			sampleRate = 1.0/tmp->SRI.xdelta;
-			phaseEstimator.reset(NULL,&sampleRate);
+			PskEndedStream endedStream;
+			endedStream.eosPending = 0;
+			ended = endedStreams.insert(std::make_pair(tmp->streamID, endedStream)).first;
 		}
-		tmp->SRI.xdelta*=samplesPerSymbol;
-		softDecision_dataFloat_out->pushSRI(tmp->SRI);
-		tmp->SRI.mode=0;
-		phase_dataFloat_out->pushSRI(tmp->SRI);
-		tmp->SRI.xdelta/=bitsPerBaud;
-		bits_dataShort_out->pushSRI(tmp->SRI);
+		ended->second.worker = job.stream->worker;
+		ended->second.eosPending++;
+		streams.erase(i);
 	}
 
-	//User has changed the oversample factor - resize the symbolEnergy vector and re-populate it with the energy samples.
-	if (resetSamplesPerBaud)
+	if (pipeline)
+		pipeline->post(job, job.stream->worker);
+	else if (!workers.empty())
+		workers[job.stream->worker]->post(job);
+	else
 	{
-		resyncEnergy(samplesPerSymbol, numDataPts);
-		resetSamplesPerBaud=false;
+		demodPacket(job, result, serviceStats);
+		publishPacket(result, serviceStats);
 	}
 
-	//All the phase calculations are invalid if the constellation size changes.
-	//Clear the phaseSum and the phaseVec and start with new estimates.
-	if (resetNumSymbols)
+	const unsigned long long end = pskClockNs();
+	latencyHistogram[latencyBucket(end-start)]++;
+	latencyNs += end-start;
+	latencyCount++;
+	reportStats(serviceStats);
+	if (end-lastUpdateNs>=statsIntervalNs)
+		updatePerformanceStats(end);
+}
+
+//Advance a timestamp by a number of seconds.
+static void addTime(BULKIO::PrecisionUTCTime& T, double seconds)
+{
+	T.tfsec += seconds;
+	const double wholeSeconds = std::floor(T.tfsec);
+	T.twsec += wholeSeconds;
+	T.tfsec -= wholeSeconds;
+}
+
+//Move the first num entries of from into to, or as many as there are.
+template <typename T>
+static void moveFront(std::vector<T>& to, std::vector<T>& from, size_t num)
+{
+	num = std::min(num, from.size());
+	to.assign(from.begin(), from.begin()+num);
+	from.erase(from.begin(), from.begin()+num);
+}
+
+//Add a chunk for the next numSymbols symbols held back in the stream.
+static void cutChunk(PskStream& stream, PskResult& result, size_t numSymbols)
+{
+	PskChunk chunk;
+	chunk.T = stream.pendingTime;
+	chunk.outputs = stream.pendingOutputs;
+	chunk.symbols = numSymbols;
+	chunk.bits = numSymbols*stream.pendingBitsPerBaud;
+	chunk.octets = 0;
+	chunk.pushSri = false;
+	chunk.signalPresent = stream.signalPresent;
+	//Only whole octets go out, the rest of the bits are left for the next chunk.
+	if (chunk.outputs & PSK_PACKED_BITS)
 	{
-		phaseEstimator.reset(NULL,NULL,true);
-		resetNumSymbols=false;
+		chunk.octets = (stream.octetBits+chunk.bits)/8;
+		stream.octetBits = (stream.octetBits+chunk.bits)%8;
 	}
-	if (resetPhaseAvg)
+	else
+		stream.octetBits = 0;
+	result.chunks.push_back(chunk);
+	stream.pendingSymbols -= numSymbols;
+	addTime(stream.pendingTime, numSymbols*stream.symbolPeriod);
+}
+
+//Move the output for the chunks from the stream into the result.
+//On EOS the last chunk also takes the zero padded octet with the bits left over.
+static void takeChunks(PskStream& stream, PskResult& result, bool EOS)
+{
+	if (EOS && !result.chunks.empty())
+	{
+		size_t octets=0;
+		for (size_t i=0; i!=result.chunks.size(); i++)
+			octets += result.chunks[i].octets;
+		result.chunks.back().octets += stream.pending.packedBits.size()-octets;
+	}
+	size_t soft=0, bits=0, octets=0, phase=0, index=0, llrs=0, quantizedLlrs=0;
+	for (size_t i=0; i!=result.chunks.size(); i++)
 	{
-		size_t numPts(phaseAvg);
-		phaseEstimator.reset(&numPts);
-		resetPhaseAvg=false;
+		const PskChunk& chunk = result.chunks[i];
+		if (chunk.outputs & PSK_SOFT_DECISIONS)
+			soft += chunk.symbols;
+		if (chunk.outputs & PSK_BITS)
+			bits += chunk.bits;
+		if (chunk.outputs & PSK_PACKED_BITS)
+			octets += chunk.octets;
+		if (chunk.outputs & PSK_PHASE)
+			phase += chunk.symbols;
+		if (chunk.outputs & PSK_SAMPLE_INDEX)
+			index += chunk.symbols;
+		if (chunk.outputs & PSK_LLRS)
+			llrs += chunk.bits;
+		if (chunk.outputs & PSK_QUANTIZED_LLRS)
+			quantizedLlrs += chunk.bits;
 	}
+	PskDemodOutput& out = result.out;
+	moveFront(out.softDecisions, stream.pending.softDecisions, soft);
+	moveFront(out.bits, stream.pending.bits, bits);
+	moveFront(out.packedBits, stream.pending.packedBits, octets);
+	moveFront(out.phase, stream.pending.phase, phase);
+	moveFront(out.sampleIndex, stream.pending.sampleIndex, index);
+	moveFront(out.llrs, stream.pending.llrs, llrs);
+	moveFront(out.quantizedLlrs, stream.pending.quantizedLlrs, quantizedLlrs);
+}
+
+//Pointer to the entries of data from pos on, for pushing part of it.
+template <typename T>
+static T* packetData(std::vector<T>& data, size_t pos)
+{
+	return data.empty() ? NULL : &data[0]+std::min(pos, data.size());
+}
 
+//How many of the num entries of data from pos on there really are, so a short output is never read past its end.
+template <typename T>
+static size_t packetSize(const std::vector<T>& data, size_t pos, size_t num)
+{
+	return (pos<data.size()) ? std::min(num, data.size()-pos) : 0;
+}
+
+//Demodulate the complex samples in a packet from either input.
+static void demodData(PskDemodCore& demod, bulkio::InFloatPort::dataTransfer* tmp, PskDemodOutput& out)
+{
 	std::vector<std::complex<float> >* dataVec = (std::vector<std::complex<float> >*) &(tmp->dataBuffer);
+	demod.process(dataVec->empty() ? NULL : &dataVec->front(), dataVec->size(), out);
+}
+
+static void demodData(PskDemodCore& demod, bulkio::InShortPort::dataTransfer* tmp, PskDemodOutput& out)
+{
+	std::vector<std::complex<short> >* dataVec = (std::vector<std::complex<short> >*) &(tmp->dataBuffer);
+	demod.process(dataVec->empty() ? NULL : &dataVec->front(), dataVec->size(), out);
+}
 
-	std::vector<std::complex<float> > out;
-	std::vector<short> bits;
-	std::vector<float> phase_vec;
-	//Reserve data for the output.
-	out.reserve((dataVec->size()+index)/samplesPerSymbol);
-	phase_vec.reserve(out.size());
-	bits.reserve(out.size()*bitsPerBaud);
-    std::vector<short> sampleIndexOut;
-    sampleIndexOut.reserve(out.size());
-
-	std::complex<float> sample;
-	const size_t lastSample = samplesPerSymbol-1;
-	for (std::vector<std::complex<float> >::iterator i=dataVec->begin(); i!=dataVec->end(); i++)
-	{
-		//Push back the sample and its energy.
-		if (samplesPerSymbol >1)
+void psk_soft_i::demodPacket(const PskJob& job, PskResult& result, PskThreadStats& stats)
+{
+	if (job.shortPacket)
+		demodPacket(job, job.shortPacket, result, stats);
+	else
+		demodPacket(job, job.packet, result, stats);
+}
+
+template <typename Packet>
+void psk_soft_i::demodPacket(const PskJob& job, Packet* tmp, PskResult& result, PskThreadStats& stats)
+{
+	const PskSettings& settings = job.settings;
+	PskStream& stream = *job.stream;
+	PskDemodCore& demod = stream.demod;
+	PskDemodOutput& demodOut = result.out;
+
+	//A new stream or a reset configures everything from scratch.
+	const bool resetAll = !stream.configured || stream.applied.resets!=settings.resets;
+	const bool resetSamplesPerBaud = resetAll || stream.applied.samplesPerBaud!=settings.samplesPerBaud || stream.applied.timingMode!=settings.timingMode;
+	const bool resetNumSymbols = resetAll || stream.applied.constellationSize!=settings.constellationSize;
+	const bool resetPhaseAvg = resetAll || stream.applied.phaseAvg!=settings.phaseAvg;
+	const size_t numSyms = settings.constellationSize;
+
+	//User has changed the oversample factor - the demod resizes and re-populates its timing recovery state.
+	demod.setTimingMode(settings.timingMode);
+	if (resetSamplesPerBaud)
+		demod.setSamplesPerBaud(settings.samplesPerBaud);
+	demod.setTimingLoopBandwidth(settings.timingLoopBandwidth);
+	demod.setTimingTimeConstant(settings.timingTimeConstant);
+	demod.setMatchedFilter(settings.matchedFilterSpan, settings.matchedFilterRollOff);
+	//This only does any work if numAvg has changed.
+	demod.setNumAvg(settings.numAvg);
+	//All the phase calculations are invalid if the constellation size changes.
+	if (resetNumSymbols)
+		demod.setConstellationSize(numSyms);
+	const size_t bitsPerBaud=demod.bitsPerBaud();
+
+	// NOTE: You must make at least one valid pushSRI call prior to pushing data.
+	//Turning the presence gating on or off adds or drops the SIGNAL_PRESENT keyword.
+	result.pushSri = tmp->sriChanged || resetNumSymbols|| resetSamplesPerBaud || resetAll || stream.applied.presenceGating!=settings.presenceGating;
+	if (result.pushSri) {
+		if (1.0/tmp->SRI.xdelta != stream.sampleRate)
+		{
+			stream.sampleRate = 1.0/tmp->SRI.xdelta;
+			demod.setSampleRate(stream.sampleRate);
+		}
+		//The Gardner timing can take a fractional number of samples per symbol from the symbol rate.
+		const redhawk::PropertyMap& keywords = redhawk::PropertyMap::cast(tmp->SRI.keywords);
+		const double symbolRate = keywords.contains("SYMBOL_RATE") ? keywords["SYMBOL_RATE"].toDouble() : 0.0;
+		if (symbolRate != stream.symbolRate)
+		{
+			stream.symbolRate = symbolRate;
+			demod.setSymbolRate(symbolRate);
+		}
+		if (bitsPerBaud==0)
+			LOG_WARN(psk_soft_i,"numSyms " <<numSyms << " not supported - no bits out")
+	}
+
+	if (resetPhaseAvg)
+		demod.setPhaseAvg(settings.phaseAvg);
+	demod.setCarrierMode(settings.carrierMode);
+	demod.setCarrierLoopBandwidth(settings.carrierLoopBandwidth);
+	demod.setDifferentialDecoding(settings.differentialDecoding);
+	demod.setFastPhase(settings.fastPhase);
+	demod.setGrayCoding(settings.grayCoding);
+	demod.setPresenceThreshold(settings.presenceThreshold);
+	demod.setPresenceHold(settings.presenceHold);
+	demod.setPresenceGating(settings.presenceGating);
+	demod.setOutputs(settings.outputs);
+	stream.applied = settings;
+	stream.configured = true;
+
+	result.packet = job.packet;
+	result.shortPacket = job.shortPacket;
+	const double samplesPerSymbol = demod.samplesPerOutputSymbol();
+	result.samplesPerBaud = samplesPerSymbol;
+	result.bitsPerBaud = bitsPerBaud;
+	result.presenceGating = settings.presenceGating;
+	result.chunks.clear();
+
+	//Anything held back was demodulated for the old SRI or outputs so it goes out first.
+	if (stream.pendingSymbols && (result.pushSri || stream.pendingOutputs!=settings.outputs))
+		cutChunk(stream, result, stream.pendingSymbols);
+	result.sriChunk = result.chunks.size();
+
+	demodData(demod, tmp, demodOut);
+	if (tmp->EOS)
+		demod.flushPackedBits(demodOut);
+	stats.demod += demod.stats();
+	demod.clearStats();
+
+	const size_t maxSymbols = settings.maxOutputSymbols;
+	size_t minSymbols = std::max(settings.minOutputSymbols, size_t(1));
+	if (maxSymbols)
+		minSymbols = std::min(minSymbols, maxSymbols);
+	const std::vector<PskPresenceChange>& changes = demodOut.presenceChanges;
+	if (result.chunks.empty() && stream.pendingSymbols==0 && minSymbols==1 && maxSymbols==0 && changes.empty())
+	{
+		//Nothing is held back or split so the packet goes out as it is.
+		if (demodOut.numSymbols || tmp->EOS)
+		{
+			PskChunk chunk;
+			chunk.T = tmp->T;
+			chunk.outputs = settings.outputs;
+			chunk.symbols = demodOut.numSymbols;
+			chunk.bits = demodOut.numSymbols*bitsPerBaud;
+			chunk.octets = demodOut.packedBits.size();
+			chunk.pushSri = false;
+			chunk.signalPresent = stream.signalPresent;
+			stream.octetBits = (settings.outputs & PSK_PACKED_BITS) ? (stream.octetBits+chunk.bits)%8 : 0;
+			result.chunks.push_back(chunk);
+		}
+	}
+	else
+	{
+		//Add the packet to the output held back and cut that into chunks which fit the limits.
+		if (stream.pendingSymbols==0)
 		{
-			samples.push_back(*i);
-			double sampleEnergy = norm(*i);
-			energy.push_back(sampleEnergy);
-			//Add energy to the symbolEnergy vector.
-			symbolEnergy[index]+=sampleEnergy;
+			stream.pendingTime = tmp->T;
+			stream.pendingOutputs = settings.outputs;
+			stream.pendingBitsPerBaud = bitsPerBaud;
+			stream.symbolPeriod = tmp->SRI.xdelta*samplesPerSymbol;
 		}
-		//When the end of the next symbol is reached...
-		if (index== lastSample)
+		stream.pending.append(demodOut);
+		stream.pendingSymbols += demodOut.numSymbols;
+
+		//Each burst starting or ending cuts the output there and gets an SRI of its own.
+		for (size_t c=0; c!=changes.size(); c++)
 		{
-			//If there are enough samples to get meaningful averages, start outputting data.
-			if (samples.size()==numDataPts)
+			const PskPresenceChange& change = changes[c];
+			//Symbols after the change, which are left for later chunks.
+			const size_t later = demodOut.numSymbols-change.symbol;
+			if (maxSymbols)
+			{
+				while (stream.pendingSymbols-later>=maxSymbols)
+					cutChunk(stream, result, maxSymbols);
+			}
+			//The bits at the end of a burst were padded out to an octet.
+			const bool padded = !change.present && stream.octetBits;
+			if (stream.pendingSymbols>later || padded)
+				cutChunk(stream, result, stream.pendingSymbols-later);
+			if (padded)
 			{
-				if (samplesPerSymbol>1)
-				{
-					//Get the index from the end for the max symbolEnergy.
-					size_t sampleIndex = std::distance(symbolEnergy.begin(), std::max_element(symbolEnergy.begin(),symbolEnergy.end()));
-
-					//This is the sample that is output.
-					sample= *(samples.begin()+sampleIndex);
-					sampleIndexOut.push_back(sampleIndex);
-				}
-				else
-					sample = *i;
-
-				//Algorithm to compensate for phase offset.
-				//Note this isn't needed for differential decoding,
-				//but since phase is a debug float out, we do the calculations regardless.
-				double thisPhase = arg(pow(sample,numSyms));
-
-				//Do phase unwrapping here with previous phase estimates.
-				long numWraps = round((phaseEstimate-thisPhase)/M_2PI);
-				thisPhase += +numWraps*M_2PI;
-
-				//Compute the average phase.
-				phaseEstimate = phaseEstimator.next(thisPhase);
-				phase_vec.push_back(phaseEstimate);
-
-				float phaseCorrection=0;
-
-				if (differentialDecoding)
-				{
-					std::complex<float> decoded = sample/last;
-					last = sample;
-					sample = decoded;
-				}
-				else
-				{
-					phaseCorrection = -phaseEstimate/numSyms;
-				}
-				//Compute the phase offset - add PI/4 so that samples are at (+/- 1, +/-j) instead of 0,1,-1,,-j.
-				if (numSyms==4)
-					phaseCorrection+=M_PI_4;
-				std::complex<float> phaseCorrectionPhasor= std::polar(float(1.0),phaseCorrection);
-				std::complex<float> corrected(sample*phaseCorrectionPhasor);
-				out.push_back(corrected);
-				//do conversion to bits
-				if (bitsPerBaud==1)
-				{
-					//
-					//                  |             // A -> 0
-					//                  |             // B -> 1
-					//             B---------A
-					//                  |
-					//                  |
-
-					bits.push_back((out.back().real()<0));
-				}
-				else if (bitsPerBaud==2)
-				{
-					//
-					//             B    |    A         // A -> 00 (0)
-					//                  |              // B -> 01 (1)
-					//              ---------          // C -> 10 (2)
-					//                  |              // D -> 11 (3)
-					//             C    |    D
-
-					bool real = out.back().real();
-					bool imag = out.back().imag();
-					bits.push_back(real ^ imag);
-					bits.push_back(not imag);
-				}
-				else if (bitsPerBaud==3)
-				{
-
-					//                  C
-					//             D    |    B         // A -> 000 (0)   E -> 100 (4)
-					//                  |              // B -> 001 (1)   F -> 101 (5)
-					//            E  --------- A       // C -> 010 (2)   G -> 110 (6)
-					//                  |              // D -> 011 (3)   H -> 111 (7)
-					//             F    |    H
-                    //                  G
-
-					//Time to map the 8 psk constellation into bits.
-
-					//There are clusters around theta 0, pi/4, pi/2, 3pi/4, pi, 5pi/4, 3pi/2, 7pi/8
-					//however, arg returns a number between -pi and pi.  Phases near -pi and near pi map to the same cluster.
-
-					//This is what provides some rudimentary mapping.
-
-					//Get the phase -pi<theta<pi.
-					float theta = arg(out.back());
-					//Convert the phase to soft symbols -4 <=softsym < 4.
-					float softsym = theta/M_PI*4;
-					//Now wrap the negative numbers over to positive numbers -.5<=softsym<7.5.
-					if (softsym <-.5)
-						softsym +=8;
-					//Now round to the closest integer.
-					//This gives symbols between 0 <=sym<= 7.
-					unsigned short sym = round(softsym);
-					//Now unpack the bits.
-					//The trick is that both 0 and 8 have the same values for 3 least significant bits (0,0,0),
-					//so they will produce the same bits.
-					for (size_t j=0; j!=3; j++)
-					{
-						bits.push_back(sym&1);
-						sym=sym>>1;
-					}
-				}
-				else
-					LOG_WARN(psk_soft_i,"numSyms " <<numSyms << " not supported - no bits out")
-
-				if (samplesPerSymbol>1)
-				{
-
-					//Subtract the energy for this symbol from the symbolEnergy vector.
-					std::vector<double>::iterator symIter = symbolEnergy.begin();
-					std::deque<double>::iterator energyIterEnd = energy.begin()+samplesPerSymbol;
-					for (std::deque<double>::iterator energyIter = energy.begin(); energyIter !=energyIterEnd;energyIter++, symIter++)
-					{
-						*symIter-=*energyIter;
-					}
-					//Remove all samples from this symbol from the samples & energy containers.
-					energy.erase(energy.begin(), energyIterEnd);
-					samples.erase(samples.begin(), samples.begin()+samplesPerSymbol);
-					count++;
-					if (count==1048576)
-						resyncEnergy(samplesPerSymbol, numDataPts);
-				}
+				result.chunks.back().octets++;
+				stream.octetBits = 0;
 			}
-			//Reset the symbolIndex back to 0
-			index=0;
+			stream.signalPresent = change.present;
+			if (change.present)
+			{
+				stream.pendingTime = tmp->T;
+				addTime(stream.pendingTime, change.sample*tmp->SRI.xdelta);
+			}
+			cutChunk(stream, result, 0);
+			result.chunks.back().pushSri = true;
+		}
+
+		if (maxSymbols)
+		{
+			while (stream.pendingSymbols>=maxSymbols)
+				cutChunk(stream, result, maxSymbols);
+		}
+		const bool overdue = settings.maxOutputLatency>0 && stream.pendingSymbols*stream.symbolPeriod>=settings.maxOutputLatency;
+		if (stream.pendingSymbols && (stream.pendingSymbols>=minSymbols || overdue || tmp->EOS))
+			cutChunk(stream, result, stream.pendingSymbols);
+		if (tmp->EOS && result.chunks.empty())
+			cutChunk(stream, result, 0);
+		takeChunks(stream, result, tmp->EOS);
+	}
+	result.signalPresent = stream.signalPresent;
+	if (tmp->EOS)
+		delete job.stream;
+}
+
+void psk_soft_i::publishPacket(PskResult& result, PskThreadStats& stats)
+{
+	if (result.shortPacket)
+		publishPacket(result, result.shortPacket, stats);
+	else
+		publishPacket(result, result.packet, stats);
+}
+
+template <typename Packet>
+void psk_soft_i::publishPacket(PskResult& result, Packet* tmp, PskThreadStats& stats)
+{
+	const unsigned long long start = pskClockNs();
+	PskDemodOutput& demodOut = result.out;
+
+	size_t softPos=0, bitsPos=0, octetPos=0, phasePos=0, indexPos=0, llrPos=0, quantizedLlrPos=0;
+	for (size_t i=0; i<=result.chunks.size(); i++)
+	{
+		if (i==result.chunks.size())
+		{
+			if (result.pushSri && i==result.sriChunk)
+				pushOutputSri(tmp->SRI, result, result.signalPresent);
+			break;
+		}
+		if ((result.pushSri && i==result.sriChunk) || result.chunks[i].pushSri)
+			pushOutputSri(tmp->SRI, result, result.chunks[i].signalPresent);
+
+		//Always push on EOS so it is passed downstream even if there is no data left to go with it.
+		const PskChunk& chunk = result.chunks[i];
+		const bool EOS = tmp->EOS && i+1==result.chunks.size();
+		const unsigned int outputs = chunk.outputs;
+		if ((outputs & PSK_SOFT_DECISIONS) && (chunk.symbols || EOS))
+		{
+			softDecision_dataFloat_out->pushPacket((float*)packetData(demodOut.softDecisions, softPos), 2*packetSize(demodOut.softDecisions, softPos, chunk.symbols), chunk.T, EOS, tmp->streamID);
+			softPos+=chunk.symbols;
+		}
+		if ((outputs & PSK_BITS) && (chunk.bits || EOS))
+		{
+			bits_dataShort_out->pushPacket(packetData(demodOut.bits, bitsPos), packetSize(demodOut.bits, bitsPos, chunk.bits), chunk.T, EOS, tmp->streamID);
+			bitsPos+=chunk.bits;
+		}
+		if ((outputs & PSK_PACKED_BITS) && (chunk.octets || EOS))
+		{
+			bits_dataOctet_out->pushPacket(packetData(demodOut.packedBits, octetPos), packetSize(demodOut.packedBits, octetPos, chunk.octets), chunk.T, EOS, tmp->streamID);
+			octetPos+=chunk.octets;
+		}
+		if ((outputs & PSK_PHASE) && (chunk.symbols || EOS))
+		{
+			phase_dataFloat_out->pushPacket(packetData(demodOut.phase, phasePos), packetSize(demodOut.phase, phasePos, chunk.symbols), chunk.T, EOS, tmp->streamID);
+			phasePos+=chunk.symbols;
+		}
+		if ((outputs & PSK_SAMPLE_INDEX) && (chunk.symbols || EOS))
+		{
+			sampleIndex_dataShort_out->pushPacket(packetData(demodOut.sampleIndex, indexPos), packetSize(demodOut.sampleIndex, indexPos, chunk.symbols), chunk.T, EOS, tmp->streamID);
+			indexPos+=chunk.symbols;
+		}
+		if ((outputs & PSK_LLRS) && (chunk.bits || EOS))
+		{
+			llr_dataFloat_out->pushPacket(packetData(demodOut.llrs, llrPos), packetSize(demodOut.llrs, llrPos, chunk.bits), chunk.T, EOS, tmp->streamID);
+			llrPos+=chunk.bits;
+		}
+		if ((outputs & PSK_QUANTIZED_LLRS) && (chunk.bits || EOS))
+		{
+			llr_dataChar_out->pushPacket((char*)packetData(demodOut.quantizedLlrs, quantizedLlrPos), packetSize(demodOut.quantizedLlrs, quantizedLlrPos, chunk.bits), chunk.T, EOS, tmp->streamID);
+			quantizedLlrPos+=chunk.bits;
 		}
-		else
-			index++;
 	}
-	//Wrap phase estimate back to a reasonable value to keep it from going to infinity.
-	//Wrap about numSyms*2pi and NOT 2PI or phase offsets are introduced,
-	//since phaseEstimate is the estimate of the numSyms power of the phase.
-	float wrapValue = M_2PI*numSyms;
-	if (abs(phaseEstimate)> wrapValue)
+	if (tmp->EOS)
 	{
-		long numWraps = round(phaseEstimate/wrapValue);
-		//Subtract the phaseOffset from the estimator.  This takes care of doing it for all the history.
-		//and reseting the state.
-		float newPhaseEstimate = phaseEstimator.subtractConst(numWraps*wrapValue);
-		phaseEstimate = newPhaseEstimate;
+		LOG_DEBUG(psk_soft_i, "end of stream " << tmp->streamID);
+		streamDrained(tmp->streamID);
 	}
+	delete tmp; // IMPORTANT: MUST RELEASE THE RECEIVED DATA BLOCK
+	result.packet = NULL;
+	result.shortPacket = NULL;
+	stats.pushNs += pskClockNs()-start;
+}
 
-	if (!out.empty())
+void psk_soft_i::streamDrained(const std::string& streamID)
+{
+	boost::mutex::scoped_lock lock(drainedLock);
+	drainedStreams.push_back(streamID);
+}
+
+void psk_soft_i::takeDrainedStreams()
+{
+	std::vector<std::string> drained;
 	{
-		std::vector<float>* output = (std::vector<float>*)&out;
-		softDecision_dataFloat_out->pushPacket(*output, tmp->T, tmp->EOS, tmp->streamID);
+		boost::mutex::scoped_lock lock(drainedLock);
+		if (drainedStreams.empty())
+			return;
+		drained.swap(drainedStreams);
+	}
+	for (size_t i=0; i!=drained.size(); i++)
+	{
+		std::map<std::string, PskEndedStream>::iterator ended = endedStreams.find(drained[i]);
+		if (ended!=endedStreams.end() && --ended->second.eosPending==0)
+			endedStreams.erase(ended);
 	}
-	if (!bits.empty())
-		bits_dataShort_out->pushPacket(bits, tmp->T, tmp->EOS, tmp->streamID);
-	if (!phase_vec.empty())
-		phase_dataFloat_out->pushPacket(phase_vec, tmp->T, tmp->EOS, tmp->streamID);
-	if (!sampleIndexOut.empty())
-		sampleIndex_dataShort_out->pushPacket(sampleIndexOut, tmp->T, tmp->EOS, tmp->streamID);
-	delete tmp; // IMPORTANT: MUST RELEASE THE RECEIVED DATA BLOCK
-	return NORMAL;
 }
-void psk_soft_i::resyncEnergy(const size_t& samplesPerSymbol, const size_t& numDataPts)
+
+void psk_soft_i::pushOutputSri(BULKIO::StreamSRI sri, const PskResult& result, bool signalPresent)
+{
+	if (result.presenceGating)
+		redhawk::PropertyMap::cast(sri.keywords)["SIGNAL_PRESENT"] = signalPresent;
+	sri.xdelta*=result.samplesPerBaud;
+	softDecision_dataFloat_out->pushSRI(sri);
+	sri.mode=0;
+	phase_dataFloat_out->pushSRI(sri);
+	sri.xdelta/=result.bitsPerBaud;
+	bits_dataShort_out->pushSRI(sri);
+	llr_dataFloat_out->pushSRI(sri);
+	llr_dataChar_out->pushSRI(sri);
+	sri.xdelta*=8;
+	bits_dataOctet_out->pushSRI(sri);
+}
+
+void psk_soft_i::reportStats(PskThreadStats& stats, bool force)
 {
-	symbolEnergy.assign(samplesPerSymbol,0.0);
-	if (samples.size()> numDataPts)
+	const unsigned long long now = pskClockNs();
+	if (!force && now-stats.lastReportNs<statsIntervalNs)
+		return;
 	{
-		samples.erase(samples.begin()+numDataPts,samples.end());
-		energy.erase(energy.begin()+numDataPts,energy.end());
+		boost::mutex::scoped_lock lock(statsLock);
+		statsTotals.demod += stats.demod;
+		statsTotals.pushNs += stats.pushNs;
 	}
-	index=0;
-	for (std::deque<double>::iterator i = energy.begin(); i!= energy.end(); i++)
+	stats.clear();
+	stats.lastReportNs = now;
+}
+
+void psk_soft_i::updatePerformanceStats(unsigned long long now)
+{
+	reportStats(serviceStats, true);
+	PskThreadStats totals;
+	{
+		boost::mutex::scoped_lock lock(statsLock);
+		totals = statsTotals;
+	}
+	const double seconds = (now-lastUpdateNs)*1e-9;
+	const double timingNs = totals.demod.timingNs-lastTotals.demod.timingNs;
+	const double phaseNs = totals.demod.phaseNs-lastTotals.demod.phaseNs;
+	const double slicingNs = totals.demod.slicingNs-lastTotals.demod.slicingNs;
+	const double pushNs = totals.pushNs-lastTotals.pushNs;
+	const double busyNs = std::max(timingNs+phaseNs+slicingNs+pushNs, 1.0);
+
+	//The latency below which 99% of the packets were handled.
+	unsigned long long p99Ns = 0;
+	unsigned long long count = 0;
+	for (size_t i=0; i!=latencyHistogram.size(); i++)
+	{
+		count += latencyHistogram[i];
+		if (latencyHistogram[i] && count*100>=latencyCount*99)
+		{
+			p99Ns = latencyBucketEnd(i);
+			break;
+		}
+	}
+
+	performance_stats_struct stats;
+	stats.input_samples_per_sec = (inputSamples-lastInputSamples)/seconds;
+	stats.output_symbols_per_sec = (totals.demod.symbols-lastTotals.demod.symbols)/seconds;
+	stats.timing_percent = 100*timingNs/busyNs;
+	stats.phase_percent = 100*phaseNs/busyNs;
+	stats.slicing_percent = 100*slicingNs/busyNs;
+	stats.push_percent = 100*pushNs/busyNs;
+	stats.service_latency_avg = latencyCount ? latencyNs*1e-3/latencyCount : 0.0;
+	stats.service_latency_p99 = p99Ns*1e-3;
+	stats.reset_count = resetCount;
+	stats.queue_flush_count = queueFlushCount;
+	stats.energy_resync_count = totals.demod.energyResyncs;
+	const double demodSamples = totals.demod.samples-lastTotals.demod.samples;
+	stats.gated_percent = demodSamples ? 100*(totals.demod.gatedSamples-lastTotals.demod.gatedSamples)/demodSamples : 0.0;
 	{
-		symbolEnergy[index]+=*i;
-		index++;
-		if (index==samplesPerSymbol)
-			index=0;
+		boost::mutex::scoped_lock lock(propertySetAccess);
+		performance_stats = stats;
 	}
-	count=0;
+
+	lastTotals = totals;
+	lastInputSamples = inputSamples;
+	lastUpdateNs = now;
+	std::fill(latencyHistogram.begin(), latencyHistogram.end(), 0);
+	latencyNs = 0;
+	latencyCount = 0;
 }
 
-void psk_soft_i::samplesPerBaudChanged(const std::string& id){
-   LOG_DEBUG(psk_soft_i,"samplesPerBaudChanged " << samplesPerBaud)
-   resetSamplesPerBaud=(samplesPerBaud!=symbolEnergy.size());
+void psk_soft_i::startThreads()
+{
+	//Let the current threads finish up so the streams can be handed out again.
+	stopThreads();
+	const CORBA::Long serviceCpu = threadAffinity.size()>0 ? threadAffinity[0] : -1;
+	const CORBA::Long publishCpu = threadAffinity.size()>1 ? threadAffinity[1] : -1;
+	std::vector<CORBA::Long> demodCpus;
+	if (threadAffinity.size()>2)
+		demodCpus.assign(threadAffinity.begin()+2, threadAffinity.end());
+	//Remember the CPUs the service thread is allowed before pinning it, so they can be given back.
+	if (!servicePinned)
+		pthread_getaffinity_np(pthread_self(), sizeof(unpinnedCpus), &unpinnedCpus);
+	pinThread(serviceCpu);
+	servicePinned = serviceCpu>=0;
+
+	size_t numThreads = workerThreads;
+	if (pipelineMode)
+	{
+		//The pipeline always has at least one demod thread.
+		numThreads = std::max(numThreads, size_t(1));
+		LOG_DEBUG(psk_soft_i, "pipelining with " << numThreads << " demod threads");
+		pipeline = new PskPipeline(this, numThreads, queueDepth, publishCpu, demodCpus);
+	}
+	else
+	{
+		LOG_DEBUG(psk_soft_i, "using " << numThreads << " worker threads");
+		for (size_t i=0; i!=numThreads; i++)
+			workers.push_back(new PskWorker(this, queueDepth, i<demodCpus.size() ? demodCpus[i] : -1));
+	}
+	//The threads have finished every packet, including the EOSs of the streams which have ended.
+	endedStreams.clear();
+	drainedStreams.clear();
+	nextWorker=0;
+	for (StreamMap::iterator i=streams.begin(); i!=streams.end(); i++)
+	{
+		i->second->worker = nextWorker;
+		if (numThreads)
+			nextWorker = (nextWorker+1)%numThreads;
+	}
+
+	threadsStarted = true;
+	startedWorkerThreads = workerThreads;
+	startedPipeline = pipelineMode;
+	startedQueueDepth = queueDepth;
+	startedAffinity = threadAffinity;
 }
 
-void psk_soft_i::constelationSizeChanged(const std::string& id){
-   LOG_DEBUG(psk_soft_i,"numSymbolsChanged "<<  samplesPerBaud)
-   resetNumSymbols=true;
+void psk_soft_i::stopThreads()
+{
+	for (size_t i=0; i!=workers.size(); i++)
+		delete workers[i];
+	workers.clear();
+	delete pipeline;
+	pipeline = NULL;
+	threadsStarted = false;
 }
 
-void psk_soft_i::phaseAvgChanged(const std::string& id){
-   LOG_DEBUG(psk_soft_i,"phaseAvgChanged " << phaseAvg)
-   resetPhaseAvg=true;
+void psk_soft_i::pinThread(CORBA::Long cpu)
+{
+	//A new thread inherits the service thread's CPUs, so it only has to be given back the ones set from outside
+	//if the service thread is pinned.  Otherwise affinity set by taskset, a cpuset or the device manager is left alone.
+	if (cpu<0 && !servicePinned)
+		return;
+	cpu_set_t cpus = unpinnedCpus;
+	if (cpu>=0)
+	{
+		CPU_ZERO(&cpus);
+		if (cpu<CPU_SETSIZE)
+			CPU_SET(cpu, &cpus);
+	}
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (err && cpu>=0)
+		LOG_WARN(psk_soft_i, "could not pin thread to cpu " << cpu << " - error " << err);
 }
@@ -21,69 +21,317 @@
 #define PSK_SOFT_IMPL_H
 
 #include "psk_soft_base.h"
+#include "psk_demod_core.h"
+#include "spsc_queue.h"
+
+#include <map>
+#include <sched.h>
 
 class psk_soft_i;
 
+/* Snapshot of the demod properties taken by the service thread for each packet,
+ * so the workers never read the properties while they are being configured.
+ */
+struct PskSettings
+{
+	PskSettings();
+	size_t samplesPerBaud;
+	size_t numAvg;
+	PskTimingMode timingMode;
+	double timingLoopBandwidth;
+	double timingTimeConstant;
+	//Span of the matched filter in symbols, or 0 if it is turned off.
+	size_t matchedFilterSpan;
+	double matchedFilterRollOff;
+	size_t constellationSize;
+	size_t phaseAvg;
+	PskCarrierMode carrierMode;
+	double carrierLoopBandwidth;
+	bool differentialDecoding;
+	bool fastPhase;
+	bool grayCoding;
+	bool presenceGating;
+	double presenceThreshold;
+	size_t presenceHold;
+	size_t minOutputSymbols;
+	size_t maxOutputSymbols;
+	double maxOutputLatency;
+	//PskDemodOutputs for the output ports which are connected.
+	unsigned int outputs;
+	//Incremented each time resetState is set.
+	unsigned int resets;
+};
+
+/* Demodulator state for a single input stream.
+ * Created when the first packet for a stream ID arrives and freed on EOS.
+ */
+struct PskStream
+{
+	PskStream();
+	PskDemodCore demod;
+	float sampleRate;
+	//Symbol rate from the SYMBOL_RATE keyword in the input SRI, or 0 if there is none.
+	double symbolRate;
+	//The settings demod is configured with - only valid once configured is set.
+	PskSettings applied;
+	bool configured;
+	//Index of the thread which demodulates this stream.
+	size_t worker;
+
+	//Output held back to make up minOutputSymbols - pendingSymbols symbols, the first at pendingTime.
+	PskDemodOutput pending;
+	size_t pendingSymbols;
+	BULKIO::PrecisionUTCTime pendingTime;
+	//The outputs, bits per symbol and symbol period the pending output was demodulated with.
+	unsigned int pendingOutputs;
+	size_t pendingBitsPerBaud;
+	double symbolPeriod;
+	//Number of bits pushed since the last whole octet.
+	size_t octetBits;
+	//Whether the presence gating found a signal at the end of the last packet.
+	bool signalPresent;
+};
+
+/* A stream ID whose stream has ended, while its EOS has still to be pushed.
+ * A stream with the same ID goes to the same thread until then, so the output for the ID stays in order.
+ */
+struct PskEndedStream
+{
+	//Index of the thread the stream was on.
+	size_t worker;
+	//EOS packets for the ID queued but not pushed yet.
+	size_t eosPending;
+};
 
-/* Class for calculating a linear fit for uniformly sampled data.
- * To use this class do the following:
- * 1. Specify the number of points to use in the fit (the history) and sample rate of the data.
- * 2. Pass in one data point at a time. The point which is the linear best fit given the current history is returned.
+/* Statistics gathered by a single thread, which adds them to the component totals about once a second
+ * so the threads only contend for the lock that often.
  */
-class LinearFit
+struct PskThreadStats
+{
+	PskThreadStats();
+	void clear();
+	PskDemodStats demod;
+	unsigned long long pushNs;
+	//When these were last added to the totals.
+	unsigned long long lastReportNs;
+};
+
+/* A packet waiting to be demodulated.
+ */
+struct PskJob
+{
+	//The packet from dataFloat_in or the one from dataShort_in - only one is set,
+	//and neither for the job which tells a thread to stop.
+	bulkio::InFloatPort::dataTransfer* packet;
+	bulkio::InShortPort::dataTransfer* shortPacket;
+	PskStream* stream;
+	PskSettings settings;
+};
+
+/* One output packet for each of the outputs.
+ */
+struct PskChunk
+{
+	BULKIO::PrecisionUTCTime T;
+	//PskDemodOutputs to push.
+	unsigned int outputs;
+	size_t symbols;
+	size_t bits;
+	size_t octets;
+	//Push the output SRIs ahead of this chunk, for a burst starting or ending, and whether there is a signal from here on.
+	bool pushSri;
+	bool signalPresent;
+};
+
+/* A demodulated packet waiting to be pushed.
+ * Each thread which demodulates packets reuses its results so the buffers keep their memory.
+ */
+struct PskResult
+{
+	PskResult();
+	//As in PskJob.
+	bulkio::InFloatPort::dataTransfer* packet;
+	bulkio::InShortPort::dataTransfer* shortPacket;
+	//Push the output SRIs, worked out from the packet SRI and these, ahead of chunks[sriChunk].
+	bool pushSri;
+	size_t sriChunk;
+	double samplesPerBaud;
+	size_t bitsPerBaud;
+	//Set the SIGNAL_PRESENT keyword in the output SRIs, and its value after the last chunk.
+	bool presenceGating;
+	bool signalPresent;
+	//The output is pushed as a packet per chunk, in order.  The last one carries the packet EOS.
+	PskDemodOutput out;
+	std::vector<PskChunk> chunks;
+};
+
+/* Thread which demodulates and pushes the packets for the streams assigned to it.
+ * Every stream is assigned to a single worker so its packets are processed in order.
+ */
+class PskWorker
 {
 public:
-	LinearFit(size_t numPts, float sampleRate);
-	float next(float yval);
-	float reset(size_t* numPts=NULL, float* sampleRate=NULL, bool forceHistoryClear=false);
-	float subtractConst(float yval);
+	//Holds up to queueDepth packets and runs on the given CPU (any CPU if it is negative).
+	PskWorker(psk_soft_i* parent, size_t queueDepth, CORBA::Long cpu);
+	~PskWorker();
+	//Queue a packet, waiting while the queue is full.
+	void post(const PskJob& job);
+	//Finish the queued packets and stop the thread.
+	void stop();
 private:
-	float calculateFit();
-	void calculateDenominator();
-	std::deque<float> yvals;
-	float m;
-	float b;
-	double ySum;
-	double xySum;
-	size_t n;
-	float xdelta;
-	float denominator;
-	float xAvg;
-	size_t count;
+	void run(CORBA::Long cpu);
+	psk_soft_i* parent;
+	//Circular buffer of queued jobs - numJobs of them starting at firstJob.
+	std::vector<PskJob> jobs;
+	size_t firstJob;
+	size_t numJobs;
+	bool running;
+	boost::mutex lock;
+	boost::condition_variable jobsChanged;
+	boost::thread* thread;
+	PskResult result;
+	PskThreadStats stats;
 };
 
+/* Pipelined demodulation.
+ * The service thread receives the packets and hands them to one or more demod threads,
+ * which hand the results on to a single publish thread that pushes them.
+ * The stages are connected by bounded lock free queues, so a slow consumer only holds up the
+ * publish thread until the queues fill, and the demod threads never wait on a lock.
+ * Every stream is assigned to a single demod thread so its packets are pushed in order.
+ */
+class PskPipeline
+{
+public:
+	//Each queue holds up to queueDepth packets.  Threads are pinned to the CPUs given, if they are not negative.
+	PskPipeline(psk_soft_i* parent, size_t numDemodThreads, size_t queueDepth, CORBA::Long publishCpu, const std::vector<CORBA::Long>& demodCpus);
+	~PskPipeline();
+	size_t demodThreads() const {return stages.size();}
+	//Queue a packet for a demod thread, waiting while its queue is full.
+	void post(const PskJob& job, size_t demodThread);
+	//Finish the queued packets and stop the threads.
+	void stop();
+private:
+	//How long a thread has been waiting on the queues, and the count of queue changes it last saw.
+	struct Waiter
+	{
+		Waiter();
+		unsigned int idleLoops;
+		unsigned long seenChanges;
+	};
+	struct Stage
+	{
+		Stage(size_t queueDepth);
+		SpscQueue<PskJob> jobs;
+		SpscQueue<PskResult> results;
+		boost::thread* thread;
+		PskThreadStats stats;
+	};
+	void runDemod(Stage* stage, CORBA::Long cpu);
+	void runPublish(CORBA::Long cpu);
+	//Wait for a queue to change, first by giving up the CPU and then by sleeping until another thread changes one.
+	void waitForQueue(Waiter& waiter);
+	//Wake the threads sleeping in waitForQueue, after pushing to or popping from a queue.
+	void queueChanged();
+	psk_soft_i* parent;
+	std::vector<Stage*> stages;
+	boost::thread* publishThread;
+	//Count of the pushes and pops on all the queues, and the number of threads sleeping until it changes.
+	volatile unsigned long changes;
+	volatile unsigned int sleepers;
+	boost::mutex sleepLock;
+	boost::condition_variable changed;
+};
 
 class psk_soft_i : public psk_soft_base
 {
     ENABLE_LOGGING
+    friend class PskWorker;
+    friend class PskPipeline;
     public:
         psk_soft_i(const char *uuid, const char *label);
         ~psk_soft_i();
         void constructor();
         int serviceFunction();
+        void stop() throw (CF::Resource::StopError, CORBA::SystemException);
     private:
-        static const double M_2PI = 2*M_PI;
-        std::deque<std::complex<float> > samples;
-        std::deque<double> energy;
-        std::vector<double> symbolEnergy;
-        size_t index;
-        std::complex<float> last;
-        void samplesPerBaudChanged(const std::string& id);
-        void constelationSizeChanged(const std::string& id);
-        void phaseAvgChanged(const std::string& id);
-
-        bool resetSamplesPerBaud;
-        bool resetNumSymbols;
-        bool resetPhaseAvg;
+        void timingModeChanged(const std::string& id);
+        void carrierModeChanged(const std::string& id);
+        //Hand a packet from either input on to be demodulated.
+        template <typename Packet>
+        void queuePacket(Packet* tmp);
+        //Demodulate a packet into result.  Deletes the stream state on EOS.
+        void demodPacket(const PskJob& job, PskResult& result, PskThreadStats& stats);
+        template <typename Packet>
+        void demodPacket(const PskJob& job, Packet* tmp, PskResult& result, PskThreadStats& stats);
+        //Push a demodulated packet and release it.
+        void publishPacket(PskResult& result, PskThreadStats& stats);
+        template <typename Packet>
+        void publishPacket(PskResult& result, Packet* tmp, PskThreadStats& stats);
+        //Note that the EOS for a stream ID has been pushed, from whichever thread pushed it.
+        void streamDrained(const std::string& streamID);
+        //Drop the stream IDs whose EOSs have all been pushed from endedStreams.
+        void takeDrainedStreams();
+        //Push the output SRIs for a packet's SRI.
+        void pushOutputSri(BULKIO::StreamSRI sri, const PskResult& result, bool signalPresent);
+        //Add a thread's stats to the totals if it has been a while since it last did, or now if force is set.
+        void reportStats(PskThreadStats& stats, bool force=false);
+        //Work out performance_stats from the totals gathered since the last update.
+        void updatePerformanceStats(unsigned long long now);
+        //Start the worker or pipeline threads called for by the properties.
+        void startThreads();
+        void stopThreads();
+        //Pin the calling thread to a CPU.  If cpu is negative the thread keeps the CPUs it was allowed from outside the component.
+        void pinThread(CORBA::Long cpu);
 
-        float phaseEstimate;
-        float sampleRate;
+        PskSettings settings;
+        //timingMode as set by the last configure.
+        PskTimingMode timingModeSetting;
+        //carrierMode as set by the last configure.
+        PskCarrierMode carrierModeSetting;
 
-        size_t count;
+        //Set when the last packet came from dataShort_in rather than dataFloat_in.
+        bool lastInputShort;
+        //Streams by stream ID.  Only the service thread adds to or removes from the map.
+        typedef std::map<std::string, PskStream*> StreamMap;
+        StreamMap streams;
+        //Streams which have ended by stream ID, until their EOS is pushed.  Only touched by the service thread.
+        std::map<std::string, PskEndedStream> endedStreams;
+        //Stream IDs whose EOS has been pushed since the service thread last took them out of endedStreams.
+        boost::mutex drainedLock;
+        std::vector<std::string> drainedStreams;
 
-        void resyncEnergy(const size_t& samplesPerSymbol, const size_t& numDataPts);
+        std::vector<PskWorker*> workers;
+        PskPipeline* pipeline;
+        size_t nextWorker;
+        //Threading properties the current threads were started with.
+        bool threadsStarted;
+        size_t startedWorkerThreads;
+        bool startedPipeline;
+        size_t startedQueueDepth;
+        std::vector<CORBA::Long> startedAffinity;
+        //Whether the service thread is pinned to a CPU, and the CPUs it was allowed before, which the other threads get back.
+        bool servicePinned;
+        cpu_set_t unpinnedCpus;
+        //Results for the packets demodulated by the service thread.
+        PskResult result;
 
-        LinearFit phaseEstimator;
+        //Totals reported by all the threads.
+        boost::mutex statsLock;
+        PskThreadStats statsTotals;
+        //The rest of the stats are only touched by the service thread.
+        PskThreadStats serviceStats;
+        unsigned long long inputSamples;
+        unsigned long long resetCount;
+        unsigned long long queueFlushCount;
+        //Histogram of the serviceFunction latencies since the last update.
+        std::vector<unsigned long long> latencyHistogram;
+        unsigned long long latencyNs;
+        unsigned long long latencyCount;
+        //Totals at the last update, for working out the rates.
+        PskThreadStats lastTotals;
+        unsigned long long lastInputSamples;
+        unsigned long long lastUpdateNs;
 };
 
 #endif
@@ -37,28 +37,44 @@ psk_soft_base::psk_soft_base(const char *uuid, const char *label) :
 
     dataFloat_in = new bulkio::InFloatPort("dataFloat_in");
     addPort("dataFloat_in", "Float input for complex baseband data to be demodulated. ", dataFloat_in);
+    dataShort_in = new bulkio::InShortPort("dataShort_in");
+    addPort("dataShort_in", "Complex 16 bit integer (SC16) input for baseband data to be demodulated, scaled so full scale is 1. The timing recovery reads the integers directly and only converts the samples picked as symbols.", dataShort_in);
     softDecision_dataFloat_out = new bulkio::OutFloatPort("softDecision_dataFloat_out");
     addPort("softDecision_dataFloat_out", "Complex Soft-Decision output. ", softDecision_dataFloat_out);
     bits_dataShort_out = new bulkio::OutShortPort("bits_dataShort_out");
-    addPort("bits_dataShort_out", "Short output for bits, zero or one. Differential Decoding can be turned on with a property setting.\nSymbol to Bit Mapping as follows:\n2 Symbols: 	Phase: 0 		Bit: 0\n					Phase: pi		Bit: 1\n\n4 Symbols: \n					Phase: pi/4 		Bit: 0\n					Phase: 3pi/4	Bit: 01\n					Phase: 5pi/4	Bit: 10\n					Phase: 7pi/4	Bit: 11\n\n8 Symbols: \n					Phase: 0			Bit: 000\n					Phase: pi/4		Bit: 001\n					Phase: pi/2		Bit: 010\n					Phase: 3pi/4	Bit: 011\n					Phase: pi 		Bit: 100\n					Phase: 5pi/4	Bit: 101\n					Phase: 3pi/2	Bit: 110\n					Phase: 7pi/4	Bit: 111\n\n", bits_dataShort_out);
+    addPort("bits_dataShort_out", "Short output for bits, zero or one. Differential Decoding can be turned on with a property setting.\nSymbol to Bit Mapping as follows:\n2 Symbols: 	Phase: 0 		Bit: 0\n					Phase: pi		Bit: 1\n\n4 Symbols: \n					Phase: pi/4 		Bit: 0\n					Phase: 3pi/4	Bit: 01\n					Phase: 5pi/4	Bit: 10\n					Phase: 7pi/4	Bit: 11\n\n8 Symbols: \n					Phase: 0			Bit: 000\n					Phase: pi/4		Bit: 001\n					Phase: pi/2		Bit: 010\n					Phase: 3pi/4	Bit: 011\n					Phase: pi 		Bit: 100\n					Phase: 5pi/4	Bit: 101\n					Phase: 3pi/2	Bit: 110\n					Phase: 7pi/4	Bit: 111\n\n16 Symbols: \n					Phase: n*pi/8	Bit: n, from 0000 at phase 0 to 1111 at 15pi/8\n\nThat is the numbering with grayCoding off. With grayCoding on, the point numbered n carries the bits of the Gray code n^(n>>1) instead, so neighbouring points differ in a single bit.\n\n", bits_dataShort_out);
+    bits_dataOctet_out = new bulkio::OutOctetPort("bits_dataOctet_out");
+    addPort("bits_dataOctet_out", "Octet output for bits packed most significant bit first, with the same symbol to bit mapping as bits_dataShort_out, which depends on grayCoding. Only whole octets are sent - the last partial octet of a stream is padded with zeros on EOS.", bits_dataOctet_out);
     phase_dataFloat_out = new bulkio::OutFloatPort("phase_dataFloat_out");
     addPort("phase_dataFloat_out", "Float output containing phase estimate for debugging. One phase estimate per symbol output. Phase is unwrapped.   \n", phase_dataFloat_out);
     sampleIndex_dataShort_out = new bulkio::OutShortPort("sampleIndex_dataShort_out");
     addPort("sampleIndex_dataShort_out", "Index of sample used in timing recovery chosen for symbol output. Will range from 0 to samplesPerBaud-1.  ", sampleIndex_dataShort_out);
+    llr_dataFloat_out = new bulkio::OutFloatPort("llr_dataFloat_out");
+    addPort("llr_dataFloat_out", "Float output of the max-log log likelihood ratio log(P(0)/P(1)) of each bit, in the same order as bits_dataShort_out. Positive values favour a zero. Supported for 2, 4, 8 and 16 symbols, and follows the grayCoding bit mapping.", llr_dataFloat_out);
+    llr_dataChar_out = new bulkio::OutCharPort("llr_dataChar_out");
+    addPort("llr_dataChar_out", "The LLRs of llr_dataFloat_out as signed 8 bit integers in steps of 1/4, saturated to +/-127, for FEC decoders which take quantized soft bits.", llr_dataChar_out);
 }
 
 psk_soft_base::~psk_soft_base()
 {
     delete dataFloat_in;
     dataFloat_in = 0;
+    delete dataShort_in;
+    dataShort_in = 0;
     delete softDecision_dataFloat_out;
     softDecision_dataFloat_out = 0;
     delete bits_dataShort_out;
     bits_dataShort_out = 0;
+    delete bits_dataOctet_out;
+    bits_dataOctet_out = 0;
     delete phase_dataFloat_out;
     phase_dataFloat_out = 0;
     delete sampleIndex_dataShort_out;
     sampleIndex_dataShort_out = 0;
+    delete llr_dataFloat_out;
+    llr_dataFloat_out = 0;
+    delete llr_dataChar_out;
+    llr_dataChar_out = 0;
 }
 
 /*******************************************************************************************
@@ -111,6 +127,60 @@ void psk_soft_base::loadProperties()
                 "external",
                 "property");
 
+    addProperty(timingMode,
+                "maxEnergy",
+                "timingMode",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(timingLoopBandwidth,
+                0.01,
+                "timingLoopBandwidth",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(timingTimeConstant,
+                0.0,
+                "timingTimeConstant",
+                "",
+                "readwrite",
+                "symbols",
+                "external",
+                "property");
+
+    addProperty(matchedFilter,
+                false,
+                "matchedFilter",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(matchedFilterRollOff,
+                0.35,
+                "matchedFilterRollOff",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(matchedFilterSpan,
+                8,
+                "matchedFilterSpan",
+                "",
+                "readwrite",
+                "symbols",
+                "external",
+                "property");
+
     addProperty(constelationSize,
                 4,
                 "constelationSize",
@@ -129,6 +199,24 @@ void psk_soft_base::loadProperties()
                 "external",
                 "property");
 
+    addProperty(carrierMode,
+                "powerFit",
+                "carrierMode",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(carrierLoopBandwidth,
+                0.05,
+                "carrierLoopBandwidth",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
     addProperty(differentialDecoding,
                 false,
                 "differentialDecoding",
@@ -138,6 +226,113 @@ void psk_soft_base::loadProperties()
                 "external",
                 "property");
 
+    addProperty(fastPhase,
+                false,
+                "fastPhase",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(grayCoding,
+                false,
+                "grayCoding",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(presenceGating,
+                false,
+                "presenceGating",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(presenceThreshold,
+                3.0,
+                "presenceThreshold",
+                "",
+                "readwrite",
+                "dB",
+                "external",
+                "property");
+
+    addProperty(presenceHold,
+                128,
+                "presenceHold",
+                "",
+                "readwrite",
+                "symbols",
+                "external",
+                "property");
+
+    addProperty(workerThreads,
+                0,
+                "workerThreads",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(minOutputSymbols,
+                0,
+                "minOutputSymbols",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(maxOutputSymbols,
+                0,
+                "maxOutputSymbols",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(maxOutputLatency,
+                0.0,
+                "maxOutputLatency",
+                "",
+                "readwrite",
+                "s",
+                "external",
+                "property");
+
+    addProperty(pipelineMode,
+                false,
+                "pipelineMode",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(queueDepth,
+                8,
+                "queueDepth",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
+    addProperty(threadAffinity,
+                "threadAffinity",
+                "",
+                "readwrite",
+                "",
+                "external",
+                "property");
+
     addProperty(resetState,
                 false,
                 "resetState",
@@ -147,6 +342,15 @@ void psk_soft_base::loadProperties()
                 "external",
                 "property");
 
+    addProperty(performance_stats,
+                performance_stats_struct(),
+                "performance_stats",
+                "",
+                "readonly",
+                "",
+                "external",
+                "property");
+
 }
 
 
@@ -25,6 +25,7 @@
 #include <ossie/ThreadedComponent.h>
 
 #include <bulkio/bulkio.h>
+#include "struct_props.h"
 
 class psk_soft_base : public Component, protected ThreadedComponent
 {
@@ -46,26 +47,76 @@ class psk_soft_base : public Component, protected ThreadedComponent
         unsigned short samplesPerBaud;
         /// Property: numAvg
         CORBA::ULong numAvg;
+        /// Property: timingMode
+        std::string timingMode;
+        /// Property: timingLoopBandwidth
+        double timingLoopBandwidth;
+        /// Property: timingTimeConstant
+        double timingTimeConstant;
+        /// Property: matchedFilter
+        bool matchedFilter;
+        /// Property: matchedFilterRollOff
+        double matchedFilterRollOff;
+        /// Property: matchedFilterSpan
+        unsigned short matchedFilterSpan;
         /// Property: constelationSize
         unsigned short constelationSize;
         /// Property: phaseAvg
         unsigned short phaseAvg;
+        /// Property: carrierMode
+        std::string carrierMode;
+        /// Property: carrierLoopBandwidth
+        double carrierLoopBandwidth;
         /// Property: differentialDecoding
         bool differentialDecoding;
+        /// Property: fastPhase
+        bool fastPhase;
+        /// Property: grayCoding
+        bool grayCoding;
+        /// Property: presenceGating
+        bool presenceGating;
+        /// Property: presenceThreshold
+        double presenceThreshold;
+        /// Property: presenceHold
+        CORBA::ULong presenceHold;
+        /// Property: workerThreads
+        CORBA::ULong workerThreads;
+        /// Property: minOutputSymbols
+        CORBA::ULong minOutputSymbols;
+        /// Property: maxOutputSymbols
+        CORBA::ULong maxOutputSymbols;
+        /// Property: maxOutputLatency
+        double maxOutputLatency;
+        /// Property: pipelineMode
+        bool pipelineMode;
+        /// Property: queueDepth
+        CORBA::ULong queueDepth;
+        /// Property: threadAffinity
+        std::vector<CORBA::Long> threadAffinity;
         /// Property: resetState
         bool resetState;
+        /// Property: performance_stats
+        performance_stats_struct performance_stats;
 
         // Ports
         /// Port: dataFloat_in
         bulkio::InFloatPort *dataFloat_in;
+        /// Port: dataShort_in
+        bulkio::InShortPort *dataShort_in;
         /// Port: softDecision_dataFloat_out
         bulkio::OutFloatPort *softDecision_dataFloat_out;
         /// Port: bits_dataShort_out
         bulkio::OutShortPort *bits_dataShort_out;
+        /// Port: bits_dataOctet_out
+        bulkio::OutOctetPort *bits_dataOctet_out;
         /// Port: phase_dataFloat_out
         bulkio::OutFloatPort *phase_dataFloat_out;
         /// Port: sampleIndex_dataShort_out
         bulkio::OutShortPort *sampleIndex_dataShort_out;
+        /// Port: llr_dataFloat_out
+        bulkio::OutFloatPort *llr_dataFloat_out;
+        /// Port: llr_dataChar_out
+        bulkio::OutCharPort *llr_dataChar_out;
 
     private:
 };
@@ -0,0 +1,412 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+
+/* Offline replay of a recorded capture through the psk_soft demodulator.
+ * The capture is memory mapped and handed to PskDemodCore a packet at a time straight out of the mapping,
+ * so multi-GB recordings are demodulated without being copied or read into memory up front.
+ * The demodulator is configured from psk_soft.prf.xml the same way the component is, and any property
+ * can be overridden on the command line.  The outputs are written to raw files in the same formats
+ * as the component's output ports and the throughput is reported when the file is done.
+ *
+ * Usage: psk_replay [options] input [propertyId=value ...]
+ *
+ *   -f cf32|sc16   input format - interleaved 32 bit float or 16 bit integer I/Q (default cf32)
+ *   -r rate        sample rate in Hz (default 1)
+ *   -R rate        symbol rate in Hz, as from the SYMBOL_RATE keyword (default none)
+ *   -n samples     samples per packet (default 16384)
+ *   -j threads     demodulate in parallel chunks on this many threads, 0 for one per core (default serial)
+ *   -P file        property file to take the settings from (default psk_soft.prf.xml)
+ *   -s file        write the soft decisions as interleaved 32 bit float I/Q
+ *   -b file        write the bits as one 16 bit integer per bit
+ *   -o file        write the bits packed into octets, most significant bit first
+ *   -p file        write the phase as 32 bit float
+ *   -i file        write the sample index as 16 bit integers
+ *   -l file        write the bit LLRs as 32 bit float
+ *   -q file        write the bit LLRs as 8 bit integers in steps of 1/4
+ *
+ * Only the outputs given a file are produced, as when only the matching ports are connected.
+ * With presenceGating on the bursts are written one after the other with nothing in between, and the number of bursts found is reported.
+ * With -j the capture is split into chunks which are demodulated at once and stitched back together by PskBatchDemod,
+ * which gives the same output as the serial replay after each chunk's warm-up.  Presence gating is only done serially.
+ */
+
+#include "psk_batch_demod.h"
+#include "psk_demod_core.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#ifndef PSK_SOFT_PRF
+#define PSK_SOFT_PRF "psk_soft.prf.xml"
+#endif
+
+typedef std::map<std::string, std::string> PropertyValues;
+
+static double now()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: psk_replay [-f cf32|sc16] [-r sampleRate] [-R symbolRate] [-n packetSamples] [-j threads] [-P prf]\n"
+			"                  [-s soft] [-b bits] [-o octets] [-p phase] [-i sampleIndex]\n"
+			"                  [-l llrs] [-q quantizedLlrs] input [propertyId=value ...]\n");
+}
+
+//The demodulator properties, with the defaults from psk_soft.prf.xml in case it cannot be found.
+static void defaultProperties(PropertyValues& props)
+{
+	props["samplesPerBaud"] = "10";
+	props["numAvg"] = "100";
+	props["timingMode"] = "maxEnergy";
+	props["timingLoopBandwidth"] = "0.01";
+	props["timingTimeConstant"] = "0.0";
+	props["matchedFilter"] = "false";
+	props["matchedFilterRollOff"] = "0.35";
+	props["matchedFilterSpan"] = "8";
+	props["constelationSize"] = "4";
+	props["phaseAvg"] = "50";
+	props["carrierMode"] = "powerFit";
+	props["carrierLoopBandwidth"] = "0.05";
+	props["differentialDecoding"] = "false";
+	props["fastPhase"] = "false";
+	props["grayCoding"] = "false";
+	props["presenceGating"] = "false";
+	props["presenceThreshold"] = "3.0";
+	props["presenceHold"] = "128";
+}
+
+//Pull the values of the demodulator properties out of the property file.
+//This only looks for <simple id="..."> ... <value>...</value>, which is all the prf needs.
+static bool loadProperties(const char* path, PropertyValues& props)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+	std::stringstream contents;
+	contents << file.rdbuf();
+	const std::string xml = contents.str();
+	size_t pos=0;
+	while ((pos=xml.find("<simple id=\"", pos))!=std::string::npos)
+	{
+		pos += strlen("<simple id=\"");
+		const size_t idEnd = xml.find('"', pos);
+		const size_t simpleEnd = xml.find("</simple>", pos);
+		const size_t valueStart = xml.find("<value>", pos);
+		if (idEnd==std::string::npos || simpleEnd==std::string::npos)
+			break;
+		PropertyValues::iterator prop = props.find(xml.substr(pos, idEnd-pos));
+		if (prop!=props.end() && valueStart<simpleEnd)
+		{
+			const size_t valueEnd = xml.find("</value>", valueStart);
+			prop->second = xml.substr(valueStart+strlen("<value>"), valueEnd-valueStart-strlen("<value>"));
+		}
+		pos = simpleEnd;
+	}
+	return true;
+}
+
+static bool toBool(const std::string& value)
+{
+	return value=="true" || value=="True" || value=="1";
+}
+
+static unsigned long toUnsigned(const std::string& value)
+{
+	return strtoul(value.c_str(), NULL, 10);
+}
+
+static double toDouble(const std::string& value)
+{
+	return strtod(value.c_str(), NULL);
+}
+
+//Set up the demodulator the way psk_soft_i::demodPacket does from the property values.
+static bool configure(PskDemodCore& demod, const PropertyValues& props)
+{
+	const std::string& timingMode = props.find("timingMode")->second;
+	if (timingMode=="gardner")
+		demod.setTimingMode(PSK_TIMING_GARDNER);
+	else if (timingMode=="leakyEnergy")
+		demod.setTimingMode(PSK_TIMING_LEAKY_ENERGY);
+	else if (timingMode=="maxEnergy")
+		demod.setTimingMode(PSK_TIMING_MAX_ENERGY);
+	else
+	{
+		fprintf(stderr, "timingMode %s not supported\n", timingMode.c_str());
+		return false;
+	}
+	const std::string& carrierMode = props.find("carrierMode")->second;
+	if (carrierMode=="decisionDirected")
+		demod.setCarrierMode(PSK_CARRIER_LOOP);
+	else if (carrierMode=="powerFit")
+		demod.setCarrierMode(PSK_CARRIER_POWER_FIT);
+	else
+	{
+		fprintf(stderr, "carrierMode %s not supported\n", carrierMode.c_str());
+		return false;
+	}
+	demod.setSamplesPerBaud(toUnsigned(props.find("samplesPerBaud")->second));
+	demod.setTimingLoopBandwidth(toDouble(props.find("timingLoopBandwidth")->second));
+	demod.setTimingTimeConstant(toDouble(props.find("timingTimeConstant")->second));
+	const size_t filterSpan = toBool(props.find("matchedFilter")->second) ? toUnsigned(props.find("matchedFilterSpan")->second) : 0;
+	demod.setMatchedFilter(filterSpan, toDouble(props.find("matchedFilterRollOff")->second));
+	demod.setNumAvg(toUnsigned(props.find("numAvg")->second));
+	demod.setConstellationSize(toUnsigned(props.find("constelationSize")->second));
+	demod.setPhaseAvg(toUnsigned(props.find("phaseAvg")->second));
+	demod.setCarrierLoopBandwidth(toDouble(props.find("carrierLoopBandwidth")->second));
+	demod.setDifferentialDecoding(toBool(props.find("differentialDecoding")->second));
+	demod.setFastPhase(toBool(props.find("fastPhase")->second));
+	demod.setGrayCoding(toBool(props.find("grayCoding")->second));
+	demod.setPresenceThreshold(toDouble(props.find("presenceThreshold")->second));
+	demod.setPresenceHold(toUnsigned(props.find("presenceHold")->second));
+	demod.setPresenceGating(toBool(props.find("presenceGating")->second));
+	if (demod.bitsPerBaud()==0)
+		fprintf(stderr, "constelationSize %s not supported - no bits out\n", props.find("constelationSize")->second.c_str());
+	return true;
+}
+
+static FILE* openOutput(const char* path)
+{
+	if (path==NULL)
+		return NULL;
+	FILE* file = fopen(path, "wb");
+	if (file==NULL)
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+	return file;
+}
+
+template <class T>
+static bool writeOutput(FILE* file, const std::vector<T>& data)
+{
+	if (file==NULL || data.empty())
+		return true;
+	return fwrite(&data[0], sizeof(T), data.size(), file)==data.size();
+}
+
+//Number of outputs, one bit each in PskDemodOutputs.
+static const size_t numOutputs = 7;
+
+static bool writeOutputs(FILE* files[], const PskDemodOutput& out)
+{
+	return writeOutput(files[0], out.softDecisions) && writeOutput(files[1], out.bits) && writeOutput(files[2], out.packedBits) &&
+			writeOutput(files[3], out.phase) && writeOutput(files[4], out.sampleIndex) && writeOutput(files[5], out.llrs) &&
+			writeOutput(files[6], out.quantizedLlrs);
+}
+
+//Writes the output of the parallel demodulation to the output files.
+class FileSink : public PskBatchSink
+{
+public:
+	FileSink(FILE* files[]) : files(files), symbols(0) {}
+	bool write(const PskDemodOutput& out)
+	{
+		symbols += out.numSymbols;
+		return writeOutputs(files, out);
+	}
+	FILE** files;
+	unsigned long long symbols;
+};
+
+int main(int argc, char* argv[])
+{
+	bool sc16 = false;
+	float sampleRate = 1.0;
+	double symbolRate = 0.0;
+	size_t packetSize = 16384;
+	//Threads to demodulate on, or -1 to demodulate serially.
+	long threads = -1;
+	const char* prfPath = PSK_SOFT_PRF;
+	//Soft decisions, bits, packed bits, phase, sample index, LLRs and quantized LLRs, in the order of PskDemodOutputs.
+	const char* outputPaths[numOutputs] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+	int opt;
+	while ((opt=getopt(argc, argv, "f:r:R:n:j:P:s:b:o:p:i:l:q:"))!=-1)
+	{
+		switch (opt)
+		{
+		case 'f':
+			if (strcmp(optarg, "sc16")==0)
+				sc16 = true;
+			else if (strcmp(optarg, "cf32")!=0)
+			{
+				fprintf(stderr, "format %s not supported\n", optarg);
+				return 1;
+			}
+			break;
+		case 'r': sampleRate = strtod(optarg, NULL); break;
+		case 'R': symbolRate = strtod(optarg, NULL); break;
+		case 'n': packetSize = strtoul(optarg, NULL, 10); break;
+		case 'j': threads = strtol(optarg, NULL, 10); break;
+		case 'P': prfPath = optarg; break;
+		case 's': outputPaths[0] = optarg; break;
+		case 'b': outputPaths[1] = optarg; break;
+		case 'o': outputPaths[2] = optarg; break;
+		case 'p': outputPaths[3] = optarg; break;
+		case 'i': outputPaths[4] = optarg; break;
+		case 'l': outputPaths[5] = optarg; break;
+		case 'q': outputPaths[6] = optarg; break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind>=argc || packetSize==0 || sampleRate<=0)
+	{
+		usage();
+		return 1;
+	}
+	const char* inputPath = argv[optind++];
+
+	PropertyValues props;
+	defaultProperties(props);
+	if (!loadProperties(prfPath, props))
+		fprintf(stderr, "cannot read %s - using the built in property defaults\n", prfPath);
+	for (; optind<argc; optind++)
+	{
+		const char* equals = strchr(argv[optind], '=');
+		PropertyValues::iterator prop = equals ? props.find(std::string(argv[optind], equals-argv[optind])) : props.end();
+		if (prop==props.end())
+		{
+			fprintf(stderr, "unknown property setting %s\n", argv[optind]);
+			return 1;
+		}
+		prop->second = equals+1;
+	}
+
+	PskDemodCore demod;
+	if (!configure(demod, props))
+		return 1;
+	demod.setSampleRate(sampleRate);
+	demod.setSymbolRate(symbolRate);
+	unsigned int outputs = 0;
+	FILE* outputFiles[numOutputs];
+	for (size_t i=0; i!=numOutputs; i++)
+	{
+		outputFiles[i] = openOutput(outputPaths[i]);
+		if (outputPaths[i]!=NULL && outputFiles[i]==NULL)
+			return 1;
+		if (outputFiles[i]!=NULL)
+			outputs |= 1u<<i;
+	}
+	demod.setOutputs(outputs);
+	if (threads>=0 && toBool(props.find("presenceGating")->second))
+		fprintf(stderr, "presenceGating is not used with -j - the whole capture is demodulated\n");
+
+	int fd = open(inputPath, O_RDONLY);
+	struct stat info;
+	if (fd<0 || fstat(fd, &info)!=0)
+	{
+		fprintf(stderr, "cannot open %s: %s\n", inputPath, strerror(errno));
+		return 1;
+	}
+	const size_t sampleBytes = sc16 ? 2*sizeof(short) : sizeof(std::complex<float>);
+	const size_t numSamples = info.st_size/sampleBytes;
+	void* mapping = NULL;
+	if (numSamples)
+	{
+		mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping==MAP_FAILED)
+		{
+			fprintf(stderr, "cannot map %s: %s\n", inputPath, strerror(errno));
+			return 1;
+		}
+		//The file is read once from front to back, so let the kernel read ahead and drop the pages behind.
+		madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	PskDemodOutput out;
+	//Either type of sample goes to the demodulator straight from the mapping.
+	unsigned long long symbols = 0;
+	unsigned long long bursts = 0;
+	bool ok = true;
+	double start = now();
+	PskBatchDemod batch;
+	if (threads>=0)
+	{
+		//The chunks keep to the same packets as the serial replay.
+		FileSink sink(outputFiles);
+		batch.setThreads(threads);
+		batch.setPacketSamples(packetSize);
+		if (sc16)
+			ok = batch.process(demod, static_cast<const std::complex<short>*>(mapping), numSamples, sink);
+		else
+			ok = batch.process(demod, static_cast<const std::complex<float>*>(mapping), numSamples, sink);
+		symbols = sink.symbols;
+	}
+	else
+	{
+		for (size_t i=0; i<numSamples && ok; i+=packetSize)
+		{
+			const size_t len = std::min(packetSize, numSamples-i);
+			if (sc16)
+				demod.process(static_cast<const std::complex<short>*>(mapping)+i, len, out);
+			else
+				demod.process(static_cast<const std::complex<float>*>(mapping)+i, len, out);
+			symbols += out.numSymbols;
+			for (size_t c=0; c!=out.presenceChanges.size(); c++)
+				bursts += out.presenceChanges[c].present;
+			ok = writeOutputs(outputFiles, out);
+		}
+		//The capture is over so the last partial octet goes out padded with zeros, as at end of stream.
+		out.clear();
+		demod.flushPackedBits(out);
+		ok = ok && writeOutputs(outputFiles, out);
+	}
+	double elapsed = now()-start;
+
+	for (size_t i=0; i!=numOutputs; i++)
+	{
+		if (outputFiles[i]!=NULL && fclose(outputFiles[i])!=0)
+			ok = false;
+	}
+	if (mapping!=NULL)
+		munmap(mapping, info.st_size);
+	if (!ok)
+	{
+		fprintf(stderr, "error writing the outputs: %s\n", strerror(errno));
+		return 1;
+	}
+
+	const PskDemodStats& stats = (threads>=0) ? batch.stats() : demod.stats();
+	const double demodNs = std::max(double(stats.timingNs+stats.phaseNs+stats.slicingNs), 1.0);
+	fprintf(stderr, "%llu samples, %llu symbols in %.3f s: %.2f Msamples/s, %.2f Msymbols/s\n", (unsigned long long)numSamples, symbols, elapsed,
+			numSamples/elapsed*1e-6, symbols/elapsed*1e-6);
+	fprintf(stderr, "demod time: timing %.1f%%, phase %.1f%%, slicing %.1f%%, energy resyncs %llu\n", 100*stats.timingNs/demodNs,
+			100*stats.phaseNs/demodNs, 100*stats.slicingNs/demodNs, stats.energyResyncs);
+	if (stats.gatedSamples)
+		fprintf(stderr, "presence gating: %llu bursts, %.1f%% of the samples skipped\n", bursts, 100.0*stats.gatedSamples/std::max(stats.samples, 1ULL));
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <vector>
+#include <cstddef>
+
+/* Bounded lock free queue for handing items from one producer thread to one consumer thread.
+ * The items live in a fixed ring of slots which are filled and read in place,
+ * so slots holding buffers keep their memory from one use to the next.
+ * The producer fills back() then calls push(), the consumer reads front() then calls pop().
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+	SpscQueue(size_t capacity) :
+		slots(capacity ? capacity : 1),
+		head(0),
+		tail(0)
+	{
+	}
+
+	size_t capacity() const {return slots.size();}
+
+	//Producer - the next free slot or NULL if the queue is full.
+	T* back()
+	{
+		if (tail-load(head)==slots.size())
+			return NULL;
+		return &slots[tail%slots.size()];
+	}
+	//Producer - hand the slot returned by back() to the consumer.
+	void push()
+	{
+		store(tail, tail+1);
+	}
+
+	//Consumer - the oldest item or NULL if the queue is empty.
+	T* front()
+	{
+		if (head==load(tail))
+			return NULL;
+		return &slots[head%slots.size()];
+	}
+	//Consumer - hand the slot returned by front() back to the producer.
+	void pop()
+	{
+		store(head, head+1);
+	}
+
+private:
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+
+	//Read the other side's count before touching the slots it covers,
+	//and finish with the slots before updating our own count.
+#ifdef __ATOMIC_ACQUIRE
+	static size_t load(const volatile size_t& count) {return __atomic_load_n(&count, __ATOMIC_ACQUIRE);}
+	static void store(volatile size_t& count, size_t value) {__atomic_store_n(&count, value, __ATOMIC_RELEASE);}
+#else
+	static size_t load(const volatile size_t& count) {size_t value=count; __sync_synchronize(); return value;}
+	static void store(volatile size_t& count, size_t value) {__sync_synchronize(); count=value;}
+#endif
+
+	std::vector<T> slots;
+	//Counts of the items popped and pushed.  Each is only written by one side
+	//and they are kept on separate cache lines so the two sides do not fight over them.
+	volatile size_t head;
+	char padding[64];
+	volatile size_t tail;
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+#ifndef STRUCTPROPS_H
+#define STRUCTPROPS_H
+
+/*******************************************************************************************
+
+    AUTO-GENERATED CODE. DO NOT MODIFY
+
+*******************************************************************************************/
+
+#include <ossie/CorbaUtils.h>
+#include <CF/cf.h>
+#include <ossie/PropertyMap.h>
+
+struct performance_stats_struct {
+    performance_stats_struct ()
+    {
+        input_samples_per_sec = 0.0;
+        output_symbols_per_sec = 0.0;
+        timing_percent = 0.0;
+        phase_percent = 0.0;
+        slicing_percent = 0.0;
+        push_percent = 0.0;
+        service_latency_avg = 0.0;
+        service_latency_p99 = 0.0;
+        reset_count = 0LL;
+        queue_flush_count = 0LL;
+        energy_resync_count = 0LL;
+        gated_percent = 0.0;
+    };
+
+    static std::string getId() {
+        return std::string("performance_stats");
+    };
+
+    static const char* getFormat() {
+        return "ddddddddQQQd";
+    };
+
+    double input_samples_per_sec;
+    double output_symbols_per_sec;
+    double timing_percent;
+    double phase_percent;
+    double slicing_percent;
+    double push_percent;
+    double service_latency_avg;
+    double service_latency_p99;
+    CORBA::ULongLong reset_count;
+    CORBA::ULongLong queue_flush_count;
+    CORBA::ULongLong energy_resync_count;
+    double gated_percent;
+};
+
+inline bool operator>>= (const CORBA::Any& a, performance_stats_struct& s) {
+    CF::Properties* temp;
+    if (!(a >>= temp)) return false;
+    const redhawk::PropertyMap& props = redhawk::PropertyMap::cast(*temp);
+    if (props.contains("performance_stats::input_samples_per_sec")) {
+        if (!(props["performance_stats::input_samples_per_sec"] >>= s.input_samples_per_sec)) return false;
+    }
+    if (props.contains("performance_stats::output_symbols_per_sec")) {
+        if (!(props["performance_stats::output_symbols_per_sec"] >>= s.output_symbols_per_sec)) return false;
+    }
+    if (props.contains("performance_stats::timing_percent")) {
+        if (!(props["performance_stats::timing_percent"] >>= s.timing_percent)) return false;
+    }
+    if (props.contains("performance_stats::phase_percent")) {
+        if (!(props["performance_stats::phase_percent"] >>= s.phase_percent)) return false;
+    }
+    if (props.contains("performance_stats::slicing_percent")) {
+        if (!(props["performance_stats::slicing_percent"] >>= s.slicing_percent)) return false;
+    }
+    if (props.contains("performance_stats::push_percent")) {
+        if (!(props["performance_stats::push_percent"] >>= s.push_percent)) return false;
+    }
+    if (props.contains("performance_stats::service_latency_avg")) {
+        if (!(props["performance_stats::service_latency_avg"] >>= s.service_latency_avg)) return false;
+    }
+    if (props.contains("performance_stats::service_latency_p99")) {
+        if (!(props["performance_stats::service_latency_p99"] >>= s.service_latency_p99)) return false;
+    }
+    if (props.contains("performance_stats::reset_count")) {
+        if (!(props["performance_stats::reset_count"] >>= s.reset_count)) return false;
+    }
+    if (props.contains("performance_stats::queue_flush_count")) {
+        if (!(props["performance_stats::queue_flush_count"] >>= s.queue_flush_count)) return false;
+    }
+    if (props.contains("performance_stats::energy_resync_count")) {
+        if (!(props["performance_stats::energy_resync_count"] >>= s.energy_resync_count)) return false;
+    }
+    if (props.contains("performance_stats::gated_percent")) {
+        if (!(props["performance_stats::gated_percent"] >>= s.gated_percent)) return false;
+    }
+    return true;
+}
+
+inline void operator<<= (CORBA::Any& a, const performance_stats_struct& s) {
+    redhawk::PropertyMap props;
+ 
+    props["performance_stats::input_samples_per_sec"] = s.input_samples_per_sec;
+ 
+    props["performance_stats::output_symbols_per_sec"] = s.output_symbols_per_sec;
+ 
+    props["performance_stats::timing_percent"] = s.timing_percent;
+ 
+    props["performance_stats::phase_percent"] = s.phase_percent;
+ 
+    props["performance_stats::slicing_percent"] = s.slicing_percent;
+ 
+    props["performance_stats::push_percent"] = s.push_percent;
+ 
+    props["performance_stats::service_latency_avg"] = s.service_latency_avg;
+ 
+    props["performance_stats::service_latency_p99"] = s.service_latency_p99;
+ 
+    props["performance_stats::reset_count"] = s.reset_count;
+ 
+    props["performance_stats::queue_flush_count"] = s.queue_flush_count;
+ 
+    props["performance_stats::energy_resync_count"] = s.energy_resync_count;
+ 
+    props["performance_stats::gated_percent"] = s.gated_percent;
+    a <<= props;
+}
+
+inline bool operator== (const performance_stats_struct& s1, const performance_stats_struct& s2) {
+    if (s1.input_samples_per_sec!=s2.input_samples_per_sec)
+        return false;
+    if (s1.output_symbols_per_sec!=s2.output_symbols_per_sec)
+        return false;
+    if (s1.timing_percent!=s2.timing_percent)
+        return false;
+    if (s1.phase_percent!=s2.phase_percent)
+        return false;
+    if (s1.slicing_percent!=s2.slicing_percent)
+        return false;
+    if (s1.push_percent!=s2.push_percent)
+        return false;
+    if (s1.service_latency_avg!=s2.service_latency_avg)
+        return false;
+    if (s1.service_latency_p99!=s2.service_latency_p99)
+        return false;
+    if (s1.reset_count!=s2.reset_count)
+        return false;
+    if (s1.queue_flush_count!=s2.queue_flush_count)
+        return false;
+    if (s1.energy_resync_count!=s2.energy_resync_count)
+        return false;
+    if (s1.gated_percent!=s2.gated_percent)
+        return false;
+    return true;
+}
+
+inline bool operator!= (const performance_stats_struct& s1, const performance_stats_struct& s2) {
+    return !(s1==s2);
+}
+
+#endif // STRUCTPROPS_H
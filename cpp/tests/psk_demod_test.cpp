@@ -0,0 +1,820 @@
+/*
+ * This file is protected by Copyright. Please refer to the COPYRIGHT file
+ * distributed with this source distribution.
+ *
+ * This file is part of REDHAWK psk_soft.
+ *
+ * REDHAWK psk_soft is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * REDHAWK psk_soft is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ */
+
+/* Native tests of the psk_soft demodulator on synthesized signals.
+ * BPSK, QPSK, 8-PSK and 16-PSK are synthesized at several samples per symbol with a carrier frequency offset,
+ * a sample clock offset which makes the symbol timing drift, and white Gaussian noise.  For each configuration:
+ *   - the bit error rate must be within lossDb of theory for a single sample per symbol at the same Es/N0,
+ *     and no better than theory for the whole pulse,
+ *   - the output must only rarely have to be lined up again with what was sent after a symbol or carrier phase slip,
+ *   - the LLRs must agree with the bits and give about the error rate the noise should cause,
+ *   - within maxLock symbols of a reset for a new burst the demodulator must be making the right decisions,
+ *     with the carrier phase and the sample it picks for each symbol close to what was synthesized,
+ *   - complex 16 bit integer input must give exactly the same output as the same samples as floats,
+ *   - demodulating the signal in parallel chunks must give the same output as demodulating it serially,
+ * and the throughput of PskDemodCore::process is reported.  Passing a minimum Msamples/s fails any
+ * configuration which runs slower, so performance work can be gated on speed as well.
+ *
+ * Usage: psk_demod_test [minMsamplesPerSec]
+ *
+ * Returns non-zero if any check fails.
+ */
+
+#include "psk_batch_demod.h"
+#include "psk_demod_core.h"
+
+#include <sys/time.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+
+//Carrier offset in cycles per sample and sample clock offset of the synthesized signals.
+static const double freqOffset = 1e-4;
+static const double clockOffset = 20e-6;
+//Symbols for the bit error rate runs, the symbols compared at a time when lining up the output with
+//what was sent, and the symbols to let the tracking settle before counting errors.
+static const size_t berSymbols = 100000;
+static const size_t blockSymbols = 128;
+static const size_t settleBlocks = 2;
+//Symbols before and after the reset in the lock time runs.
+static const size_t lockSymbols = 2000;
+//Furthest apart the output and the sent symbols are expected to be on a long run, where the output is
+//lined up from the start, and after a reset, where the timing recovery may hold back up to numAvg symbols.
+static const int maxLag = 4;
+static const int maxResetLag = 128;
+
+struct TestConfig
+{
+	const char* name;
+	size_t constellationSize;
+	size_t samplesPerBaud;
+	PskTimingMode timingMode;
+	PskCarrierMode carrierMode;
+	//Es/N0 for the bit error rate run, over the energy of the whole pulse.
+	double esNoDb;
+	//Largest allowed implementation loss against theory on top of the sampling loss (see samplingLossDb).
+	//The Gardner timing's interpolator averages the noise of the samples either side, which does a little better than one sample.
+	double lossDb;
+	//Most symbols allowed to get back to error free decisions after a reset.
+	size_t maxLock;
+	//Map the points to bits with Gray coding rather than the natural binary numbering.
+	bool grayCoding;
+};
+
+struct Signal
+{
+	std::vector<std::complex<float> > samples;
+	std::vector<unsigned int> symbols;
+};
+
+static double now()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+//Small deterministic generator so every run sees the same signals.
+class Random
+{
+public:
+	Random(unsigned long long seed) : state(seed*2862933555777941757ULL+3037000493ULL) {}
+	double uniform()
+	{
+		state ^= state<<13;
+		state ^= state>>7;
+		state ^= state<<17;
+		return ((state>>11)+0.5)/9007199254740992.0;
+	}
+	//Box-Muller, one value at a time.
+	double gaussian()
+	{
+		return sqrt(-2*log(uniform()))*cos(2*M_PI*uniform());
+	}
+	unsigned int below(unsigned int n)
+	{
+		return (unsigned int)(uniform()*n);
+	}
+private:
+	unsigned long long state;
+};
+
+//Synthesize numSymbols random symbols with a half sine pulse which peaks in the middle of each symbol.
+//The pulse is sampled at the drifting clock so the best sample moves through the symbol over the run.
+//The first sample is timingOffset symbols into the first symbol and the carrier starts at carrierPhase.
+//The points are at multiples of 2pi/M, plus pi/4 for QPSK, which the demodulator slices to the symbol number.
+//The noise is set for an Es/N0 of esNoDb, where Es is the energy of the whole pulse, samplesPerBaud/2 samples of peak power.
+static double noiseSigma(size_t samplesPerBaud, double esNoDb)
+{
+	return sqrt(samplesPerBaud/2.0*pow(10.0, -esNoDb/10)/2);
+}
+
+static void synthesize(Signal& signal, size_t constellationSize, size_t samplesPerBaud, size_t numSymbols, double esNoDb, unsigned long long seed,
+		double timingOffset=0.0, double carrierPhase=0.0)
+{
+	Random random(seed);
+	signal.symbols.resize(numSymbols);
+	for (size_t i=0; i!=numSymbols; i++)
+		signal.symbols[i] = random.below(constellationSize);
+	const double offset = ((constellationSize==4) ? M_PI/4 : 0.0)+carrierPhase;
+	const double sigma = noiseSigma(samplesPerBaud, esNoDb);
+	//Stop early enough that the last sample is still within the last symbol.
+	const size_t numSamples = size_t((numSymbols-1-timingOffset)*samplesPerBaud/(1+clockOffset));
+	signal.samples.resize(numSamples);
+	for (size_t k=0; k!=numSamples; k++)
+	{
+		const double t = (k*(1+clockOffset)+0.5)/samplesPerBaud+timingOffset;
+		const size_t n = size_t(t);
+		const double amplitude = sin(M_PI*(t-n));
+		const double phase = 2*M_PI*signal.symbols[n]/constellationSize+offset+2*M_PI*freqOffset*k;
+		signal.samples[k] = std::complex<float>(amplitude*cos(phase)+sigma*random.gaussian(), amplitude*sin(phase)+sigma*random.gaussian());
+	}
+}
+
+static double qFunction(double x)
+{
+	return 0.5*erfc(x/M_SQRT2);
+}
+
+static unsigned int bitCount(unsigned int value)
+{
+	unsigned int count=0;
+	for (; value; value>>=1)
+		count += value&1;
+	return count;
+}
+
+//Es/N0 lost by demodulating without a matched filter.  The energy timing takes a single sample at the peak of the pulse,
+//which has only the peak power against the noise of one sample, rather than the pulse energy.
+static double samplingLossDb(const TestConfig& config)
+{
+	return 10*log10(config.samplesPerBaud/2.0);
+}
+
+//Bits the demodulator puts out for the point numbered counterclockwise from the point at 0 (pi/4 for QPSK).
+static unsigned int pointBits(const TestConfig& config, unsigned int point)
+{
+	return config.grayCoding ? point^(point>>1) : point;
+}
+
+//Average number of bits which differ between each point and the point step points round from it.
+static double averageFlips(const TestConfig& config, size_t step)
+{
+	double flips = 0;
+	for (size_t k=0; k!=config.constellationSize; k++)
+		flips += bitCount(pointBits(config, k)^pointBits(config, (k+step)%config.constellationSize));
+	return flips/config.constellationSize;
+}
+
+//Bit error rate for coherent detection at the given Es/N0 with the configuration's mapping of points to bits.
+static double theoryBer(const TestConfig& config, double esNoDb)
+{
+	const double esNo = pow(10.0, esNoDb/10);
+	if (config.constellationSize==2)
+		return qFunction(sqrt(2*esNo));
+	if (config.constellationSize==4)
+	{
+		//I and Q are independent, so errors to either neighbour and to the opposite point are both possible.
+		const double p = qFunction(sqrt(esNo));
+		return (2*p*(1-p)*averageFlips(config, 1)+p*p*averageFlips(config, 2))/2;
+	}
+	//Nearly all symbol errors are to a neighbour.
+	const double symbolErrorRate = 2*qFunction(sqrt(2*esNo)*sin(M_PI/config.constellationSize));
+	return symbolErrorRate*averageFlips(config, 1)/log2(double(config.constellationSize));
+}
+
+//How much more Es/N0 than the sampling loss the measured bit error rate is short of theory by, in dB.
+static double implementationLossDb(const TestConfig& config, double ber)
+{
+	//The theory falls as the Es/N0 goes up, so home in on the loss it matches the measurement at.
+	double low=-10.0, high=30.0;
+	for (int i=0; i!=50; i++)
+	{
+		const double loss = (low+high)/2;
+		if (theoryBer(config, config.esNoDb-loss)<ber)
+			low = loss;
+		else
+			high = loss;
+	}
+	return (low+high)/2-samplingLossDb(config);
+}
+
+static PskDemodCore* makeDemod(const TestConfig& config)
+{
+	PskDemodCore* demod = new PskDemodCore;
+	demod->setTimingMode(config.timingMode);
+	demod->setCarrierMode(config.carrierMode);
+	demod->setSamplesPerBaud(config.samplesPerBaud);
+	demod->setNumAvg(100);
+	demod->setConstellationSize(config.constellationSize);
+	demod->setGrayCoding(config.grayCoding);
+	demod->setPhaseAvg(50);
+	demod->setSampleRate(1.0);
+	return demod;
+}
+
+//LLR statistics gathered alongside the bits.
+struct LlrStats
+{
+	//Sum over the bits of the probability the LLR gives for the hard decision being wrong.
+	double errorProbability;
+	size_t bits;
+	//Bits whose LLR sign disagrees with the hard decision or whose quantized LLR is not the rounded LLR.
+	size_t signMismatches;
+	size_t quantizationMismatches;
+};
+
+//Demodulate len samples a packet at a time, appending each symbol's bits, first bit out least significant, to values,
+//and if the demodulator puts them out and they are asked for, its soft decisions and sample indices.
+//Returns the time spent in process().
+static double demodulate(PskDemodCore& demod, const std::complex<float>* data, size_t len, std::vector<unsigned int>& values, LlrStats* llrStats=NULL,
+		std::vector<std::complex<float> >* softDecisions=NULL, std::vector<short>* sampleIndex=NULL)
+{
+	const size_t packetSize = 16384;
+	const size_t bitsPerSymbol = demod.bitsPerBaud();
+	PskDemodOutput out;
+	double elapsed = 0;
+	for (size_t i=0; i<len; i+=packetSize)
+	{
+		double start = now();
+		demod.process(data+i, std::min(packetSize, len-i), out);
+		elapsed += now()-start;
+		for (size_t j=0; j!=out.numSymbols; j++)
+		{
+			unsigned int value=0;
+			for (size_t b=0; b!=bitsPerSymbol; b++)
+				value |= (out.bits[j*bitsPerSymbol+b]&1)<<b;
+			values.push_back(value);
+		}
+		if (softDecisions)
+			softDecisions->insert(softDecisions->end(), out.softDecisions.begin(), out.softDecisions.end());
+		if (sampleIndex)
+			sampleIndex->insert(sampleIndex->end(), out.sampleIndex.begin(), out.sampleIndex.end());
+		if (llrStats)
+		{
+			for (size_t j=0; j!=out.llrs.size(); j++)
+			{
+				const float llr = out.llrs[j];
+				llrStats->errorProbability += 1.0/(1.0+exp(fabs(llr)));
+				llrStats->bits++;
+				if (llr!=0 && (llr<0)!=(out.bits[j]!=0))
+					llrStats->signMismatches++;
+				const long quantized = std::max(-127L, std::min(127L, lrint(llr*PSK_LLR_QUANTIZATION)));
+				if (labs(out.quantizedLlrs[j]-quantized)>1)
+					llrStats->quantizationMismatches++;
+			}
+		}
+	}
+	return elapsed;
+}
+
+//How the output lines up with what was sent - the output symbol i is sent symbol i+lag rotated by rotation points,
+//which is ambiguous without differential decoding.
+struct Alignment
+{
+	int lag;
+	unsigned int rotation;
+	size_t bitErrors;
+	bool operator==(const Alignment& other) const {return lag==other.lag && rotation==other.rotation;}
+	bool operator!=(const Alignment& other) const {return !(*this==other);}
+};
+
+//The alignment with the fewest bit errors for output symbols [first, first+len), sent symbol first+base+lag onwards.
+static Alignment align(const std::vector<unsigned int>& values, size_t first, size_t len, const std::vector<unsigned int>& sent, long base, int lagRange, const TestConfig& config)
+{
+	Alignment best = {0, 0, size_t(-1)};
+	for (int lag=-lagRange; lag<=lagRange; lag++)
+	{
+		const long start = long(first)+base+lag;
+		if (start<0 || start+len>sent.size())
+			continue;
+		for (unsigned int rotation=0; rotation!=config.constellationSize; rotation++)
+		{
+			size_t errors=0;
+			for (size_t i=0; i!=len; i++)
+				errors += bitCount(values[first+i]^pointBits(config, (sent[start+i]+rotation)%config.constellationSize));
+			if (errors<best.bitErrors)
+			{
+				Alignment alignment = {lag, rotation, errors};
+				best = alignment;
+			}
+		}
+	}
+	return best;
+}
+
+//Failed checks, printed after the results for each configuration.
+static std::vector<std::string> failures;
+
+static void check(bool ok, const TestConfig& config, const char* what, double value, double limit)
+{
+	if (!ok)
+	{
+		char message[256];
+		snprintf(message, sizeof(message), "FAIL %s: %s %g against limit %g", config.name, what, value, limit);
+		failures.push_back(message);
+	}
+}
+
+//Bit error rate and throughput on a long run.  The symbol timing slips a symbol whenever the clock offset
+//carries the best sample past a symbol boundary, and the carrier phase can slip a point, so the output is lined
+//up with what was sent a block at a time.  Blocks where the alignment changes are not counted but there should be few.
+static void testBer(const TestConfig& config, double minMsps)
+{
+	Signal signal;
+	synthesize(signal, config.constellationSize, config.samplesPerBaud, berSymbols, config.esNoDb, config.constellationSize*100+config.samplesPerBaud);
+	PskDemodCore* demod = makeDemod(config);
+	std::vector<unsigned int> values;
+	values.reserve(berSymbols+maxLag);
+	LlrStats llrStats = {0.0, 0, 0, 0};
+	const double elapsed = demodulate(*demod, &signal.samples[0], signal.samples.size(), values, &llrStats);
+	const size_t bitsPerSymbol = demod->bitsPerBaud();
+	delete demod;
+
+	const size_t numBlocks = values.size()/blockSymbols;
+	std::vector<Alignment> alignments(numBlocks);
+	for (size_t b=0; b!=numBlocks; b++)
+		alignments[b] = align(values, b*blockSymbols, blockSymbols, signal.symbols, 0, maxLag, config);
+	size_t bitErrors=0;
+	size_t bits=0;
+	size_t skipped=0;
+	for (size_t b=settleBlocks; b+1<numBlocks; b++)
+	{
+		if (alignments[b]!=alignments[b-1] || alignments[b]!=alignments[b+1])
+		{
+			skipped++;
+			continue;
+		}
+		bitErrors += alignments[b].bitErrors;
+		bits += blockSymbols*bitsPerSymbol;
+	}
+	const double ber = bits ? double(bitErrors)/bits : 1.0;
+	const double theory = theoryBer(config, config.esNoDb);
+	const double sampled = theoryBer(config, config.esNoDb-samplingLossDb(config));
+	const double limit = theoryBer(config, config.esNoDb-samplingLossDb(config)-config.lossDb);
+	//If the LLRs are scaled for the right noise level the error probabilities they give add up to about the bit errors
+	//expected from the noise, which leaves out the errors from timing and phase slips.
+	const double llrBer = llrStats.bits ? llrStats.errorProbability/llrStats.bits : 1.0;
+	const double msps = signal.samples.size()/elapsed*1e-6;
+	printf("%-32s %6.1f %10.2e %10.2e %10.2e %6.2f %10.2e %8lu %12.2f %12.2f", config.name, config.esNoDb, ber, theory, sampled, implementationLossDb(config, ber),
+			llrBer, (unsigned long)skipped, msps, values.size()/elapsed*1e-6);
+	check(ber<=limit, config, "bit error rate", ber, limit);
+	//No receiver does better than coherent detection with the whole pulse energy, give or take the error in the measurement.
+	const double floor = theoryBer(config, config.esNoDb+0.5);
+	check(ber>=floor, config, "bit error rate (better than theory)", ber, floor);
+	check(skipped<=numBlocks/10, config, "realigned blocks", skipped, numBlocks/10);
+	check(llrBer<=limit, config, "LLR bit error rate", llrBer, limit);
+	check(llrBer>=floor, config, "LLR bit error rate (better than theory)", llrBer, floor);
+	check(llrStats.signMismatches==0, config, "LLR sign mismatches", llrStats.signMismatches, 0);
+	check(llrStats.quantizationMismatches==0, config, "quantized LLR mismatches", llrStats.quantizationMismatches, 0);
+	if (minMsps>0)
+		check(msps>=minMsps, config, "Msamples/s", msps, minMsps);
+}
+
+//Es/N0 of the clean signals the lock time runs use, 20dB or more at the sample and more for the larger constellations,
+//so the decisions are error free once locked.
+static double cleanEsNoDb(const TestConfig& config)
+{
+	return std::max(20.0+samplingLossDb(config), config.esNoDb+10);
+}
+
+//Lock time after a reset onto a burst with a different symbol timing and carrier phase.  Each symbol of the burst is
+//checked against what was synthesized: the decision has to be right, the soft decision within a quarter of the spacing
+//of the points of the sent point, and the sample picked for it within a sample of the peak of its pulse.  The lock time
+//is the symbols up to just past the last one which is not, so a timing or carrier loop which does not follow the offsets
+//of the burst, or the clock and frequency offsets, never locks.
+static void testLock(const TestConfig& config)
+{
+	const unsigned long long seed = config.constellationSize*100+config.samplesPerBaud+1;
+	const double burstTiming = 0.25;
+	const double burstPhase = 1.0;
+	Signal signal;
+	synthesize(signal, config.constellationSize, config.samplesPerBaud, lockSymbols, cleanEsNoDb(config)+10, seed);
+	Signal burst;
+	synthesize(burst, config.constellationSize, config.samplesPerBaud, lockSymbols, cleanEsNoDb(config)+10, seed+1, burstTiming, burstPhase);
+	//Start the burst on a whole symbol's worth of samples so the new best sample is well inside the max energy window.
+	//Otherwise it can be at the edge of the window, where the timing slips back and forth a symbol in the noise.
+	//It also keeps the sample indices counting from the start of the burst.
+	const size_t resetSample = signal.samples.size()/config.samplesPerBaud*config.samplesPerBaud;
+	signal.samples.resize(resetSample);
+	const long base = signal.symbols.size();
+	signal.samples.insert(signal.samples.end(), burst.samples.begin(), burst.samples.end());
+	signal.symbols.insert(signal.symbols.end(), burst.symbols.begin(), burst.symbols.end());
+
+	PskDemodCore* demod = makeDemod(config);
+	demod->setOutputs(PSK_BITS|PSK_SOFT_DECISIONS|PSK_SAMPLE_INDEX);
+	std::vector<unsigned int> values;
+	demodulate(*demod, &signal.samples[0], resetSample, values);
+	values.clear();
+	demod->reset();
+	std::vector<std::complex<float> > softDecisions;
+	std::vector<short> sampleIndex;
+	demodulate(*demod, &signal.samples[resetSample], signal.samples.size()-resetSample, values, NULL, &softDecisions, &sampleIndex);
+	delete demod;
+
+	//Line up on the end of the burst, then check every symbol of the burst from its start.
+	//Symbols from before the reset which the timing recovery held back come out first and are not counted.
+	const size_t tail = 4*blockSymbols;
+	const size_t numSyms = config.constellationSize;
+	const double samplesPerBaud = config.samplesPerBaud;
+	const double maxPhaseError = M_PI/(2*numSyms);
+	long lock = lockSymbols;
+	if (values.size()>tail && softDecisions.size()==values.size() && sampleIndex.size()==values.size())
+	{
+		const Alignment alignment = align(values, values.size()-tail, tail, signal.symbols, base, maxResetLag, config);
+		lock = 0;
+		for (size_t i=0; i!=values.size(); i++)
+		{
+			const long n = long(i)+alignment.lag;
+			if (n<0 || size_t(n)>=burst.symbols.size())
+				continue;
+			const unsigned int point = (burst.symbols[n]+alignment.rotation)%numSyms;
+			//The soft decisions are turned back onto the points, which synthesize puts at multiples of 2pi/M plus pi/4 for QPSK.
+			const double pointPhase = 2*M_PI*point/numSyms+((numSyms==4) ? M_PI/4 : 0.0);
+			const double phaseError = remainder(arg(softDecisions[i])-pointPhase, 2*M_PI);
+			//Where synthesize puts the peak of the pulse, in samples from the start of the burst, against the symbol's own samples.
+			const double peak = ((n+0.5-burstTiming)*samplesPerBaud-0.5)/(1+clockOffset);
+			const double offset = fabs(remainder(peak-sampleIndex[i], samplesPerBaud));
+			if (values[i]!=pointBits(config, point) || fabs(phaseError)>=maxPhaseError || offset>1.0)
+				lock = n+1;
+		}
+	}
+	printf(" %8ld\n", lock);
+	check(lock<=long(config.maxLock), config, "lock symbols", lock, config.maxLock);
+}
+
+//The same signal as complex 16 bit integers has to give exactly the same output as it does as floats,
+//though the energy timing only converts the samples it picks.
+static void testSc16(const TestConfig& config)
+{
+	Signal signal;
+	synthesize(signal, config.constellationSize, config.samplesPerBaud, lockSymbols, config.esNoDb, config.constellationSize*100+config.samplesPerBaud+2);
+	//A quarter of full scale leaves room for the noise.
+	const float scale = 8192;
+	std::vector<std::complex<short> > samples(signal.samples.size());
+	std::vector<std::complex<float> > converted(signal.samples.size());
+	for (size_t i=0; i!=samples.size(); i++)
+	{
+		samples[i] = std::complex<short>(lrintf(signal.samples[i].real()*scale), lrintf(signal.samples[i].imag()*scale));
+		converted[i] = std::complex<float>(samples[i].real()*PSK_SC16_SCALE, samples[i].imag()*PSK_SC16_SCALE);
+	}
+	PskDemodCore* demod = makeDemod(config);
+	PskDemodCore* demodSc16 = makeDemod(config);
+	PskDemodOutput out, outSc16;
+	size_t mismatches=0;
+	//Odd sized packets so the symbols straddle them.
+	const size_t packetSize = 1001;
+	for (size_t i=0; i<samples.size(); i+=packetSize)
+	{
+		const size_t len = std::min(packetSize, samples.size()-i);
+		demod->process(&converted[i], len, out);
+		demodSc16->process(&samples[i], len, outSc16);
+		if (out.bits!=outSc16.bits || out.softDecisions!=outSc16.softDecisions || out.sampleIndex!=outSc16.sampleIndex)
+			mismatches++;
+	}
+	delete demod;
+	delete demodSc16;
+	check(mismatches==0, config, "SC16 packets differing from float", mismatches, 0);
+}
+
+//Collects the output of PskBatchDemod in one place.
+class OutputCollector : public PskBatchSink
+{
+public:
+	bool write(const PskDemodOutput& out)
+	{
+		all.numSymbols += out.numSymbols;
+		all.softDecisions.insert(all.softDecisions.end(), out.softDecisions.begin(), out.softDecisions.end());
+		all.bits.insert(all.bits.end(), out.bits.begin(), out.bits.end());
+		all.phase.insert(all.phase.end(), out.phase.begin(), out.phase.end());
+		all.sampleIndex.insert(all.sampleIndex.end(), out.sampleIndex.begin(), out.sampleIndex.end());
+		all.packedBits.insert(all.packedBits.end(), out.packedBits.begin(), out.packedBits.end());
+		all.llrs.insert(all.llrs.end(), out.llrs.begin(), out.llrs.end());
+		all.quantizedLlrs.insert(all.quantizedLlrs.end(), out.quantizedLlrs.begin(), out.quantizedLlrs.end());
+		return true;
+	}
+	PskDemodOutput all;
+};
+
+//Symbols of two outputs which differ by more than floating point rounding, or all of them if the outputs are not the same length.
+static size_t countDifferences(const PskDemodOutput& a, const PskDemodOutput& b, size_t bitsPerSymbol)
+{
+	if (a.numSymbols!=b.numSymbols || a.softDecisions.size()!=b.softDecisions.size() || a.bits.size()!=b.bits.size() ||
+			a.phase.size()!=b.phase.size() || a.sampleIndex.size()!=b.sampleIndex.size() || a.packedBits!=b.packedBits ||
+			a.llrs.size()!=b.llrs.size() || a.quantizedLlrs.size()!=b.quantizedLlrs.size())
+		return std::max(a.numSymbols, b.numSymbols);
+	size_t differences=0;
+	for (size_t i=0; i!=a.numSymbols; i++)
+	{
+		bool same = (a.sampleIndex[i]==b.sampleIndex[i] && std::abs(a.softDecisions[i]-b.softDecisions[i])<1e-4 && std::abs(a.phase[i]-b.phase[i])<1e-3);
+		for (size_t j=i*bitsPerSymbol; j!=(i+1)*bitsPerSymbol; j++)
+		{
+			same = same && a.bits[j]==b.bits[j];
+			if (!a.llrs.empty())
+				same = same && std::abs(a.llrs[j]-b.llrs[j])<=1e-3*std::max(1.0f, std::abs(a.llrs[j])) && std::abs(a.quantizedLlrs[j]-b.quantizedLlrs[j])<=1;
+		}
+		if (!same)
+			differences++;
+	}
+	return differences;
+}
+
+//Demodulating in parallel chunks has to give the same output as demodulating serially a packet at a time.
+//The chunks are made as short as their overlaps allow, so every boundary is exercised and any chunk which does
+//not line up with the one before is demodulated again.
+static void testBatch(const TestConfig& config)
+{
+	Signal signal;
+	synthesize(signal, config.constellationSize, config.samplesPerBaud, berSymbols/2, config.esNoDb, config.constellationSize*100+config.samplesPerBaud+3);
+	const size_t packetSize = 4096;
+	const unsigned int outputs[] = {PSK_ALL_OUTPUTS & ~(PSK_LLRS | PSK_QUANTIZED_LLRS), PSK_ALL_OUTPUTS};
+	for (size_t o=0; o!=sizeof(outputs)/sizeof(unsigned int); o++)
+	{
+		PskDemodCore* demod = makeDemod(config);
+		demod->setOutputs(outputs[o]);
+		PskDemodCore serial(*demod);
+		PskDemodOutput expected, out;
+		OutputCollector collector;
+		for (size_t i=0; i<signal.samples.size(); i+=packetSize)
+		{
+			serial.process(&signal.samples[i], std::min(packetSize, signal.samples.size()-i), out);
+			collector.write(out);
+		}
+		out.clear();
+		serial.flushPackedBits(out);
+		collector.write(out);
+		expected = collector.all;
+		collector.all = PskDemodOutput();
+
+		PskBatchDemod batch;
+		batch.setThreads(4);
+		batch.setPacketSamples(packetSize);
+		batch.setChunkSamples(1);
+		batch.process(*demod, &signal.samples[0], signal.samples.size(), collector);
+		const size_t differences = countDifferences(expected, collector.all, demod->bitsPerBaud());
+		delete demod;
+		check(differences==0, config, outputs[o]==PSK_ALL_OUTPUTS ? "batch symbols differing from serial with LLRs" : "batch symbols differing from serial",
+				differences, 0);
+	}
+}
+
+//With every output turned on each one has to hold an entry per symbol, or per bit, for float and SC16 input alike,
+//both at the configured oversampling and without any, where every sample is a symbol.
+static void testOutputLengths(const TestConfig& config)
+{
+	Signal signal;
+	synthesize(signal, config.constellationSize, config.samplesPerBaud, blockSymbols*4, cleanEsNoDb(config), config.constellationSize*100+config.samplesPerBaud+6);
+	std::vector<std::complex<short> > sc16(signal.samples.size());
+	for (size_t i=0; i!=sc16.size(); i++)
+		sc16[i] = std::complex<short>(short(signal.samples[i].real()*8192), short(signal.samples[i].imag()*8192));
+	const size_t samplesPerBaud[] = {config.samplesPerBaud, 1};
+	//The Gardner timing needs at least two samples per symbol.
+	const size_t numRates = (config.timingMode==PSK_TIMING_GARDNER) ? 1 : 2;
+	for (size_t r=0; r!=numRates; r++)
+	{
+		PskDemodCore* demod = makeDemod(config);
+		demod->setSamplesPerBaud(samplesPerBaud[r]);
+		demod->setOutputs(PSK_ALL_OUTPUTS);
+		const size_t bitsPerSymbol = demod->bitsPerBaud();
+		PskDemodOutput out;
+		for (size_t pass=0; pass!=2; pass++)
+		{
+			if (pass==0)
+				demod->process(&signal.samples[0], signal.samples.size(), out);
+			else
+				demod->process(&sc16[0], sc16.size(), out);
+			const size_t numSymbols = out.numSymbols;
+			const size_t perSymbol[] = {out.softDecisions.size(), out.phase.size(), out.sampleIndex.size()};
+			const size_t perBit[] = {out.bits.size(), out.llrs.size(), out.quantizedLlrs.size()};
+			check(numSymbols!=0, config, "output symbols", numSymbols, 1);
+			for (size_t i=0; i!=3; i++)
+			{
+				check(perSymbol[i]==numSymbols, config, "output entries per symbol", perSymbol[i], numSymbols);
+				check(perBit[i]==numSymbols*bitsPerSymbol, config, "output entries per bit", perBit[i], numSymbols*bitsPerSymbol);
+			}
+		}
+		delete demod;
+	}
+}
+
+//Bursts between stretches of noise with presence gating on.  Each burst has to be found within a few symbols
+//of where it starts and let go of within the hold after it ends, and demodulated from a reset to error free decisions
+//within the warm-up.  The noise in between has to be skipped without putting out any symbols.
+static void testPresence(const TestConfig& config)
+{
+	const unsigned long long seed = config.constellationSize*100+config.samplesPerBaud+4;
+	const size_t quietSymbols = 3000;
+	const size_t holdSymbols = 128;
+	const double sigma = noiseSigma(config.samplesPerBaud, cleanEsNoDb(config));
+	Random random(seed);
+	std::vector<std::complex<float> > samples;
+	Signal bursts[2];
+	size_t starts[2], ends[2];
+	for (size_t b=0; b!=2; b++)
+	{
+		for (size_t i=0; i!=quietSymbols*config.samplesPerBaud; i++)
+			samples.push_back(std::complex<float>(sigma*random.gaussian(), sigma*random.gaussian()));
+		//The second burst has a different timing and carrier phase.  Its timing is chosen so no two samples tie for the most energy,
+		//which the max energy timing flips between in the noise if the burst starts where they fall either side of a symbol.
+		synthesize(bursts[b], config.constellationSize, config.samplesPerBaud, lockSymbols, cleanEsNoDb(config), seed+b+1, 0.33*b, 1.0*b);
+		starts[b] = samples.size();
+		samples.insert(samples.end(), bursts[b].samples.begin(), bursts[b].samples.end());
+		ends[b] = samples.size();
+	}
+	for (size_t i=0; i!=quietSymbols*config.samplesPerBaud/3; i++)
+		samples.push_back(std::complex<float>(sigma*random.gaussian(), sigma*random.gaussian()));
+
+	PskDemodCore* demod = makeDemod(config);
+	demod->setPresenceGating(true);
+	demod->setPresenceHold(holdSymbols);
+	demod->setOutputs(PSK_BITS);
+	const size_t bitsPerSymbol = demod->bitsPerBaud();
+	//The Gardner timing's warm-up allows for a far slower lock than it needs, so it has to lock within the first half of the burst.
+	const size_t warmup = std::min(demod->warmupSymbols(), lockSymbols/2);
+	std::vector<unsigned int> values;
+	std::vector<PskPresenceChange> changes;
+	PskDemodOutput out;
+	const size_t packetSize = 4096;
+	for (size_t i=0; i<samples.size(); i+=packetSize)
+	{
+		demod->process(&samples[i], std::min(packetSize, samples.size()-i), out);
+		for (size_t c=0; c!=out.presenceChanges.size(); c++)
+		{
+			PskPresenceChange change = out.presenceChanges[c];
+			change.sample += i;
+			change.symbol += values.size();
+			changes.push_back(change);
+		}
+		for (size_t j=0; j!=out.numSymbols; j++)
+		{
+			unsigned int value=0;
+			for (size_t b=0; b!=bitsPerSymbol; b++)
+				value |= (out.bits[j*bitsPerSymbol+b]&1)<<b;
+			values.push_back(value);
+		}
+	}
+	const double gated = double(demod->stats().gatedSamples)/samples.size();
+	delete demod;
+
+	check(changes.size()==4, config, "presence changes", changes.size(), 4);
+	if (changes.size()!=4)
+		return;
+	//Symbols put out past the end of a burst, up to the hold and the block the signal went in.
+	const size_t lateSymbols = holdSymbols+2*32;
+	//The start is placed to within a few symbols.
+	const size_t startSamples = 8*config.samplesPerBaud;
+	for (size_t b=0; b!=2; b++)
+	{
+		const PskPresenceChange& start = changes[2*b];
+		const PskPresenceChange& end = changes[2*b+1];
+		check(start.present && !end.present, config, "presence change order", end.present, 0);
+		check(start.sample+long(startSamples)>=long(starts[b]) && start.sample<=long(starts[b]+startSamples), config, "burst start samples off",
+				start.sample-long(starts[b]), startSamples);
+		check(end.sample>=long(ends[b]) && end.sample<=long(ends[b]+lateSymbols*config.samplesPerBaud), config, "burst end samples late",
+				end.sample-long(ends[b]), lateSymbols*config.samplesPerBaud);
+		check(end.symbol-start.symbol<=lockSymbols+lateSymbols, config, "burst symbols", end.symbol-start.symbol, lockSymbols+lateSymbols);
+		//Line up on the burst just after the warm-up, then the lock time is the symbols up to just past the last error.
+		//Starting from a reset it can take up to the warm-up.  Later on the clock offset can slip the timing a symbol.
+		const size_t tail = 4*blockSymbols;
+		const size_t last = start.symbol+warmup+tail;
+		long lock = lockSymbols;
+		if (end.symbol>=last)
+		{
+			const Alignment alignment = align(values, last-tail, tail, bursts[b].symbols, -long(start.symbol), maxResetLag, config);
+			lock = 0;
+			for (size_t i=start.symbol; i!=last; i++)
+			{
+				const long sent = long(i)-long(start.symbol)+alignment.lag;
+				if (sent>=0 && size_t(sent)<bursts[b].symbols.size() && values[i]!=pointBits(config, (bursts[b].symbols[sent]+alignment.rotation)%config.constellationSize))
+					lock = sent+1;
+			}
+		}
+		check(lock<=long(warmup), config, "burst lock symbols", lock, warmup);
+	}
+	const double minGated = double(2*quietSymbols+quietSymbols/3-2*lateSymbols)*config.samplesPerBaud/samples.size();
+	check(gated>=minGated, config, "gated fraction", gated, minGated);
+}
+
+//A weak burst, 5 dB over the noise at the sample, in a packet cut a few symbols after it starts.
+//That is too little of the last presence block of the packet to find it, so it is found at the start of the next one,
+//but the start has to be placed back in the packet before and the symbols from there put out first.
+static void testPresenceEdge(const TestConfig& config)
+{
+	const unsigned long long seed = config.constellationSize*100+config.samplesPerBaud+5;
+	const size_t quietSymbols = 3000;
+	const size_t burstSymbols = 1000;
+	const size_t cutSymbols = 4;
+	const double esNoDb = 5.0+samplingLossDb(config);
+	const double sigma = noiseSigma(config.samplesPerBaud, esNoDb);
+	Random random(seed);
+	std::vector<std::complex<float> > samples;
+	for (size_t i=0; i!=quietSymbols*config.samplesPerBaud; i++)
+		samples.push_back(std::complex<float>(sigma*random.gaussian(), sigma*random.gaussian()));
+	Signal burst;
+	synthesize(burst, config.constellationSize, config.samplesPerBaud, burstSymbols, esNoDb, seed+1);
+	const size_t start = samples.size();
+	samples.insert(samples.end(), burst.samples.begin(), burst.samples.end());
+	for (size_t i=0; i!=quietSymbols*config.samplesPerBaud; i++)
+		samples.push_back(std::complex<float>(sigma*random.gaussian(), sigma*random.gaussian()));
+
+	PskDemodCore* demod = makeDemod(config);
+	demod->setPresenceGating(true);
+	demod->setOutputs(PSK_BITS);
+	const size_t cut = start+cutSymbols*config.samplesPerBaud;
+	std::vector<PskPresenceChange> changes;
+	size_t numSymbols = 0;
+	PskDemodOutput out;
+	const size_t packets[] = {0, cut, samples.size()};
+	for (size_t p=0; p!=2; p++)
+	{
+		demod->process(&samples[packets[p]], packets[p+1]-packets[p], out);
+		for (size_t c=0; c!=out.presenceChanges.size(); c++)
+		{
+			PskPresenceChange change = out.presenceChanges[c];
+			change.sample += packets[p];
+			change.symbol += numSymbols;
+			changes.push_back(change);
+		}
+		numSymbols += out.numSymbols;
+	}
+	delete demod;
+
+	check(changes.size()==2, config, "edge presence changes", changes.size(), 2);
+	if (changes.size()!=2)
+		return;
+	const size_t startSamples = 2*config.samplesPerBaud;
+	check(changes[0].present && changes[0].symbol==0, config, "edge presence change order", changes[0].present, 1);
+	check(changes[0].sample+long(startSamples)>=long(start) && changes[0].sample<=long(start+startSamples), config, "edge burst start samples off",
+			changes[0].sample-long(start), startSamples);
+	check(changes[1].symbol>=burstSymbols, config, "edge burst symbols", changes[1].symbol, burstSymbols);
+}
+
+int main(int argc, char* argv[])
+{
+	const double minMsps = (argc>1) ? strtod(argv[1], NULL) : 0.0;
+	const TestConfig configs[] = {
+		{"BPSK sps 4",                         2,   4, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT,  9.0, 2.0,  16, false},
+		{"BPSK sps 8",                         2,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 12.0, 2.0,  16, false},
+		{"BPSK sps 10",                        2,  10, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 13.0, 2.0,  16, false},
+		{"QPSK sps 4",                         4,   4, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 12.0, 1.5,  16, false},
+		{"QPSK sps 8",                         4,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 15.0, 1.5,  16, false},
+		{"QPSK sps 10",                        4,  10, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 16.0, 1.5,  16, false},
+		{"8PSK sps 4",                         8,   4, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 17.0, 1.5,  16, false},
+		{"8PSK sps 8",                         8,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 20.0, 1.5,  16, false},
+		{"8PSK sps 10",                        8,  10, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 21.0, 1.5,  16, false},
+		{"QPSK sps 8 leakyEnergy",             4,   8, PSK_TIMING_LEAKY_ENERGY, PSK_CARRIER_POWER_FIT, 15.0, 1.5,  50, false},
+		{"8PSK sps 8 leakyEnergy",             8,   8, PSK_TIMING_LEAKY_ENERGY, PSK_CARRIER_POWER_FIT, 20.0, 1.5,  50, false},
+		{"QPSK sps 8 gardner",                 4,   8, PSK_TIMING_GARDNER,      PSK_CARRIER_POWER_FIT, 15.0, 0.0,  32, false},
+		{"8PSK sps 8 gardner",                 8,   8, PSK_TIMING_GARDNER,      PSK_CARRIER_POWER_FIT, 20.0, 0.0,  32, false},
+		{"BPSK sps 8 decisionDirected",        2,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_LOOP,      12.0, 2.0,  16, false},
+		{"QPSK sps 8 decisionDirected",        4,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_LOOP,      15.0, 1.5,  16, false},
+		{"8PSK sps 8 decisionDirected",        8,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_LOOP,      20.0, 1.5,  16, false},
+		{"QPSK sps 8 Gray",                    4,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 15.0, 1.5,  16, true},
+		{"8PSK sps 8 Gray",                    8,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 20.0, 1.5,  16, true},
+		{"8PSK sps 8 Gray decisionDirected",   8,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_LOOP,      20.0, 1.5,  16, true},
+		{"16PSK sps 8",                       16,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 26.0, 1.5,  16, false},
+		{"16PSK sps 8 Gray",                  16,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_POWER_FIT, 26.0, 1.5,  16, true},
+		{"16PSK sps 8 decisionDirected",      16,   8, PSK_TIMING_MAX_ENERGY,   PSK_CARRIER_LOOP,      26.0, 1.5,  16, false},
+	};
+	printf("%-32s %6s %10s %10s %10s %6s %10s %8s %12s %12s %8s\n", "config", "Es/N0", "BER", "theory", "sampled", "loss", "LLR BER", "realign", "Msamples/s", "Msymbols/s", "lock");
+	size_t reported=0;
+	for (size_t i=0; i!=sizeof(configs)/sizeof(TestConfig); i++)
+	{
+		testBer(configs[i], minMsps);
+		testLock(configs[i]);
+		testSc16(configs[i]);
+		testBatch(configs[i]);
+		testOutputLengths(configs[i]);
+		testPresence(configs[i]);
+		testPresenceEdge(configs[i]);
+		for (; reported!=failures.size(); reported++)
+			printf("%s\n", failures[reported].c_str());
+	}
+	if (!failures.empty())
+	{
+		printf("%lu checks failed\n", (unsigned long)failures.size());
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -127,6 +127,7 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
         self.soft = sb.DataSink()
         self.bits = sb.DataSink()
         self.phase = sb.DataSink()
+        self.octets = sb.DataSink()
         
         #setup my components
         self.setupComponent()
@@ -135,12 +136,14 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
         self.src.start()
         self.soft.start()
         self.bits.start()
+        self.octets.start()
         
         #do the connections
         self.src.connect(self.comp)        
         self.comp.connect(self.soft,usesPortName='softDecision_dataFloat_out')
         self.comp.connect(self.bits,usesPortName='bits_dataShort_out')
         self.comp.connect(self.phase,usesPortName='phase_dataFloat_out')
+        self.comp.connect(self.octets,usesPortName='bits_dataOctet_out')
         
     def tearDown(self):
         """Finish the unit test - this is run after every method that starts with test
@@ -152,6 +155,7 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
         self.soft.stop()
         self.bits.stop()
         self.phase.stop()            
+        self.octets.stop()
         self.comp.releaseObject()
         ossie.utils.testing.ScaComponentTestCase.tearDown(self)
 
@@ -175,7 +179,193 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
     def testNonDiffDecode8PSK(self):
         self.NonDiffDecodeTest(8)
 
-    def DiffDecodeTest(self,numSyms):
+    def testNonDiffDecode16PSK(self):
+        self.NonDiffDecodeTest(16)
+
+    def testFastNonDiffDecode16PSK(self):
+        self.NonDiffDecodeTest(16,fastPhase=True)
+
+    def testFastDiffDecodeBPSK(self):
+        self.DiffDecodeTest(2,fastPhase=True)
+
+    def testFastDiffDecodeQPSK(self):
+        self.DiffDecodeTest(4,fastPhase=True)
+
+    def testFastDiffDecode8PSK(self):
+        self.DiffDecodeTest(8,fastPhase=True)
+
+    def testFastNonDiffDecodeBPSK(self):
+        self.NonDiffDecodeTest(2,fastPhase=True)
+
+    def testFastNonDiffDecodeQPSK(self):
+        self.NonDiffDecodeTest(4,fastPhase=True)
+
+    def testFastNonDiffDecode8PSK(self):
+        self.NonDiffDecodeTest(8,fastPhase=True)
+
+    def testPipelineNonDiffDecode8PSK(self):
+        self.comp.pipelineMode=True
+        self.comp.queueDepth=2
+        self.NonDiffDecodeTest(8)
+
+    def testOutputPacketSizing(self):
+        #symbols held back for the minimum packet size are not pushed without an EOS
+        self.comp.minOutputSymbols=50
+        self.comp.maxOutputSymbols=64
+        self.NonDiffDecodeTest(8)
+
+    def testGardnerNonDiffDecode8PSK(self):
+        #the gardner timing outputs symbols straight away so skip the ones before it locks
+        self.comp.timingMode="gardner"
+        self.NonDiffDecodeTest(8,skip=100)
+
+    def testLeakyNonDiffDecode8PSK(self):
+        self.comp.timingMode="leakyEnergy"
+        self.comp.timingTimeConstant=20
+        self.NonDiffDecodeTest(8)
+
+    def testDecisionDirectedNonDiffDecode8PSK(self):
+        self.comp.carrierMode="decisionDirected"
+        self.NonDiffDecodeTest(8)
+
+    def testMatchedFilterNonDiffDecode8PSK(self):
+        #the filter delays the symbols by half its length, and as it is not matched to the rectangular pulses
+        #the symbols only come out close to the input
+        self.comp.matchedFilter=True
+        self.comp.matchedFilterSpan=8
+        self.NonDiffDecodeTest(8,skip=5,lag=4,tolerance=0.3)
+
+    def testPackedBits(self):
+        data, syms = genPsk(1000, sampPerBaud=8,numSyms=8,differential=False)
+        self.comp.samplesPerBaud=8
+        self.comp.constelationSize=8
+        self.comp.numAvg=100
+        out, bits, phase = self.main(toReal(data),100)
+        octets = self.octets.getData()
+        if isinstance(octets, str):
+            octets = [ord(x) for x in octets]
+        #only whole octets are sent without an EOS
+        expected = []
+        for i in xrange(len(bits)/8):
+            val = 0
+            for bit in bits[8*i:8*i+8]:
+                val = (val<<1) | bit
+            expected.append(val)
+        self.assertEqual(list(octets), expected)
+
+    def testGrayCoding16PSK(self):
+        data, syms = genPsk(1000, sampPerBaud=8,numSyms=16,differential=False)
+        self.comp.samplesPerBaud=8
+        self.comp.constelationSize=16
+        self.comp.numAvg=100
+        self.comp.grayCoding=True
+        out, bits, phase = self.main(toReal(data),100)
+        #undo the Gray coding of each symbol's bits, first bit out least significant, to get the point numbers
+        points = []
+        for i in xrange(len(bits)/4):
+            val = sum([bits[4*i+j]<<j for j in xrange(4)])
+            point = 0
+            while val:
+                point ^= val
+                val >>= 1
+            points.append(point)
+        sent = [int(round(cmath.phase(x)*16/(2*math.pi)))%16 for x in syms]
+        #the points are only known up to a rotation, so compare the steps from one symbol to the next
+        steps = [(b-a)%16 for a, b in zip(points, points[1:])]
+        sentSteps = [(b-a)%16 for a, b in zip(sent, sent[1:])]
+        self.assertEqual(steps[1:], sentSteps[1:len(steps)])
+
+    def testStreamReuseWorkerThreads(self):
+        #a stream ID reused straight after its EOS has to come out after the EOS, so it must stay on the same worker
+        self.comp.workerThreads=2
+        self.comp.samplesPerBaud=8
+        self.comp.constelationSize=2
+        self.comp.numAvg=100
+        self.comp.differentialDecoding=True
+        #differentially decoded, a constant phase gives zeros and a phase flipping every symbol gives ones
+        zeros = [complex(1,0)]*(8*1000)
+        ones = []
+        for i in xrange(1000):
+            ones.extend([complex(1-2*(i%2),0)]*8)
+        self.src.push(toReal(zeros), EOS=True, streamID='reused', complexData=True, sampleRate=100)
+        self.src.push(toReal(ones), EOS=True, streamID='reused', complexData=True, sampleRate=100)
+        bits = []
+        count = 0
+        while count<100:
+            newBits = self.bits.getData()
+            if newBits:
+                bits.extend(newBits)
+                count = 0
+            time.sleep(.01)
+            count+=1
+        bitString = ''.join([str(x) for x in bits])
+        print "found %s zeros and %s ones" %(bitString.count('0'), bitString.count('1'))
+        self.assertTrue(bitString.count('0') > 800)
+        self.assertTrue(bitString.count('1') > 800)
+        #the first symbol of each stream is relative to an arbitrary reference, so allow one stray bit where the streams meet
+        onesStart = bitString.find('1'*10)
+        self.assertTrue(onesStart > 800)
+        self.assertEqual(bitString[onesStart:].count('0'), 0)
+
+    def testLlrs8PSK(self):
+        llrs = sb.DataSink()
+        llrs.start()
+        self.comp.connect(llrs,usesPortName='llr_dataFloat_out')
+        data, syms = genPsk(1000, sampPerBaud=8,numSyms=8,differential=False)
+        self.comp.samplesPerBaud=8
+        self.comp.constelationSize=8
+        self.comp.numAvg=100
+        out, bits, phase = self.main(toReal(data),100)
+        llrData = llrs.getData()
+        llrs.stop()
+        #one LLR per bit, positive for a zero
+        self.assertEqual(len(llrData), len(bits))
+        self.assertEqual([int(x<0) for x in llrData], list(bits))
+
+    def testShortInput8PSK(self):
+        #half of full scale comes out with an amplitude of 0.5
+        shortSrc = sb.DataSource(dataFormat='short')
+        shortSrc.connect(self.comp, providesPortName='dataShort_in')
+        shortSrc.start()
+        data, syms = genPsk(1000, sampPerBaud=8,numSyms=8,differential=False)
+        self.comp.samplesPerBaud=8
+        self.comp.constelationSize=8
+        self.comp.numAvg=100
+        shortSrc.push([int(round(16384*x)) for x in toReal(data)], complexData=True, sampleRate=100)
+        out=[]
+        count=0
+        while count<100:
+            newOut = self.soft.getData()
+            if newOut:
+                out.extend(newOut)
+                count=0
+            time.sleep(.01)
+            count+=1
+        shortSrc.stop()
+        outCx = toCx(out)
+        #there is an arbitrary phase offset for non-differentially decoded data, so try each rotation
+        maxError = min(max([abs(2*x*complex(math.cos(theta), math.sin(theta))-y) for x, y in zip(outCx[1:],syms[1:])])
+                       for theta in [k*math.pi/4 for k in xrange(8)])
+        print "found max error of %s" %maxError
+        assert(maxError < 1e-3)
+
+    def testPresenceGating(self):
+        #only the burst is demodulated, not the noise either side of it, and the last SRI marks the end of the burst
+        data, syms = genPsk(1000, sampPerBaud=8,numSyms=8,differential=False)
+        noise = [complex(.01*random.gauss(0,1), .01*random.gauss(0,1)) for i in xrange(8*1000)]
+        self.comp.samplesPerBaud=8
+        self.comp.constelationSize=8
+        self.comp.numAvg=100
+        self.comp.presenceGating=True
+        out, bits, phase = self.main(toReal(noise+data+noise),100)
+        #the burst goes on for the hold after the signal goes, and the energy timing holds back up to numAvg symbols
+        numOut = len(out)/2
+        print "found %s symbols" %numOut
+        assert(1000-100 <= numOut <= 1000+self.comp.presenceHold+32)
+        keywords = dict((kw.id, any.from_any(kw.value)) for kw in self.soft.sri().keywords)
+        self.assertEqual(keywords.get('SIGNAL_PRESENT'), False)
+
+    def DiffDecodeTest(self,numSyms,fastPhase=False):
         data, syms = genPsk(1000, sampPerBaud=8,numSyms=numSyms,differential=True)
         
         dataReal=[]
@@ -192,6 +382,7 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
         self.comp.constelationSize=numSyms
         self.comp.numAvg=100
         self.comp.differentialDecoding=True
+        self.comp.fastPhase=fastPhase
         dataReal = toReal(data)
         out, bits, phase = self.main(dataReal,100)
         outCx = toCx(out)
@@ -203,7 +394,7 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
         print "found max error of %s" %maxError
         assert(maxError < 1e-3)
 
-    def NonDiffDecodeTest(self,numSyms):
+    def NonDiffDecodeTest(self,numSyms,fastPhase=False,skip=1,lag=0,tolerance=1e-3):
         data, syms = genPsk(1000, sampPerBaud=8,numSyms=numSyms,differential=False)
 
         dataReal=[]
@@ -212,6 +403,7 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
         self.comp.constelationSize=numSyms
         self.comp.numAvg=100
         self.comp.differentialDecoding=False
+        self.comp.fastPhase=fastPhase
         dataReal = toReal(data)
         out, bits, phase = self.main(dataReal,100)
         outCx = toCx(out)
@@ -226,16 +418,18 @@ class ComponentTests(ossie.utils.testing.ScaComponentTestCase):
             thetas = [math.pi/4, 3*math.pi/4, 5*math.pi/4, 7*math.pi/4]
         if numSyms ==8:
             thetas = [0, math.pi/4, math.pi/2,3*math.pi/4,math.pi, 5*math.pi/4,3*math.pi/2, 7*math.pi/4]
+        if numSyms ==16:
+            thetas = [2*math.pi*x/16 for x in xrange(16)]
 
         for theta in thetas:
             #don't include the first output as it is relative to an arbitrary reference
             #with the differential decoding
             cxScaler= complex(math.cos(theta), math.sin(theta))
             outCxRotated = [cxScaler*x for x in outCx]
-            maxError = min(maxError, max([abs(x-y) for x, y in zip(outCxRotated[1:],syms[1:])]))
+            maxError = min(maxError, max([abs(x-y) for x, y in zip(outCxRotated[skip:],syms[skip-lag:])]))
             
         print "found max error of %s" %maxError
-        assert(maxError < 1e-3)        
+        assert(maxError < tolerance)
 
 
     def main(self,inData, sampleRate, complexData = True):